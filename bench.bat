@@ -0,0 +1,8 @@
+@echo off
+echo Running benchmarks.
+
+rem ### Synthetic text of several kinds and sizes, every pair of encodings.
+txu /BENCH
+
+rem ### The same conversions on a file of real text, if one is given.
+if not "%1"=="" txu /BENCH %1
@@ -1,7 +1,7 @@
 echo off
-rem ### Compile txu.cpp to create txu.exe
+rem ### Compile txu.cpp and txulib.cpp to create txu.exe
 rem ### Assumes Microsoft C++ compiler is installed and in the system PATH.
 
 echo Building txu.exe from C++ source code.
 
-cl /nologo /EHsc /Ox /W3 /MT txu.cpp
+cl /nologo /EHsc /Ox /W3 /MT txu.cpp txulib.cpp
@@ -0,0 +1,45 @@
+@echo off
+rem ### Compile txu.cpp and txulib.cpp to create a release txu.exe with
+rem ### link time code generation and profile guided optimization:  an
+rem ### instrumented txu.exe is run on the /BENCH corpus, and the profile
+rem ### it gathers then decides how the final txu.exe is optimized.
+rem ### Files of real text to train on as well may be given, as in
+rem ### "build_pgo corpus1.txt corpus2.txt".
+rem ### Assumes Microsoft C++ compiler is installed and in the system PATH.
+
+echo Building instrumented txu.exe from C++ source code.
+
+if exist txu.pgd del txu.pgd
+if exist txu*.pgc del txu*.pgc
+
+cl /nologo /EHsc /Ox /GL /W3 /MT /c txu.cpp txulib.cpp
+if errorlevel 1 goto failed
+link /nologo /LTCG /GENPROFILE /OUT:txu.exe txu.obj txulib.obj
+if errorlevel 1 goto failed
+
+echo Training on the benchmark corpus.
+
+rem ### The SIMD kernels are chosen at run time, so the suite is run once
+rem ### with each set the CPU has, to profile the code around all of them.
+rem ### Sets the CPU lacks are refused, and leave nothing in the profile.
+txu /BENCH=1 /SIMD=NONE
+txu /BENCH=1 /SIMD=SSE2
+txu /BENCH=1 /SIMD=AVX2
+
+:train
+if "%1"=="" goto optimize
+txu /BENCH=1 %1
+shift
+goto train
+
+:optimize
+echo Building optimized txu.exe from the profile.
+
+link /nologo /LTCG /USEPROFILE /OUT:txu.exe txu.obj txulib.obj
+if errorlevel 1 goto failed
+goto end
+
+:failed
+echo Build failed.
+
+:end
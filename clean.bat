@@ -2,5 +2,8 @@
 echo Removing test files and build output files.
 if exist txu.exe del txu.exe
 if exist txu.obj del txu.obj
+if exist txulib.obj del txulib.obj
 if exist txu.pdb del txu.pdb
+if exist txu.pgd del txu.pgd
+if exist txu*.pgc del txu*.pgc
 if exist __out.* del __out.*
@@ -15,3 +15,9 @@ txu /O=UTF16   ansitext.txt __out.utf16
 echo Testing UTF-16BE.
 txu /O=UTF16BE ansitext.txt __out.utf16be
 
+echo Testing UTF-32.
+txu /O=UTF32   ansitext.txt __out.utf32
+
+echo Testing UTF-32BE.
+txu /O=UTF32BE ansitext.txt __out.utf32be
+
@@ -0,0 +1,105 @@
+# tests/txutest.cmake
+# Runs one test of txu for ctest (see CMakeLists.txt):  converts
+# an input file and compares the output with the bytes expected.
+#
+#   cmake -DTXU=txu -DIN=file -DEXPECT=file [-D...] -P txutest.cmake
+#
+# TXU      The txu program.
+# ARGS     Its options, separated by spaces.
+# IN       The input file.
+# EXPECT   The file the output must be the same as.
+# SAME     Instead of EXPECT, more options for a second run of
+#          the same conversion, whose output must be the same
+#          as that of the first.
+# REPEAT   Make the input PREFIX and then IN this many times
+#          over, for text longer than the reads and chunks.
+#          IN must then have no zero bytes.
+#          With REPEAT_EXPECT, the expected output is made the
+#          same way from EXPECT.
+# PREFIX   Text to put before the repeated input, if any.
+# STDIN    If ON, read the input from stdin and take the output
+#          from stdout, rather than naming the files.
+# RESULT   The exit code txu must give.  Default 0.
+# ERROR    A regular expression its messages must match.
+# MEASURE  If ON, instead of converting, check that txu /MEASURE
+#          with ARGS reports as many code points as /COUNT.
+# WORK     Directory for the files made by the test.
+
+cmake_minimum_required(VERSION 3.15)
+
+if(NOT DEFINED RESULT)
+   set(RESULT 0)
+endif()
+separate_arguments(ARGS)
+separate_arguments(SAME)
+file(MAKE_DIRECTORY ${WORK})
+file(REMOVE ${WORK}/out ${WORK}/out2)
+
+# Reads the bytes of a file into 'Var'.  file(READ) alone
+# would leave out the CR of each CR LF.
+function(read_bytes File Var)
+   file(READ ${File} Hex HEX)
+   string(REGEX MATCHALL ".." Hex "${Hex}")
+   set(Codes)
+   foreach(Byte ${Hex})
+      math(EXPR Code "0x${Byte}")
+      list(APPEND Codes ${Code})
+   endforeach()
+   string(ASCII ${Codes} Text)
+   set(${Var} "${Text}" PARENT_SCOPE)
+endfunction()
+
+set(In ${IN})
+if(DEFINED REPEAT)
+   read_bytes(${IN} Text)
+   string(REPEAT "${Text}" ${REPEAT} Text)
+   file(WRITE ${WORK}/in "${PREFIX}${Text}")
+   set(In ${WORK}/in)
+endif()
+
+if(MEASURE)
+   execute_process(COMMAND ${TXU} ${ARGS} -MEASURE ${In} OUTPUT_VARIABLE Measured RESULT_VARIABLE Result)
+   execute_process(COMMAND ${TXU} ${ARGS} -COUNT ${In} OUTPUT_VARIABLE Counted)
+   string(REGEX MATCH "[0-9]+ code points" Measured "${Measured}")
+   string(REGEX MATCH "[0-9]+ code points" Counted "${Counted}")
+   if(NOT "${Result}" STREQUAL "0" OR NOT Measured OR NOT "${Measured}" STREQUAL "${Counted}")
+      message(FATAL_ERROR "txu ${ARGS} -MEASURE gave ${Result}, '${Measured}', not '${Counted}'")
+   endif()
+   return()
+endif()
+
+# Runs txu on the input with the given options, writing 'Out'.
+function(run_txu Out)
+   if(STDIN)
+      execute_process(COMMAND ${TXU} ${ARGN}
+         INPUT_FILE ${In} OUTPUT_FILE ${Out} ERROR_VARIABLE Messages RESULT_VARIABLE Result)
+   else()
+      execute_process(COMMAND ${TXU} ${ARGN} ${In} ${Out}
+         OUTPUT_VARIABLE Messages ERROR_VARIABLE Messages RESULT_VARIABLE Result)
+   endif()
+   if(NOT "${Result}" STREQUAL "${RESULT}")
+      message(FATAL_ERROR "txu ${ARGN} gave ${Result}, not ${RESULT}:\n${Messages}")
+   endif()
+   if(DEFINED ERROR AND NOT "${Messages}" MATCHES "${ERROR}")
+      message(FATAL_ERROR "txu ${ARGN} did not say '${ERROR}':\n${Messages}")
+   endif()
+endfunction()
+
+run_txu(${WORK}/out ${ARGS})
+
+if(DEFINED SAME)
+   run_txu(${WORK}/out2 ${ARGS} ${SAME})
+   set(Expected ${WORK}/out2)
+elseif(REPEAT_EXPECT)
+   read_bytes(${EXPECT} Text)
+   string(REPEAT "${Text}" ${REPEAT} Text)
+   file(WRITE ${WORK}/expect "${PREFIX}${Text}")
+   set(Expected ${WORK}/expect)
+else()
+   set(Expected ${EXPECT})
+endif()
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK}/out ${Expected} RESULT_VARIABLE Differ)
+if(Differ)
+   message(FATAL_ERROR "${WORK}/out is not the same as ${Expected}")
+endif()
@@ -1,7 +1,8 @@
 //---------------------------------------------------------------
 // txu.cpp
-// A program to convert text files between the ANSI, UTF-8, and
-// UTF-16 character formats.
+// A program to convert text files between the ANSI, UTF-8,
+// UTF-16 and UTF-32 character formats.  The conversion itself is done by
+// libtxu (txulib.cpp); this file reads and writes the files.
 //
 // (C) Copyright 2011 Ammon R. Campbell.
 // You may use this program freely for non-commercial purposes
@@ -11,53 +12,61 @@
 
 #include <stdio.h>
 #include <ctype.h>
-#include <tchar.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <new>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <functional>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef TXU_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TXU_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "txuport.h"
+#include "txulib.h"
 
 // Global variables.
 bool   bVerbose = false;   // True if verbose output enabled.
-size_t nLines = 0;         // Total number of lines read.
-size_t nChars = 0;         // Total number of characters read.
-
-// Type to indicate one of several possible encodings for a text file.
-enum TxEncoding
-{
-   FMT_UNKNOWN = 0,        // Encoding is not known, not initialized, error, etc.
-   FMT_AUTO,               // An attempt should be made to automatically
-                           // determine the encoding of the text.
-   FMT_ANSI,               // Old fashioned 8-bit ANSI ASCII text.
-   FMT_UTF8,               // UTF-8 encoding.  The width of a character varies.
-   FMT_UTF16,              // UTF-16 little endian encoding.
-   FMT_UTF16BE             // UTF-16 big endian encoding.
-};
-
-//----------------------------------------------------------
-// Retrieve human-readable name of TxEncoding value.
-//----------------------------------------------------------
-const _TCHAR * TxEncodingToName(TxEncoding t)
-{
-   if (t == FMT_AUTO)      return _T("AUTO");
-   if (t == FMT_ANSI)      return _T("ANSI");
-   if (t == FMT_UTF8)      return _T("UTF8");
-   if (t == FMT_UTF16)     return _T("UTF16");
-   if (t == FMT_UTF16BE)   return _T("UTF16BE");
-   return _T("UNKNOWN");
-}
-
-//----------------------------------------------------------
-// Retrieve TxEncoding for the given name.
-//----------------------------------------------------------
-TxEncoding TxEncodingFromName(const _TCHAR *t)
-{
-   if (_tcsicmp(t, _T("AUTO")) == 0)      return FMT_AUTO;
-   if (_tcsicmp(t, _T("ANSI")) == 0)      return FMT_ANSI;
-   if (_tcsicmp(t, _T("UTF8")) == 0)      return FMT_UTF8;
-   if (_tcsicmp(t, _T("UTF16")) == 0)     return FMT_UTF16;
-   if (_tcsicmp(t, _T("UTF16BE")) == 0)   return FMT_UTF16BE;
-   return FMT_UNKNOWN;
-}
+size_t nMapLimit = 1024;   // Largest input file to map into memory, in MB.
+size_t nBufSize = 1024;    // Size of the blocks read and written, in KB.
+size_t nThreads = 1;       // Number of threads converting each file.
+size_t nJobs = 0;          // Number of files converted at once in batch mode.
+size_t nBench = 0;         // Number of times each benchmark is run, or 0 for none.
+FILE  *fpStats = NULL;     // Where /STATS=JSON records go, or NULL for none.
+bool   bResume = false;    // True to keep /RESUME checkpoints.
+bool   bMeasure = false;   // True to measure the output instead of writing it.
+bool   bCount = false;     // True to count the lines and characters of the input only.
+TxCompression Compress = COMPRESS_NONE;   // Compression of the output (/COMPRESS).
 
 //----------------------------------------------------------
 // msg:
@@ -71,6 +80,35 @@ static void msg(const _TCHAR *msg1, const _TCHAR *msg2=NULL)
    _ftprintf(stderr, _T("\n"));
 }
 
+//----------------------------------------------------------
+// IsOption:
+// Checks whether a command line argument is an option, that
+// is starts with a '-' or '/' switch indicator.  A lone '-'
+// is a filename, standing for stdin.  Outside Windows, where
+// a path also starts with '/', that is only an option if the
+// letters after it run to the end or to an '=' or ':', as in
+// /OUTFORMAT=UTF8, and it is not the name of a file; '-'
+// can always be used instead.
+//----------------------------------------------------------
+static bool IsOption(const _TCHAR *szArg)
+{
+   if (szArg[0] == '-')
+      return szArg[1] != '\0';
+   if (szArg[0] != '/')
+      return false;
+#ifdef _WIN32
+   return true;
+#else
+   const _TCHAR *p = szArg + 1;
+   while (isalpha(static_cast<unsigned char>(*p)))
+      p++;
+   if (p == szArg + 1 || (*p != '\0' && *p != '=' && *p != ':'))
+      return false;
+   struct stat st;
+   return stat(szArg, &st) != 0;
+#endif
+}
+
 //----------------------------------------------------------
 // OptionNameIs:
 // Checks the name of a command line option.
@@ -128,7 +166,7 @@ static const _TCHAR * OptionValue(
    const _TCHAR *szArg  // Pointer to command line argument string to be examined.
    )
 {
-   static _TCHAR* empty = _T("");
+   static const _TCHAR *empty = _T("");
    static _TCHAR p[1024] = _T("");
 
    if (szArg == NULL)
@@ -149,7 +187,7 @@ static const _TCHAR * OptionValue(
       _tcscpy_s(p, 1024, szArg);
 
       // Remove trailing spaces (if any).
-      while (_tcslen(p) > 0 && p[_tcslen(p) - 1] == ' ' || p[_tcslen(p) - 1] == '\t')
+      while (_tcslen(p) > 0 && (p[_tcslen(p) - 1] == ' ' || p[_tcslen(p) - 1] == '\t'))
          p[_tcslen(p) - 1] = '\0';
 
       // Remove trailing quote (if any).
@@ -163,464 +201,3409 @@ static const _TCHAR * OptionValue(
    return empty;
 }
 
+//----------------------------------------------------------
+// OptionNumber:
+// Retrieves the value portion of a command line option of
+// the form OPTIONNAME=NUMBER as an unsigned number.
+//
+// Returns true if successful, false if the value is missing
+// or is not a number.
+//----------------------------------------------------------
+static bool OptionNumber(
+   const _TCHAR *szArg, // Pointer to command line argument string to be examined.
+   size_t & Value       // Receives the value of the option.
+   )
+{
+   const _TCHAR *szValue = OptionValue(szArg);
+   if (szValue[0] < '0' || szValue[0] > '9')
+      return false;
+
+   _TCHAR *szEnd = NULL;
+   unsigned long n = _tcstoul(szValue, &szEnd, 10);
+   if (szEnd == NULL || *szEnd != '\0')
+      return false;
+
+   Value = n;
+   return true;
+}
+
 //----------------------------------------------------------
 // Show command line usage information for the program.
 //----------------------------------------------------------
 static void Usage(void)
 {
-   printf("Usage:  txu [options] infile [outfile]\n");
+   printf("Usage:  txu [options] [infile|-] [outfile]\n");
+   printf("        txu [options] /OUTDIR=dir|/NAME=rule [/LIST=file] [files|dir]\n");
    printf("\n");
    printf("  Reads infile and writes output to stdout, or to outfile if given.\n");
-   printf("  Note that UTF <-> ANSI conversions always use US/ANSI code page.\n");
+   printf("  With no infile, or '-', reads stdin, so txu can be used in a pipe.\n");
+   printf("  An outfile of '-' also means stdout.\n");
+   printf("  Given a wildcard, a directory, /LIST or /RECURSE, converts each\n");
+   printf("  file found in batch mode, several at once.\n");
+   printf("  ANSI is ISO 8859-1 (Latin 1) unless another /CODEPAGE is given.\n");
+   printf("  Options may also start with '-', as in -OUTFORMAT=UTF8.\n");
    printf("\n");
    printf("Options:\n");
    printf("  /INFORMAT=f   Specify format of input file, where 'f' is one of\n");
-   printf("                AUTO, ANSI, UTF8, UTF16, UTF16BE.  Default AUTO.\n");
+   printf("                AUTO, ANSI, UTF8, UTF16, UTF16BE, UTF32, UTF32BE.\n");
+   printf("                Default AUTO.\n");
+   printf("                AUTO reads the BOM, or with none guesses from samples.\n");
    printf("  /OUTFORMAT=f  Specify format of output file, where 'f' is one of\n");
-   printf("                ANSI, UTF8, UTF16, UTF16BE.  Default ANSI.\n");
+   printf("                ANSI, UTF8, UTF16, UTF16BE, UTF32, UTF32BE.\n");
+   printf("                Default ANSI.\n");
+   printf("  /MAPLIMIT=n   Map input files of up to 'n' MB into memory instead\n");
+   printf("                of reading them as a stream.  0 disables.  Default 1024.\n");
+   printf("  /BUFSIZE=n    Read and write in blocks of 'n' KB.  Default 1024.\n");
+   printf("  /THREADS=n    Convert large files with 'n' threads in parallel.\n");
+   printf("                0 uses one thread per CPU.  Default 1.\n");
+   printf("  /JOBS=n       Convert 'n' files at once in batch mode.\n");
+   printf("                0 uses one per CPU.  Default 0.\n");
+   printf("  /LIST=file    Convert the files named in 'file', one per line.\n");
+   printf("  /RECURSE      Search subdirectories for input files too.\n");
+   printf("  /OUTDIR=dir   Write batch mode output to 'dir', keeping the layout\n");
+   printf("                of subdirectories.  Default next to each input.\n");
+   printf("  /NAME=rule    Name batch mode output files by 'rule', where '*'\n");
+   printf("                is the input name without extension, e.g. *.utf8.txt\n");
+   printf("  /CACHE=file   Remember the files converted in batch mode in 'file',\n");
+   printf("                and skip those whose input and output are unchanged.\n");
+   printf("  /BENCH[=n]    Time the conversions instead, repeating each 'n' times\n");
+   printf("                (default 3):  on infile to every encoding, or with no\n");
+   printf("                infile on synthetic text of several kinds and sizes.\n");
+   printf("  /CODEPAGE=n   Use code page 'n' for ANSI text, one of 437, 850, 852,\n");
+   printf("                866, 874, 1250-1258, 20866, 21866, 28591, 28592, 28595,\n");
+   printf("                28605.  Default 28591 (ISO 8859-1).\n");
+   printf("  /EOL=e        Write line endings 'e', one of LF, CRLF, CR, or KEEP\n");
+   printf("                to leave them as they are.  Default KEEP.\n");
+   printf("  /ONERROR=a    What to do about invalid input, or characters not in\n");
+   printf("                the code page, where 'a' is one of STOP, REPLACE\n");
+   printf("                (with U+FFFD, or '?' in ANSI), SKIP.  Default STOP.\n");
+   printf("  /SIMD=k       Select the SIMD kernels, where 'k' is one of AUTO, NONE,\n");
+   printf("                SSE2, AVX2, NEON.  Default AUTO (best the CPU supports).\n");
+   printf("  /STATS=JSON   Write a line of JSON for each file to stderr:  bytes in\n");
+   printf("                and out, time reading, converting and writing, MB/s\n");
+   printf("                and invalid sequences.  Batch mode adds the totals.\n");
+   printf("  /STATSFILE=f  Write the /STATS=JSON records to file 'f' instead.\n");
+   printf("  /MEASURE      Print the size the output would take, in bytes and code\n");
+   printf("                points, with the BOM, instead of writing it.\n");
+   printf("  /COUNT        Print the lines, code points and bytes of the input,\n");
+   printf("                counted without decoding it, instead of converting it.\n");
+   printf("  /RESUME       Save checkpoints in outfile.txuresume as the conversion\n");
+   printf("                goes, and if one is found, carry on from there instead\n");
+   printf("                of starting over.  Needs an infile and an outfile.\n");
+   printf("  /COMPRESS=c   Compress the output with 'c', one of GZIP, ZSTD, or\n");
+   printf("                NONE.  Default NONE.  Input compressed with gzip or\n");
+   printf("                zstd is decompressed as it is read, with no option.\n");
+   printf("                Either needs txu built with it (see README.md).\n");
    printf("  /VERBOSE      Verbose output to stderr.  Useful for debugging.\n");
 }
 
+// Clock for the timings reported by /STATS.
+typedef std::chrono::steady_clock TxClock;
+
 //----------------------------------------------------------
-// Reads one character from the given file assuming the
-// given encoding, placing the result into 'Char'.
-// Returns true if successful, false if end of file.
+// Returns the number of seconds since 'Start'.
 //----------------------------------------------------------
-static bool ReadChar(FILE *fpIn, TxEncoding InFmt, unsigned & Char)
+static double SecondsSince(TxClock::time_point Start)
 {
-   Char = 0;
-   unsigned char c;
+   return std::chrono::duration<double>(TxClock::now() - Start).count();
+}
 
-   // The magic numbers below are from the UTF specs.
-   switch(InFmt)
-   {
-      case FMT_ANSI:
-         {
-            if (fread(&c, 1, 1, fpIn) != 1)
-               return false;
-            Char = c;
-         }
-         break;
+//----------------------------------------------------------
+// Heap allocation counter, for checking that a conversion
+// allocates nothing once its workspace (see TxWorkspace) has
+// grown to the size the files need.  It is built only with
+// TXU_COUNT_ALLOCS defined, as it replaces the global
+// operator new, and then reported by /VERBOSE and
+// /STATS=JSON.  Every allocation in the process is counted,
+// so the count of a file is its own only with /JOBS=1.
+//----------------------------------------------------------
+#ifdef TXU_COUNT_ALLOCS
+static std::atomic<unsigned long long> nHeapAllocs(0);
 
-      case FMT_UTF8:
-         {
-            if (fread(&c, 1, 1, fpIn) != 1)
-               return false;
-            if ((c & 0x80) == 0)
-            {
-               Char = c;
-            }
-            else if ((c & 0xE0) == 0xC0)
-            {
-               Char = (c & ~0xE0);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-            }
-            else if ((c & 0xF0) == 0xE0)
-            {
-               Char = (c & ~0xF0);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-            }
-            else if ((c & 0xF8) == 0xF0)
-            {
-               Char = (c & ~0xF8);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-            }
-            else if ((c & 0xFC) == 0xF8)
-            {
-               Char = (c & ~0xFC);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-            }
-            else if ((c & 0xFE) == 0xFC)
-            {
-               Char = (c & ~0xFE);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-               if (fread(&c, 1, 1, fpIn) != 1)
-                  return false;
-               Char = (Char << 6) + (c & 0x3F);
-            }
-            else
-            {
-               _ftprintf(stderr, "\nInvalid character sequence for UTF-8 at file offset %ld\n", ftell(fpIn));
-               msg("Invalid character sequence for UTF-8");
-               return false;
-            }
-         }
-         break;
+void * operator new(size_t Size)
+{
+   nHeapAllocs++;
+   void *p = malloc(Size > 0 ? Size : 1);
+   if (p == NULL)
+      throw std::bad_alloc();
+   return p;
+}
 
-      case FMT_UTF16:
-         {
-            if (fread(&c, 1, 1, fpIn) != 1)
-               return false;
-            Char = c;
-            if (fread(&c, 1, 1, fpIn) != 1)
-               return false;
-            Char = Char + static_cast<unsigned short>(c) * 256;
-         }
-         break;
+void * operator new[](size_t Size)
+{
+   return operator new(Size);
+}
 
-      case FMT_UTF16BE:
-         {
-            if (fread(&c, 1, 1, fpIn) != 1)
-               return false;
-            Char = c;
-            if (fread(&c, 1, 1, fpIn) != 1)
-               return false;
-            Char = Char * 256 + static_cast<unsigned short>(c);
-         }
-         break;
+void operator delete(void *p) noexcept
+{
+   free(p);
+}
 
-      default:
-         return false;
-   }
+void operator delete[](void *p) noexcept
+{
+   free(p);
+}
 
-   nChars++;
-   return true;
+void operator delete(void *p, size_t) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+   free(p);
+}
+#endif
+
+//----------------------------------------------------------
+// Returns the number of heap allocations so far, or 0 if
+// they are not being counted.
+//----------------------------------------------------------
+static unsigned long long HeapAllocs(void)
+{
+#ifdef TXU_COUNT_ALLOCS
+   return nHeapAllocs;
+#else
+   return 0;
+#endif
 }
 
 //----------------------------------------------------------
-// Read a line of text from the given file assuming the
-// given encoding, placing the results into 'Line'.
-// Returns true if successful, false if end of file.
+// A thread kept for running one job at a time in the
+// background:  a read for a reader, a write for a writer, or
+// a piece of the input in /THREADS mode.  The thread is
+// started with the first job and then waits for the next
+// one, so that no thread is started for each block.
 //----------------------------------------------------------
-static bool ReadLine(FILE *fpIn, TxEncoding InFmt, std::vector<unsigned> &Line)
+struct TxHelper
 {
-   Line.clear();
+   std::mutex                 Lock;      // Guards pJob and bQuit.
+   std::condition_variable    Changed;   // Signalled when pJob or bQuit changes.
+   void                     (*pJob)(void *);  // Job being run, or NULL when idle.
+   void                      *pArg;      // Argument of pJob.
+   bool                       bQuit;     // True to end the thread.
+   std::thread                Thread;    // The thread, once started.
 
-   unsigned c;
-   if (!ReadChar(fpIn, InFmt, c))
-      return false;
-   while (c != '\n')
+   TxHelper() : pJob(NULL), pArg(NULL), bQuit(false) {}
+   ~TxHelper();
+};
+
+//----------------------------------------------------------
+// Body of a helper thread:  runs each job it is given, until
+// told to quit.
+//----------------------------------------------------------
+static void HelperMain(TxHelper *pHelper)
+{
+   std::unique_lock<std::mutex> Lock(pHelper->Lock);
+   for (;;)
    {
-      Line.push_back(c);
-      if (!ReadChar(fpIn, InFmt, c))
-         return false;
+      while (pHelper->pJob == NULL && !pHelper->bQuit)
+         pHelper->Changed.wait(Lock);
+      if (pHelper->pJob == NULL)
+         return;
+      Lock.unlock();
+      pHelper->pJob(pHelper->pArg);
+      Lock.lock();
+      pHelper->pJob = NULL;
+      pHelper->Changed.notify_all();
    }
-   Line.push_back(c);
-   return true;
 }
 
 //----------------------------------------------------------
-// Write character to the given output file, using the
-// given encoding.
-// Returns true if successful, false if write fails.
+// Hands a job to a helper, which must be idle, starting its
+// thread if it has none yet.
 //----------------------------------------------------------
-static bool WriteChar(
-   FILE *fpOut,
-   TxEncoding OutFmt,
-   unsigned Char
-   )
+static void StartJob(TxHelper &Helper, void (*pJob)(void *), void *pArg)
+{
+   std::lock_guard<std::mutex> Lock(Helper.Lock);
+   Helper.pJob = pJob;
+   Helper.pArg = pArg;
+   if (!Helper.Thread.joinable())
+      Helper.Thread = std::thread(HelperMain, &Helper);
+   Helper.Changed.notify_all();
+}
+
+//----------------------------------------------------------
+// Waits for a helper's job, if any, to be done.
+//----------------------------------------------------------
+static void WaitJob(TxHelper &Helper)
+{
+   std::unique_lock<std::mutex> Lock(Helper.Lock);
+   while (Helper.pJob != NULL)
+      Helper.Changed.wait(Lock);
+}
+
+TxHelper::~TxHelper()
 {
-   // The magic numbers below are from the UTF specs.
-   switch(OutFmt)
    {
-      case FMT_ANSI:
-         {
-            unsigned char c = static_cast<unsigned char>(Char);
-            if (fwrite(&c, 1, 1, fpOut) != 1)
-               return false;
-         }
-         break;
+      std::lock_guard<std::mutex> Guard(Lock);
+      bQuit = true;
+      Changed.notify_all();
+   }
+   if (Thread.joinable())
+      Thread.join();
+}
 
-      case FMT_UTF8:
-         {
-            if (Char <= 0x7F)
-            {
-               unsigned char c = static_cast<unsigned char>(Char);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-            }
-            else if (Char <= 0x7FF)
-            {
-               unsigned char c = 0xC0 | static_cast<unsigned char>(Char & 0x1F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 5;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-            }
-            else if (Char <= 0xFFFF)
-            {
-               unsigned char c = 0xE0 | static_cast<unsigned char>(Char & 0x0F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 4;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-            }
-            else if (Char <= 0x1FFFFF)
-            {
-               unsigned char c = 0xF0 | static_cast<unsigned char>(Char & 0x7);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 3;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-            }
-            else if (Char <= 0x3FFFFFF)
-            {
-               unsigned char c = 0xF8 | static_cast<unsigned char>(Char & 0x3);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 2;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-            }
-            else if (Char <= 0x7FFFFFFF)
-            {
-               unsigned char c = 0xFC | static_cast<unsigned char>(Char & 0x1);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 1;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-               Char >>= 6;
-               c = 0x80 | static_cast<unsigned char>(Char & 0x3F);
-               if (fwrite(&c, 1, 1, fpOut) != 1)
-                  return false;
-            }
-         }
-         break;
+//----------------------------------------------------------
+// Compressed files.  Input compressed with gzip or zstd (see
+// CheckCompression) is decompressed as it is read, ahead of
+// the decoder, and with /COMPRESS the output is compressed
+// as it is written, so a compressed file is converted in one
+// pass, a block at a time, with no decompressed copy of it
+// anywhere.  Each method is only built in with TXU_WITH_ZLIB
+// or TXU_WITH_ZSTD defined, and zlib or libzstd linked.
+//----------------------------------------------------------
 
-      case FMT_UTF16:
-         {
-            unsigned char c1 = static_cast<unsigned char>(Char & 0xFF);
-            unsigned char c2 = static_cast<unsigned char>((Char >> 8) & 0xFF);
-            if (fwrite(&c1, 1, 1, fpOut) != 1)
-               return false;
-            if (fwrite(&c2, 1, 1, fpOut) != 1)
-               return false;
-         }
-         break;
+// Size of the buffer of compressed bytes.
+const size_t PACK_BUFSIZE = 256 * 1024;
 
-      case FMT_UTF16BE:
-         {
-            unsigned char c1 = static_cast<unsigned char>((Char >> 8) & 0xFF);
-            unsigned char c2 = static_cast<unsigned char>(Char & 0xFF);
-            if (fwrite(&c1, 1, 1, fpOut) != 1)
-               return false;
-            if (fwrite(&c2, 1, 1, fpOut) != 1)
-               return false;
-         }
-         break;
+// Most bytes passed to zlib in one call, as it counts them
+// in an unsigned int.
+const size_t ZLIB_PIECE = 1024 * 1024 * 1024;
 
-      default:
-         return false;
-   }
+// Decompresses input as it is read.
+struct TxUnpacker
+{
+   TxCompression              Method;    // How the input is compressed.
+   std::vector<unsigned char> Packed;    // Compressed bytes read from the file.
+   size_t                     PackedPos; // Index of the first byte not yet decompressed.
+   size_t                     PackedLen; // Number of valid bytes in Packed.
+   bool                       bInFrame;  // True inside a gzip member or zstd frame.
+   bool                       bFailed;   // True if the compressed data is bad or cut off.
+#ifdef TXU_WITH_ZLIB
+   z_stream                   Zlib;      // State of the gzip decompressor.
+   bool                       bZlib;     // True once Zlib is set up.
+#endif
+#ifdef TXU_WITH_ZSTD
+   ZSTD_DStream              *pZstd;     // State of the zstd decompressor, or NULL.
+#endif
 
-   return true;
+   TxUnpacker();
+   ~TxUnpacker();
+};
+
+// Compresses output as it is written.
+struct TxPacker
+{
+   TxCompression              Method;    // How the output is compressed.
+   std::vector<unsigned char> Packed;    // Compressed bytes to be written.
+#ifdef TXU_WITH_ZLIB
+   z_stream                   Zlib;      // State of the gzip compressor.
+   bool                       bZlib;     // True once Zlib is set up.
+#endif
+#ifdef TXU_WITH_ZSTD
+   ZSTD_CStream              *pZstd;     // State of the zstd compressor, or NULL.
+#endif
+
+   TxPacker();
+   ~TxPacker();
+};
+
+TxUnpacker::TxUnpacker() : Method(COMPRESS_NONE), PackedPos(0), PackedLen(0), bInFrame(false), bFailed(false)
+{
+#ifdef TXU_WITH_ZLIB
+   bZlib = false;
+#endif
+#ifdef TXU_WITH_ZSTD
+   pZstd = NULL;
+#endif
+}
+
+TxUnpacker::~TxUnpacker()
+{
+#ifdef TXU_WITH_ZLIB
+   if (bZlib)
+      inflateEnd(&Zlib);
+#endif
+#ifdef TXU_WITH_ZSTD
+   ZSTD_freeDStream(pZstd);
+#endif
+}
+
+TxPacker::TxPacker() : Method(COMPRESS_NONE)
+{
+#ifdef TXU_WITH_ZLIB
+   bZlib = false;
+#endif
+#ifdef TXU_WITH_ZSTD
+   pZstd = NULL;
+#endif
+}
+
+TxPacker::~TxPacker()
+{
+#ifdef TXU_WITH_ZLIB
+   if (bZlib)
+      deflateEnd(&Zlib);
+#endif
+#ifdef TXU_WITH_ZSTD
+   ZSTD_freeCStream(pZstd);
+#endif
 }
 
 //----------------------------------------------------------
-// Write a line of text to the given output file, using the
-// given encoding.
-// Returns true if successful, false if write fails.
+// Retrieves the name of a compression method, or finds one
+// by name.
 //----------------------------------------------------------
-static bool WriteLine(
-   FILE *fpOut,
-   TxEncoding OutFmt,
-   std::vector<unsigned> & Line
-   )
+static const _TCHAR * TxCompressionToName(TxCompression c)
 {
-   for (std::vector<unsigned>::iterator it = Line.begin(); it != Line.end(); ++it)
-      if (!WriteChar(fpOut, OutFmt, *it))
-         return false;
+   if (c == COMPRESS_GZIP)    return _T("GZIP");
+   if (c == COMPRESS_ZSTD)    return _T("ZSTD");
+   return _T("NONE");
+}
+
+static bool TxCompressionFromName(const _TCHAR *t, TxCompression &c)
+{
+   if (_tcsicmp(t, _T("NONE")) == 0)      c = COMPRESS_NONE;
+   else if (_tcsicmp(t, _T("GZIP")) == 0) c = COMPRESS_GZIP;
+   else if (_tcsicmp(t, _T("ZSTD")) == 0) c = COMPRESS_ZSTD;
+   else return false;
    return true;
 }
 
 //----------------------------------------------------------
-// Write byte order marker for start of text file in the
-// given encoding.
-// Returns true if successful, false if write fails.
+// True if this txu was built with the given method.
 //----------------------------------------------------------
-static bool WriteBOM(
-   FILE *fpOut,
-   TxEncoding OutFmt
-   )
+static bool HasCompression(TxCompression c)
 {
-   // Write byte-order-mark bytes to start of file.
-   // The magic numbers below are from the UTF specs.
-   if (OutFmt == FMT_UTF8)
+   switch(c)
    {
-      if (fwrite("\xEF\xBB\xBF", 1, 3, fpOut) != 3)
-         return false;
-   }
-   else if (OutFmt == FMT_UTF16)
-   {
-      if (fwrite("\xFF\xFE", 1, 2, fpOut) != 2)
-         return false;
-   }
-   else if (OutFmt == FMT_UTF16BE)
-   {
-      if (fwrite("\xFE\xFF", 1, 2, fpOut) != 2)
-         return false;
+      case COMPRESS_NONE:  return true;
+#ifdef TXU_WITH_ZLIB
+      case COMPRESS_GZIP:  return true;
+#endif
+#ifdef TXU_WITH_ZSTD
+      case COMPRESS_ZSTD:  return true;
+#endif
+      default:             return false;
    }
-   // else:  other formats need no BOM bytes.
-
-   return true;
 }
 
 //----------------------------------------------------------
-// Attempts to identify the BOM at the start of the file.
-// If successful, leaves the file pointer at the first
-// character AFTER the BOM.
-//
-// Returns the text encoding indicated by the BOM if found,
-// or FMT_UNKNOWN if not found.
+// Sets up a decompressor for the next file.  The 'n' bytes
+// at 'p' have been read from the file already, and are
+// decompressed first.  The decompressor's state is kept
+// from one file to the next, and reset here.
 //----------------------------------------------------------
-TxEncoding CheckBOM(FILE *fpIn)
+static void StartUnpacking(TxUnpacker &Un, TxCompression Method, const unsigned char *p, size_t n)
 {
-   TxEncoding InFmt = FMT_UNKNOWN;
-
-   // Read first few bytes of file.
-   unsigned char ch[32];
-   memset(&ch[0], 0, 32);
-   fseek(fpIn, 0, SEEK_SET);
-   size_t bytes = fread(&ch, 1, _countof(ch), fpIn);
-   fseek(fpIn, 0, SEEK_SET);
-   if (bytes < 1)
+   Un.Method = Method;
+   Un.Packed.resize(__max(PACK_BUFSIZE, n));
+   if (n > 0)
+      memcpy(&Un.Packed[0], p, n);
+   Un.PackedPos = 0;
+   Un.PackedLen = n;
+   Un.bInFrame = Un.bFailed = false;
+#ifdef TXU_WITH_ZLIB
+   if (Method == COMPRESS_GZIP && !Un.bZlib)
    {
-      msg("Empty input file");
-      fclose(fpIn);
-      return FMT_UNKNOWN;
+      memset(&Un.Zlib, 0, sizeof(Un.Zlib));
+      Un.bZlib = inflateInit2(&Un.Zlib, 16 + MAX_WBITS) == Z_OK;
+      Un.bFailed = !Un.bZlib;
    }
-
-   // If input mode was not specified, attempt to determine format
-   // from input data.  The magic numbers below are from the UTF specs.
-   if (ch[0] == 0xFE && ch[1] == 0xFF)
+#endif
+#ifdef TXU_WITH_ZSTD
+   if (Method == COMPRESS_ZSTD)
    {
-      InFmt = FMT_UTF16BE;
-      fseek(fpIn, 2, SEEK_SET);
+      if (Un.pZstd == NULL)
+         Un.pZstd = ZSTD_createDStream();
+      Un.bFailed = Un.pZstd == NULL || ZSTD_isError(ZSTD_DCtx_reset(Un.pZstd, ZSTD_reset_session_only));
    }
-   else if (ch[0] == 0xFF && ch[1] == 0xFE)
+#endif
+}
+
+//----------------------------------------------------------
+// Decompresses what it can of the compressed bytes held into
+// up to 'n' bytes at 'p', starting a new gzip member or zstd
+// frame if the last one has ended.  Sets bInFrame while one
+// is not finished, and bFailed if the data is bad.
+// Returns the number of bytes placed at 'p'.
+//----------------------------------------------------------
+static size_t Unpack(TxUnpacker &Un, unsigned char *p, size_t n)
+{
+#ifdef TXU_WITH_ZLIB
+   if (Un.Method == COMPRESS_GZIP)
    {
-      InFmt = FMT_UTF16;
-      fseek(fpIn, 2, SEEK_SET);
+      if (!Un.bInFrame && inflateReset(&Un.Zlib) != Z_OK)
+      {
+         Un.bFailed = true;
+         return 0;
+      }
+      Un.Zlib.next_in = &Un.Packed[Un.PackedPos];
+      Un.Zlib.avail_in = static_cast<uInt>(Un.PackedLen - Un.PackedPos);
+      Un.Zlib.next_out = p;
+      Un.Zlib.avail_out = static_cast<uInt>(__min(n, ZLIB_PIECE));
+      int Result = inflate(&Un.Zlib, Z_NO_FLUSH);
+      Un.PackedPos = Un.PackedLen - Un.Zlib.avail_in;
+      Un.bInFrame = Result != Z_STREAM_END;
+      if (Result != Z_OK && Result != Z_STREAM_END && Result != Z_BUF_ERROR)
+         Un.bFailed = true;
+      return __min(n, ZLIB_PIECE) - Un.Zlib.avail_out;
    }
-   else if (ch[0] == 0xEF && ch[1] == 0xBB && ch[2] == 0xBF)
+#endif
+#ifdef TXU_WITH_ZSTD
+   if (Un.Method == COMPRESS_ZSTD)
    {
-      InFmt = FMT_UTF8;
-      fseek(fpIn, 3, SEEK_SET);
+      ZSTD_inBuffer In = { &Un.Packed[0], Un.PackedLen, Un.PackedPos };
+      ZSTD_outBuffer Out = { p, n, 0 };
+      size_t Result = ZSTD_decompressStream(Un.pZstd, &Out, &In);
+      Un.PackedPos = In.pos;
+      if (ZSTD_isError(Result))
+         Un.bFailed = true;
+      else
+         Un.bInFrame = Result != 0;
+      return Out.pos;
    }
-   else if (bytes >= 16) // if we read at least 16 bytes...
+#endif
+   (void)p;
+   (void)n;
+   Un.bFailed = true;
+   return 0;
+}
+
+//----------------------------------------------------------
+// Reads up to 'n' bytes of input into 'p', decompressing
+// them with 'pUn' if it is not NULL.  Fewer are read only at
+// the end of the file, or, with pUn->bFailed set, at bad or
+// cut off compressed data.
+// Returns the number of bytes placed at 'p'.
+//----------------------------------------------------------
+static size_t ReadInput(FILE *fp, TxUnpacker *pUn, unsigned char *p, size_t n)
+{
+   if (pUn == NULL)
+      return fread(p, 1, n, fp);
+
+   size_t Got = 0;
+   while (Got < n && !pUn->bFailed)
    {
-      // No BOM, but if the first chars are all ANSI/ASCII,
-      // then assume the file format is ANSI.
-      for (size_t i = 0; i < __min(bytes, _countof(ch)); i++)
+      // With no compressed bytes left, the decompressor may
+      // still have output held back.
+      size_t Made = 0;
+      if (pUn->PackedPos < pUn->PackedLen || pUn->bInFrame)
+         Made = Unpack(*pUn, p + Got, n - Got);
+      Got += Made;
+      if (Made == 0 && pUn->PackedPos == pUn->PackedLen)
       {
-         if (ch[i] > 127)
+         pUn->PackedPos = 0;
+         pUn->PackedLen = fread(&pUn->Packed[0], 1, pUn->Packed.size(), fp);
+         if (pUn->PackedLen == 0)
          {
-            return FMT_UNKNOWN;
+            // The file must not end inside a member or frame.
+            pUn->bFailed = pUn->bInFrame;
+            break;
          }
       }
-      InFmt = FMT_ANSI;
    }
-   return InFmt;
+   return Got;
 }
 
 //----------------------------------------------------------
-// main:
-// Application entry point.
-// Uses standard arguments and return values.
+// Sets up a compressor for the next file.  Its state is kept
+// from one file to the next, and reset here.
+// Returns false if it can't be set up.
 //----------------------------------------------------------
-#ifdef _UNICODE
-int wmain(int argc, wchar_t **argv)
-#else
-int main(int argc, char **argv)
-#endif
+static bool StartPacking(TxPacker &Pk, TxCompression Method)
 {
-   // See if user needs command line help.
-   if (argc < 2)
+   Pk.Method = Method;
+   Pk.Packed.resize(PACK_BUFSIZE);
+#ifdef TXU_WITH_ZLIB
+   if (Method == COMPRESS_GZIP)
    {
-      Usage();
-      return EXIT_FAILURE;
+      if (Pk.bZlib)
+         return deflateReset(&Pk.Zlib) == Z_OK;
+      memset(&Pk.Zlib, 0, sizeof(Pk.Zlib));
+      Pk.bZlib = deflateInit2(&Pk.Zlib, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+         Z_DEFAULT_STRATEGY) == Z_OK;
+      return Pk.bZlib;
+   }
+#endif
+#ifdef TXU_WITH_ZSTD
+   if (Method == COMPRESS_ZSTD)
+   {
+      if (Pk.pZstd == NULL)
+         Pk.pZstd = ZSTD_createCStream();
+      return Pk.pZstd != NULL && !ZSTD_isError(ZSTD_CCtx_reset(Pk.pZstd, ZSTD_reset_session_only));
    }
+#endif
+   return Method == COMPRESS_NONE;
+}
 
-   // Program settings.
-   std::string InFile;
-   std::string OutFile;
-   TxEncoding  InFmt  = FMT_AUTO;
+//----------------------------------------------------------
+// Compresses the 'n' bytes at 'p' and writes what comes out
+// to the file.  'bEnd' ends the gzip member or zstd frame
+// after them, so that the file is complete.
+// Returns true if successful, false if writing fails.
+//----------------------------------------------------------
+static bool WritePacked(TxPacker &Pk, FILE *fp, const unsigned char *p, size_t n, bool bEnd)
+{
+#ifdef TXU_WITH_ZLIB
+   if (Pk.Method == COMPRESS_GZIP)
+   {
+      for (;;)
+      {
+         size_t Piece = __min(n, ZLIB_PIECE);
+         bool bFinish = bEnd && Piece == n;
+         Pk.Zlib.next_in = const_cast<unsigned char *>(p);
+         Pk.Zlib.avail_in = static_cast<uInt>(Piece);
+         int Result;
+         do
+         {
+            Pk.Zlib.next_out = &Pk.Packed[0];
+            Pk.Zlib.avail_out = static_cast<uInt>(Pk.Packed.size());
+            Result = deflate(&Pk.Zlib, bFinish ? Z_FINISH : Z_NO_FLUSH);
+            size_t Len = Pk.Packed.size() - Pk.Zlib.avail_out;
+            if (Result == Z_STREAM_ERROR || (Len > 0 && fwrite(&Pk.Packed[0], 1, Len, fp) != Len))
+               return false;
+         } while (bFinish ? Result != Z_STREAM_END : Pk.Zlib.avail_out == 0);
+         p += Piece;
+         n -= Piece;
+         if (n == 0)
+            return true;
+      }
+   }
+#endif
+#ifdef TXU_WITH_ZSTD
+   if (Pk.Method == COMPRESS_ZSTD)
+   {
+      ZSTD_inBuffer In = { p, n, 0 };
+      for (;;)
+      {
+         ZSTD_outBuffer Out = { &Pk.Packed[0], Pk.Packed.size(), 0 };
+         size_t Left = ZSTD_compressStream2(Pk.pZstd, &Out, &In, bEnd ? ZSTD_e_end : ZSTD_e_continue);
+         if (ZSTD_isError(Left) || (Out.pos > 0 && fwrite(&Pk.Packed[0], 1, Out.pos, fp) != Out.pos))
+            return false;
+         if (bEnd ? Left == 0 : In.pos == In.size)
+            return true;
+      }
+   }
+#endif
+   (void)Pk;
+   (void)bEnd;
+   return n == 0 || fwrite(p, 1, n, fp) == n;
+}
+
+//----------------------------------------------------------
+// Buffered input.  The input file is read a block at a time
+// and each block is converted straight into the output
+// buffer by libtxu (see TxConvert).  A character that is
+// split across two blocks is left unconverted at the end of
+// the byte buffer and completed by the next read.  A mapped
+// input file is converted in place, as one block.
+//
+// A streamed file is read ahead: while one block is being
+// converted, a background thread is already reading the
+// next one into a second buffer, and the two buffers swap
+// places when the converter moves on.
+//----------------------------------------------------------
+struct TxReader
+{
+   FILE                      *fp;        // Input file, or NULL if mapped.
+   TxUnpacker                *pUnpack;   // Decompresses the file, or NULL.
+   TxEncoding                 Fmt;       // Encoding of the input file.
+   std::vector<unsigned char> Buffer;    // Holds bytes read from the file.
+   std::vector<unsigned char> Ahead;     // Next block, being read in the background.
+   size_t                     AheadLen;  // Number of bytes read into Ahead.
+   TxHelper                   Reading;   // Thread reading into Ahead.
+   const unsigned char       *pBytes;    // Raw bytes of input.
+   size_t                     BytePos;   // Index of first unconverted byte.
+   size_t                     ByteLen;   // Number of valid bytes at pBytes.
+   size_t                     Offset;    // File offset of pBytes[0].
+   bool                       bEOF;      // True if end of file was reached.
+   bool                       bInvalid;  // True if stopped at invalid input, or at a
+                                         // character the output code page lacks.
+   double                     ReadTime;  // Seconds spent reading the file.
+   double                     WaitTime;  // Seconds the converter waited for reads.
+   std::vector<double>        ThreadTime; // Seconds each /THREADS thread spent converting.
+};
+
+//----------------------------------------------------------
+// Buffered output.  Encoded bytes are collected in a block
+// sized buffer which is written to the output file in one
+// call whenever it fills up.  The write is done by a
+// background thread from a second buffer, so the converter
+// can go on filling the first one in the meantime.
+//----------------------------------------------------------
+struct TxWriter
+{
+   FILE                      *fp;        // Output file.
+   TxPacker                  *pPack;     // Compresses the file, or NULL.
+   TxEncoding                 Fmt;       // Encoding of the output file.
+   std::vector<unsigned char> Bytes;     // Encoded bytes not yet written.
+   size_t                     ByteLen;   // Number of valid bytes in Bytes.
+   std::vector<unsigned char> Behind;    // Block being written in the background.
+   size_t                     BehindLen; // Number of bytes to write from Behind.
+   bool                       bFailed;   // True if a background write failed.
+   TxHelper                   Writing;   // Thread writing from Behind.
+   unsigned long long         Written;   // Number of bytes written to the file.
+   struct TxCheckpoint       *pResume;   // Where /RESUME checkpoints are kept, or NULL.
+   double                     WriteTime; // Seconds spent writing the file.
+   double                     WaitTime;  // Seconds the converter waited for writes.
+};
+
+// Limits on the size of the blocks read from the input file
+// and written to the output file (/BUFSIZE), in KB.
+const size_t MIN_BUFSIZE = 128;
+const size_t MAX_BUFSIZE = 1024 * 1024;
+
+// Room kept in front of each block read ahead, for the
+// unconverted tail of the block before it.
+const size_t READ_HEADROOM = 64;
+
+// Amount of input each thread converts at a time in /THREADS
+// mode.
+const size_t THREAD_CHUNK = 4 * 1024 * 1024;
+
+// Amount of input converted between /RESUME checkpoints.
+const size_t RESUME_INTERVAL = 64 * 1024 * 1024;
+
+//----------------------------------------------------------
+// Body of the read ahead thread:  fills the reader's Ahead
+// buffer from the file.
+//----------------------------------------------------------
+static void ReadAhead(void *pArg)
+{
+   TxReader *pIn = static_cast<TxReader *>(pArg);
+   TxClock::time_point Start = TxClock::now();
+   pIn->AheadLen = ReadInput(pIn->fp, pIn->pUnpack, &pIn->Ahead[READ_HEADROOM],
+      pIn->Ahead.size() - READ_HEADROOM);
+   pIn->ReadTime += SecondsSince(Start);
+}
+
+//----------------------------------------------------------
+// Prepares a reader for the given file.  The 'nPeek' bytes
+// at pPeek, which start at file offset 'Offset', have
+// already been read from the file, and are converted first;
+// the file must be positioned just after them.  This way
+// input that can't seek, such as a pipe, can be looked at
+// before it is converted.  The file is read 'BufSize' bytes
+// at a time, and decompressed with 'pUnpack' if it is not
+// NULL.
+//----------------------------------------------------------
+static void InitReader(
+   TxReader &In,
+   FILE *fpIn,
+   TxUnpacker *pUnpack,
+   TxEncoding InFmt,
+   size_t BufSize,
+   const unsigned char *pPeek,
+   size_t nPeek,
+   size_t Offset
+   )
+{
+   In.fp = fpIn;
+   In.pUnpack = pUnpack;
+   In.Fmt = InFmt;
+   In.Buffer.resize(READ_HEADROOM + __max(BufSize, nPeek));
+   In.Ahead.resize(READ_HEADROOM + BufSize);
+   In.AheadLen = 0;
+   if (nPeek > 0)
+      memcpy(&In.Buffer[READ_HEADROOM], pPeek, nPeek);
+   In.pBytes = &In.Buffer[READ_HEADROOM];
+   In.BytePos = 0;
+   In.ByteLen = nPeek;
+   In.Offset = Offset;
+   In.bEOF = In.bInvalid = false;
+   In.ReadTime = In.WaitTime = 0;
+   In.ThreadTime.clear();
+
+   // Start reading the first block right away.
+   StartJob(In.Reading, ReadAhead, &In);
+}
+
+//----------------------------------------------------------
+// Prepares a reader for input that has been mapped into
+// memory.  'Offset' is the file offset of the first
+// character to be read.
+//----------------------------------------------------------
+static void InitMappedReader(
+   TxReader &In,
+   const unsigned char *pData,
+   size_t Size,
+   size_t Offset,
+   TxEncoding InFmt
+   )
+{
+   In.fp = NULL;
+   In.pUnpack = NULL;
+   In.Fmt = InFmt;
+   In.pBytes = pData + Offset;
+   In.BytePos = 0;
+   In.ByteLen = Size - Offset;
+   In.Offset = Offset;
+   In.bEOF = true;
+   In.bInvalid = false;
+   In.ReadTime = In.WaitTime = 0;
+   In.ThreadTime.clear();
+}
+
+//----------------------------------------------------------
+// Moves on to the next block of the file:  waits for the
+// block being read ahead, puts the unconverted tail (if any)
+// of the current block in front of it, and starts reading
+// the block after it.
+// Sets bEOF when the end of the file is reached.
+//----------------------------------------------------------
+static void ReadBlock(TxReader &In)
+{
+   size_t Tail = In.ByteLen - In.BytePos;
+   In.Offset += In.BytePos;
+   TxClock::time_point WaitStart = TxClock::now();
+   WaitJob(In.Reading);
+   In.WaitTime += SecondsSince(WaitStart);
+   size_t Want = In.Ahead.size() - READ_HEADROOM;
+
+   // The tail is never more than part of one character, but
+   // make room for it anyway if it will not fit.
+   size_t Start = READ_HEADROOM;
+   if (Tail > Start)
+   {
+      In.Ahead.insert(In.Ahead.begin(), Tail - Start, 0);
+      Start = Tail;
+   }
+   if (Tail > 0)
+      memcpy(&In.Ahead[Start - Tail], In.pBytes + In.BytePos, Tail);
+
+   In.Buffer.swap(In.Ahead);
+   In.pBytes = &In.Buffer[Start - Tail];
+   In.BytePos = 0;
+   In.ByteLen = Tail + In.AheadLen;
+   if (In.AheadLen < Want)
+      In.bEOF = true;
+   else
+      StartJob(In.Reading, ReadAhead, &In);
+}
+
+//----------------------------------------------------------
+// Waits for any read still going on in the background, so
+// the input file can be closed.
+//----------------------------------------------------------
+static void EndReader(TxReader &In)
+{
+   WaitJob(In.Reading);
+}
+
+//----------------------------------------------------------
+// Prepares a writer for the given file.
+//----------------------------------------------------------
+static void InitWriter(TxWriter &Out, FILE *fpOut, TxEncoding OutFmt)
+{
+   Out.fp = fpOut;
+   Out.pPack = NULL;
+   Out.Fmt = OutFmt;
+   Out.Bytes.resize(nBufSize * 1024);
+   Out.ByteLen = 0;
+   Out.Behind.resize(nBufSize * 1024);
+   Out.BehindLen = 0;
+   Out.bFailed = false;
+   Out.Written = 0;
+   Out.pResume = NULL;
+   Out.WriteTime = Out.WaitTime = 0;
+}
+
+//----------------------------------------------------------
+// Writes the 'n' bytes at 'p' to the writer's file,
+// compressed if it has a compressor.  'bEnd' finishes the
+// compressed file after them.
+// Returns true if successful, false if writing fails.
+//----------------------------------------------------------
+static bool WriteOutput(TxWriter &Out, const unsigned char *p, size_t n, bool bEnd)
+{
+   if (Out.pPack != NULL)
+      return WritePacked(*Out.pPack, Out.fp, p, n, bEnd);
+   return fwrite(p, 1, n, Out.fp) == n;
+}
+
+//----------------------------------------------------------
+// Body of the write behind thread:  writes the writer's
+// Behind buffer to the file.
+//----------------------------------------------------------
+static void WriteBehind(void *pArg)
+{
+   TxWriter *pOut = static_cast<TxWriter *>(pArg);
+   TxClock::time_point Start = TxClock::now();
+   if (!WriteOutput(*pOut, &pOut->Behind[0], pOut->BehindLen, false))
+      pOut->bFailed = true;
+   pOut->WriteTime += SecondsSince(Start);
+}
+
+//----------------------------------------------------------
+// Waits for the block being written in the background, if
+// any, to reach the file.
+// Returns true if successful, false if a write has failed.
+//----------------------------------------------------------
+static bool WaitWriter(TxWriter &Out)
+{
+   if (Out.BehindLen > 0)
+   {
+      TxClock::time_point Start = TxClock::now();
+      WaitJob(Out.Writing);
+      Out.WaitTime += SecondsSince(Start);
+      if (!Out.bFailed)
+         Out.Written += Out.BehindLen;
+      Out.BehindLen = 0;
+   }
+   return !Out.bFailed;
+}
+
+//----------------------------------------------------------
+// Waits for the last of the output to be written, and
+// finishes the file if it is compressed.  Call when done
+// with a writer, after flushing it.
+// Returns true if successful, false if a write has failed.
+//----------------------------------------------------------
+static bool EndWriter(TxWriter &Out)
+{
+   if (!WaitWriter(Out))
+      return false;
+   if (Out.pPack == NULL)
+      return true;
+   TxClock::time_point Start = TxClock::now();
+   bool bWritten = WritePacked(*Out.pPack, Out.fp, NULL, 0, true);
+   Out.WriteTime += SecondsSince(Start);
+   Out.pPack = NULL;
+   return bWritten;
+}
+
+//----------------------------------------------------------
+// Starts writing any buffered output to the output file in
+// the background, once the block before it is written.
+// Returns true if successful, false if a write has failed.
+//----------------------------------------------------------
+static bool FlushWriter(TxWriter &Out)
+{
+   if (!WaitWriter(Out))
+      return false;
+   if (Out.ByteLen == 0)
+      return true;
+   Out.Bytes.swap(Out.Behind);
+   Out.BehindLen = Out.ByteLen;
+   Out.ByteLen = 0;
+   StartJob(Out.Writing, WriteBehind, &Out);
+   return true;
+}
+
+//----------------------------------------------------------
+// Writes a run of already encoded bytes to the given writer.
+// Large runs are written straight from 'p' rather than being
+// copied into the writer's buffer.
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool WriteBytes(TxWriter &Out, const unsigned char *p, size_t n)
+{
+   if (n >= Out.Bytes.size() - Out.ByteLen)
+   {
+      if (!FlushWriter(Out))
+         return false;
+      if (n >= Out.Bytes.size())
+      {
+         if (!WaitWriter(Out))
+            return false;
+         TxClock::time_point Start = TxClock::now();
+         bool bWritten = WriteOutput(Out, p, n, false);
+         double Seconds = SecondsSince(Start);
+         Out.WriteTime += Seconds;
+         Out.WaitTime += Seconds;
+         if (!bWritten)
+            return false;
+         Out.Written += n;
+         return true;
+      }
+   }
+   if (n > 0)
+      memcpy(&Out.Bytes[Out.ByteLen], p, n);
+   Out.ByteLen += n;
+   return true;
+}
+
+//----------------------------------------------------------
+// A /RESUME checkpoint:  how far a conversion has got, and
+// what its converter needs to carry on from there.  Partial
+// characters are never carried, as a checkpoint is only
+// taken between blocks, where the input offset is always
+// the start of a character.
+//----------------------------------------------------------
+struct TxCheckpoint
+{
+   std::string        Name;       // Name of the checkpoint file.
+   unsigned long long InSize;     // Size of the input file.
+   unsigned long long InOffset;   // Input file offset converted up to.
+   unsigned long long OutOffset;  // Output file length at that point.
+   bool               bAfterCR;   // True if the input before InOffset ends in a CR.
+   unsigned long long nChars;     // Counts of the converter at that point.
+   unsigned long long nLines;
+   unsigned long long nBad;
+   unsigned long long nUnmapped;
+   unsigned long long Next;       // Input file offset of the next checkpoint.
+};
+
+// Contents of a checkpoint file:  the size of the input, the
+// encodings, code page, /EOL and /ONERROR it was converted
+// with, and then the checkpoint itself.  The file ends with
+// "end", so that one left half written can be told apart.
+static const _TCHAR RESUME_FORMAT[] =
+   _T("txu resume 1\nsize %llu\nformats %d %d\ncodepage %u\neol %d\nonerror %d\n")
+   _T("input %llu\noutput %llu\nafter_cr %d\nchars %llu\nlines %llu\nbad %llu\nunmapped %llu\n");
+
+//----------------------------------------------------------
+// Reads the checkpoint left by an earlier conversion of the
+// same input with the same settings, that did not finish.
+// Returns true if there is one, false to start over.
+//----------------------------------------------------------
+static bool LoadCheckpoint(TxCheckpoint &Ck, TxEncoding InFmt, TxEncoding OutFmt)
+{
+   FILE *fp;
+   if (_tfopen_s(&fp, Ck.Name.c_str(), "r"))
+      return false;
+   unsigned long long Size = 0;
+   int InCode = 0, OutCode = 0, EolCode = 0, ErrCode = 0, AfterCR = 0;
+   unsigned CodePage = 0;
+   _TCHAR End[4] = _T("");
+   int n = _ftscanf(fp, RESUME_FORMAT, &Size, &InCode, &OutCode, &CodePage, &EolCode, &ErrCode,
+      &Ck.InOffset, &Ck.OutOffset, &AfterCR, &Ck.nChars, &Ck.nLines, &Ck.nBad, &Ck.nUnmapped);
+   if (n == 13)
+      _ftscanf(fp, _T("%3s"), End);
+   fclose(fp);
+   Ck.bAfterCR = AfterCR != 0;
+
+   return n == 13 && _tcscmp(End, _T("end")) == 0 && Size == Ck.InSize &&
+      InCode == InFmt && OutCode == OutFmt && CodePage == CodePageNumber() &&
+      EolCode == Eol && ErrCode == OnError && Ck.InOffset <= Ck.InSize;
+}
+
+//----------------------------------------------------------
+// Takes a /RESUME checkpoint, if the conversion has got far
+// enough past the last one:  the output so far is written to
+// the file, then its length, with the input offset and the
+// converter state that go with it, is saved in the checkpoint
+// file.  If the checkpoint file can't be written, the one
+// before it is still good, or is rejected by LoadCheckpoint.
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool SaveCheckpoint(TxReader &In, TxConverter &Cv, TxWriter &Out)
+{
+   TxCheckpoint &Ck = *Out.pResume;
+   unsigned long long InOffset = In.Offset + In.BytePos;
+   if (InOffset < Ck.Next)
+      return true;
+   if (!FlushWriter(Out) || !WaitWriter(Out) || fflush(Out.fp) != 0)
+      return false;
+   Ck.Next = InOffset + RESUME_INTERVAL;
+
+   FILE *fp;
+   if (_tfopen_s(&fp, Ck.Name.c_str(), "w"))
+   {
+      msg("Failed writing checkpoint file", Ck.Name.c_str());
+      return true;
+   }
+   _ftprintf(fp, RESUME_FORMAT, Ck.InSize, In.Fmt, Out.Fmt,
+      CodePageNumber(), Eol, OnError, InOffset, Out.Written, Cv.bAfterCR ? 1 : 0,
+      static_cast<unsigned long long>(Cv.nChars), static_cast<unsigned long long>(Cv.nLines),
+      static_cast<unsigned long long>(Cv.nBad), static_cast<unsigned long long>(Cv.nUnmapped));
+   _ftprintf(fp, _T("end\n"));
+   if (fclose(fp) != 0)
+      msg("Failed writing checkpoint file", Ck.Name.c_str());
+   return true;
+}
+
+//----------------------------------------------------------
+// Reports where a conversion was stopped by /ONERROR=STOP,
+// and marks the reader as stopped.  The reader is at the
+// invalid input, or just past a character not in the code
+// page, which 'Cv' stopped after.
+//----------------------------------------------------------
+static void ReportStop(TxReader &In, const TxConverter &Cv, TxResult Result)
+{
+   In.bInvalid = true;
+   if (Result == TX_INVALID)
+   {
+      _ftprintf(stderr, "\nInvalid character sequence for %s at file offset %zu\n",
+         TxEncodingToName(In.Fmt), In.Offset + In.BytePos);
+      msg("Invalid character sequence", TxEncodingToName(In.Fmt));
+   }
+   else
+   {
+      _ftprintf(stderr, "\nCharacter not in code page %u at file offset %zu\n", CodePageNumber(),
+         In.Offset + In.BytePos - Cv.StopLen);
+      msg("Character not in the output code page");
+   }
+}
+
+//----------------------------------------------------------
+// Deals with what is left in the reader at the end of the
+// file, which can only be a character cut off by it, as
+// /ONERROR says (see TxFinish).
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool FinishStream(TxReader &In, TxConverter &Cv, TxWriter &Out)
+{
+   unsigned char Tail[8];
+   size_t Produced;
+   TxResult Result = TxFinish(Cv, In.ByteLen - In.BytePos, Tail, sizeof(Tail), Produced);
+   if (Result != TX_OK)
+   {
+      ReportStop(In, Cv, Result);
+      return true;
+   }
+   In.BytePos = In.ByteLen;
+   return Produced == 0 || WriteBytes(Out, Tail, Produced);
+}
+
+//----------------------------------------------------------
+// A piece of the input that is converted on its own by one
+// thread in /THREADS mode, and the results of converting it.
+//----------------------------------------------------------
+struct TxChunkJob
+{
+   const unsigned char       *pIn;       // Input bytes of this piece.
+   size_t                     InLen;     // Number of input bytes.
+   size_t                     Used;      // Number of input bytes converted.
+   TxResult                   Result;    // How the conversion ended.
+   TxConverter                Cv;        // Conversion state and counts of this piece.
+   std::vector<unsigned char> Out;       // Encoded output.
+   size_t                     OutLen;    // Number of valid bytes in Out.
+   double                     Seconds;   // Time spent converting this piece.
+};
+
+//----------------------------------------------------------
+// Everything converting a file needs besides the files
+// themselves:  the reader, writer and converter, the buffers
+// the encoding is detected from, and the pieces and helper
+// threads of /THREADS mode.  Each thread that converts files
+// keeps one workspace for all of them, so the buffers, once
+// grown to the size the files need, and the threads, once
+// started, are used again for the next file instead of being
+// allocated for each one.
+//----------------------------------------------------------
+struct TxWorkspace
+{
+   TxReader                   In;        // Reads the input file.
+   TxWriter                   Out;       // Writes the output file.
+   TxConverter                Cv;        // Converts the text.
+   TxUnpacker                 Unpack;    // Decompresses compressed input.
+   TxPacker                   Pack;      // Compresses the output (/COMPRESS).
+   std::vector<unsigned char> Peek;      // Start of a streamed input file.
+   std::vector<unsigned char> Sample;    // Samples of the text, for detection.
+   std::vector<size_t>        Starts;    // Index in Sample of each sample.
+   std::vector<TxChunkJob>    Jobs;      // Pieces of the input (/THREADS).
+   std::deque<TxHelper>       Helpers;   // Threads converting all but the first piece.
+};
+
+//----------------------------------------------------------
+// Converts the whole input to the output, a block at a time,
+// each block straight into the writer's buffer.  Text that
+// needs no conversion is written from the block itself
+// instead, which for a mapped file means it is never copied
+// at all.  A character cut off by the end of a block is kept
+// for the next one by ReadBlock; one cut off by the end of
+// the file is left to FinishStream.
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool ConvertStream(TxWorkspace &Ws)
+{
+   TxReader &In = Ws.In;
+   TxConverter &Cv = Ws.Cv;
+   TxWriter &Out = Ws.Out;
+   for (;;)
+   {
+      const unsigned char *p = In.pBytes + In.BytePos;
+      size_t n = In.ByteLen - In.BytePos;
+      size_t Good = TxCopyPrefix(Cv, p, n);
+      if (Good > 0)
+      {
+         if (!WriteBytes(Out, p, Good))
+            return false;
+         In.BytePos += Good;
+         p += Good;
+         n -= Good;
+      }
+
+      size_t Used, Produced;
+      TxResult Result = TxConvert(Cv, p, n, &Out.Bytes[Out.ByteLen], Out.Bytes.size() - Out.ByteLen,
+         Used, Produced);
+      In.BytePos += Used;
+      Out.ByteLen += Produced;
+      if (Result == TX_OUTPUT_FULL)
+      {
+         if (!FlushWriter(Out))
+            return false;
+         if (Out.pResume != NULL && !SaveCheckpoint(In, Cv, Out))
+            return false;
+         continue;
+      }
+      if (Result != TX_OK)
+      {
+         ReportStop(In, Cv, Result);
+         break;
+      }
+
+      if (In.bEOF)
+      {
+         if (!FinishStream(In, Cv, Out))
+            return false;
+         break;
+      }
+      if (Out.pResume != NULL && !SaveCheckpoint(In, Cv, Out))
+         return false;
+      ReadBlock(In);
+   }
+   return FlushWriter(Out);
+}
+
+//----------------------------------------------------------
+// Converts one piece of the input into the job's own output
+// buffer, which grows as needed.  Stops at invalid input or
+// at a character that is cut off by the end of the piece.
+//----------------------------------------------------------
+static void ConvertChunk(TxChunkJob &Job)
+{
+   TxClock::time_point Start = TxClock::now();
+   Job.Used = Job.OutLen = 0;
+   if (Job.Out.size() < Job.InLen + 64)
+      Job.Out.resize(Job.InLen + 64);
+   for (;;)
+   {
+      size_t Used, Produced;
+      Job.Result = TxConvert(Job.Cv, Job.pIn + Job.Used, Job.InLen - Job.Used,
+         &Job.Out[Job.OutLen], Job.Out.size() - Job.OutLen, Used, Produced);
+      Job.Used += Used;
+      Job.OutLen += Produced;
+      if (Job.Result != TX_OUTPUT_FULL)
+         break;
+      Job.Out.resize(Job.Out.size() * 2);
+   }
+   Job.Seconds += SecondsSince(Start);
+}
+
+// ConvertChunk, as a job for a helper thread.
+static void RunChunk(void *pArg)
+{
+   ConvertChunk(*static_cast<TxChunkJob *>(pArg));
+}
+
+//----------------------------------------------------------
+// Converts the whole input to the output with nThreads
+// threads.  The input is taken nThreads pieces at a time;
+// each piece ends at the start of a character, and never
+// between a CR and a LF, and is converted by its own thread
+// with its own converter.  The results are written in order.
+//
+// Only the first piece of a block follows one that has been
+// converted, so it alone starts with the state the one
+// before left.  If a piece stops short of its end (a
+// malformed character running past it), the next piece is
+// converted again from where the first one stopped, so the
+// output is always the same as from ConvertStream.
+//
+// The first piece is converted by the calling thread, and
+// the others by the workspace's helpers, which are kept for
+// the next block and the next file.
+//
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool ConvertParallel(TxWorkspace &Ws)
+{
+   TxReader &In = Ws.In;
+   TxConverter &Cv = Ws.Cv;
+   TxWriter &Out = Ws.Out;
+   std::vector<TxChunkJob> &Jobs = Ws.Jobs;
+   Jobs.resize(nThreads);
+   while (Ws.Helpers.size() + 1 < nThreads)
+      Ws.Helpers.emplace_back();
+   In.ThreadTime.assign(nThreads, 0);
+   for (;;)
+   {
+      if (!In.bEOF)
+         ReadBlock(In);
+
+      // Divide what is in the buffer into one piece per thread.
+      const unsigned char *p = In.pBytes + In.BytePos;
+      size_t Avail = __min(In.ByteLen - In.BytePos, nThreads * THREAD_CHUNK);
+      size_t Piece = (Avail + nThreads - 1) / nThreads;
+      size_t Start = 0;
+      for (size_t k = 0; k < Jobs.size(); k++)
+      {
+         size_t End = __min(Start + Piece, Avail);
+         if (k + 1 == Jobs.size())
+            End = Avail;
+         else if (End < Avail)
+            End = __max(Start, TxSplitPoint(In.Fmt, p, Avail, End));
+         Jobs[k].pIn = p + Start;
+         Jobs[k].InLen = End - Start;
+         Jobs[k].Seconds = 0;
+         TxInitConverter(Jobs[k].Cv, Cv.InFmt, Cv.OutFmt);
+         Start = End;
+      }
+      Jobs[0].Cv.bAfterCR = Cv.bAfterCR;
+
+      for (size_t k = 1; k < Jobs.size(); k++)
+         StartJob(Ws.Helpers[k - 1], RunChunk, &Jobs[k]);
+      ConvertChunk(Jobs[0]);
+      for (size_t k = 1; k < Jobs.size(); k++)
+         WaitJob(Ws.Helpers[k - 1]);
+
+      // Write the results in order.
+      size_t Pos = 0;
+      for (size_t k = 0; k < Jobs.size(); k++)
+      {
+         TxChunkJob &Job = Jobs[k];
+         if (Job.pIn != p + Pos)
+         {
+            Job.InLen += Job.pIn - (p + Pos);
+            Job.pIn = p + Pos;
+            TxInitConverter(Job.Cv, Cv.InFmt, Cv.OutFmt);
+            Job.Cv.bAfterCR = Cv.bAfterCR;
+            ConvertChunk(Job);
+         }
+         if (Job.OutLen > 0 && !WriteBytes(Out, &Job.Out[0], Job.OutLen))
+            return false;
+         if (Job.Cv.nChars > 0)
+            Cv.bAfterCR = Job.Cv.bAfterCR;
+         Cv.nChars += Job.Cv.nChars;
+         Cv.nLines += Job.Cv.nLines;
+         Cv.nBad += Job.Cv.nBad;
+         Cv.nUnmapped += Job.Cv.nUnmapped;
+         In.ThreadTime[k] += Job.Seconds;
+         Pos += Job.Used;
+         if (Job.Result == TX_INVALID || Job.Result == TX_UNMAPPABLE)
+         {
+            In.BytePos += Pos;
+            ReportStop(In, Job.Cv, Job.Result);
+            return FlushWriter(Out);
+         }
+      }
+      In.BytePos += Pos;
+      if (Out.pResume != NULL && !SaveCheckpoint(In, Cv, Out))
+         return false;
+
+      // Stop at the end of the file, once nothing is left but
+      // perhaps an incomplete character.
+      if (In.bEOF && (In.BytePos == In.ByteLen || Pos == 0))
+         break;
+   }
+   if (!FinishStream(In, Cv, Out))
+      return false;
+   return FlushWriter(Out);
+}
+
+// Pointer to ConvertStream or ConvertParallel.
+typedef bool (*TxConvertFn)(TxWorkspace &Ws);
+
+//----------------------------------------------------------
+// Retrieves the conversion loop for the given pair of
+// encodings:  ConvertParallel if more than one thread was
+// asked for, unless the text is mostly passed through as it
+// is, which runs at the speed of the I/O anyway; otherwise
+// ConvertStream.
+//----------------------------------------------------------
+static TxConvertFn GetConverter(TxEncoding InFmt, TxEncoding OutFmt)
+{
+   if (nThreads > 1 && !TxPassesThrough(InFmt, OutFmt))
+      return ConvertParallel;
+   return ConvertStream;
+}
+
+//----------------------------------------------------------
+// Goes through the whole input as ConvertStream would, but
+// only adds the size of the output to 'Bytes' (see
+// TxMeasure).  Stops at invalid input as /ONERROR says,
+// which is reported.
+//----------------------------------------------------------
+static void MeasureStream(TxReader &In, TxConverter &Cv, unsigned long long &Bytes)
+{
+   for (;;)
+   {
+      size_t Used;
+      TxResult Result = TxMeasure(Cv, In.pBytes + In.BytePos, In.ByteLen - In.BytePos, Used, Bytes);
+      In.BytePos += Used;
+      if (Result != TX_OK)
+      {
+         ReportStop(In, Cv, Result);
+         return;
+      }
+      if (In.bEOF)
+         break;
+      ReadBlock(In);
+   }
+
+   unsigned char Tail[8];
+   size_t Produced;
+   TxResult Result = TxFinish(Cv, In.ByteLen - In.BytePos, Tail, sizeof(Tail), Produced);
+   if (Result != TX_OK)
+      ReportStop(In, Cv, Result);
+   Bytes += Produced;
+}
+
+//----------------------------------------------------------
+// Counts the characters and line feeds in the whole input
+// without decoding it (see TxCountText).
+//----------------------------------------------------------
+static void CountStream(TxReader &In, size_t &nChars, size_t &nLines)
+{
+   for (;;)
+   {
+      In.BytePos += TxCountText(In.Fmt, In.pBytes + In.BytePos, In.ByteLen - In.BytePos, nChars, nLines);
+      if (In.bEOF)
+         break;
+      ReadBlock(In);
+   }
+}
+
+//----------------------------------------------------------
+// Retrieves the byte order marker written at the start of a
+// text file in the given encoding, and sets 'Len' to its
+// length, since that of UTF-32 has zero bytes in it.
+//----------------------------------------------------------
+static const char * BOMBytes(TxEncoding Fmt, size_t &Len)
+{
+   // The magic numbers below are from the UTF specs.
+   const char *BOM = "";
+   if (Fmt == FMT_UTF8)
+      BOM = "\xEF\xBB\xBF";
+   else if (Fmt == FMT_UTF16)
+      BOM = "\xFF\xFE";
+   else if (Fmt == FMT_UTF16BE)
+      BOM = "\xFE\xFF";
+   else if (Fmt == FMT_UTF32)
+      BOM = "\xFF\xFE\x00\x00";
+   else if (Fmt == FMT_UTF32BE)
+      BOM = "\x00\x00\xFE\xFF";
+   // else:  other formats need no BOM bytes.
+
+   // Only UTF-32 has zero bytes in its BOM.
+   Len = Fmt == FMT_UTF32 || Fmt == FMT_UTF32BE ? 4 : strlen(BOM);
+   return BOM;
+}
+
+//----------------------------------------------------------
+// Write byte order marker for start of text file in the
+// writer's encoding.
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool WriteBOM(
+   TxWriter & Out
+   )
+{
+   // Write byte-order-mark bytes to start of file.
+   size_t n;
+   const char *BOM = BOMBytes(Out.Fmt, n);
+   if (Out.Bytes.size() - Out.ByteLen < n && !FlushWriter(Out))
+      return false;
+   memcpy(&Out.Bytes[Out.ByteLen], BOM, n);
+   Out.ByteLen += n;
+   return true;
+}
+
+//----------------------------------------------------------
+// Input file mapped into memory.
+//----------------------------------------------------------
+struct TxMapping
+{
+   const unsigned char *pData;     // Contents of the file, or NULL.
+   size_t               Size;      // Size of the file in bytes.
+#ifdef _WIN32
+   HANDLE               hMap;      // File mapping object.
+#endif
+};
+
+//----------------------------------------------------------
+// Attempts to map the named input file into memory.  Only
+// regular files on disk are mapped, and only if they are
+// no larger than 'MaxSize' bytes, so pipes, devices, empty
+// files and very large files are left to the caller to
+// read as a stream.
+//
+// Returns true if the file was mapped, false if not.
+//----------------------------------------------------------
+static bool MapInputFile(const _TCHAR *Name, size_t MaxSize, TxMapping &Map)
+{
+   Map.pData = NULL;
+   Map.Size = 0;
+   if (MaxSize == 0)
+      return false;
+
+#ifdef _WIN32
+   Map.hMap = NULL;
+   HANDLE hFile = CreateFile(Name, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+   if (hFile == INVALID_HANDLE_VALUE)
+      return false;
+
+   LARGE_INTEGER Size;
+   if (GetFileType(hFile) != FILE_TYPE_DISK ||
+       !GetFileSizeEx(hFile, &Size) ||
+       Size.QuadPart <= 0 ||
+       static_cast<unsigned long long>(Size.QuadPart) > MaxSize)
+   {
+      CloseHandle(hFile);
+      return false;
+   }
+
+   // The view keeps the mapping alive, and the mapping keeps
+   // the file open, so both handles can be closed once the
+   // view exists.
+   Map.hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+   CloseHandle(hFile);
+   if (Map.hMap == NULL)
+      return false;
+   Map.pData = static_cast<const unsigned char *>(MapViewOfFile(Map.hMap, FILE_MAP_READ, 0, 0, 0));
+   if (Map.pData == NULL)
+   {
+      CloseHandle(Map.hMap);
+      Map.hMap = NULL;
+      return false;
+   }
+   Map.Size = static_cast<size_t>(Size.QuadPart);
+#else
+   int fd = open(Name, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 ||
+       !S_ISREG(st.st_mode) ||
+       st.st_size <= 0 ||
+       static_cast<unsigned long long>(st.st_size) > MaxSize)
+   {
+      close(fd);
+      return false;
+   }
+
+   void *p = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED)
+      return false;
+   madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+   Map.pData = static_cast<const unsigned char *>(p);
+   Map.Size = static_cast<size_t>(st.st_size);
+#endif
+
+   return true;
+}
+
+//----------------------------------------------------------
+// Releases an input file mapped by MapInputFile().
+//----------------------------------------------------------
+static void UnmapInputFile(TxMapping &Map)
+{
+   if (Map.pData == NULL)
+      return;
+#ifdef _WIN32
+   UnmapViewOfFile(Map.pData);
+   CloseHandle(Map.hMap);
+   Map.hMap = NULL;
+#else
+   munmap(const_cast<unsigned char *>(Map.pData), Map.Size);
+#endif
+   Map.pData = NULL;
+   Map.Size = 0;
+}
+
+//----------------------------------------------------------
+// Closes the input file, whether it was mapped or opened
+// as a stream.  Standard input is left open.
+//----------------------------------------------------------
+static void CloseInput(FILE *fpIn, TxMapping &Map)
+{
+   if (fpIn != NULL && fpIn != stdin)
+      fclose(fpIn);
+   UnmapInputFile(Map);
+}
+
+//----------------------------------------------------------
+// Moves to an offset in a file, like fseek, and retrieves the
+// current offset, like ftell, but for files past 2 GB too.
+//----------------------------------------------------------
+static bool SeekFile(FILE *fp, long long Offset, int Origin)
+{
+#ifdef _WIN32
+   return _fseeki64(fp, Offset, Origin) == 0;
+#else
+   return fseeko(fp, static_cast<off_t>(Offset), Origin) == 0;
+#endif
+}
+
+static long long TellFile(FILE *fp)
+{
+#ifdef _WIN32
+   return _ftelli64(fp);
+#else
+   return static_cast<long long>(ftello(fp));
+#endif
+}
+
+//----------------------------------------------------------
+// Retrieves the size of an input file opened by ConvertFile,
+// or 0 if it is not known.  A streamed file is left at the
+// position it was at.
+//----------------------------------------------------------
+static size_t InputSize(FILE *fpIn, const TxMapping &Map)
+{
+   if (fpIn == NULL)
+      return Map.Size;
+
+   long long OldPos = TellFile(fpIn);
+   SeekFile(fpIn, 0, SEEK_END);
+   long long End = TellFile(fpIn);
+   SeekFile(fpIn, OldPos, SEEK_SET);
+   return End > 0 ? static_cast<size_t>(End) : 0;
+}
+
+//----------------------------------------------------------
+// Opens the output file of a conversion being resumed (see
+// /RESUME), and cuts off whatever was written to it after the
+// checkpoint, leaving it positioned at the end.
+// Returns true if successful, false if the file is not there
+// or is shorter than it was at the checkpoint.
+//----------------------------------------------------------
+static bool OpenResumedOutput(const std::string &OutFile, unsigned long long Length, FILE *&fpOut)
+{
+   if (_tfopen_s(&fpOut, OutFile.c_str(), "r+b"))
+      return false;
+   bool bOpened = SeekFile(fpOut, 0, SEEK_END) && TellFile(fpOut) >= static_cast<long long>(Length);
+#ifdef _WIN32
+   bOpened = bOpened && _chsize_s(_fileno(fpOut), static_cast<long long>(Length)) == 0;
+#else
+   bOpened = bOpened && ftruncate(fileno(fpOut), static_cast<off_t>(Length)) == 0;
+#endif
+   if (bOpened && SeekFile(fpOut, static_cast<long long>(Length), SEEK_SET))
+      return true;
+   fclose(fpOut);
+   return false;
+}
+
+// Smallest output for which the space is reserved up front.
+const unsigned long long PREALLOC_MIN = 1024 * 1024;
+
+//----------------------------------------------------------
+// Works out how much disk space to reserve for the output of
+// 'Len' bytes of text, not counting the BOM, from the length
+// alone.  Where each character takes a fixed number of bytes
+// in and out, this is the size of the output; otherwise it
+// is the most the output could take, and what is left over
+// is given back at the end.  Measuring the text instead (see
+// TxMeasure) would be exact, but costs about as much as
+// checking it again in the conversion.
+//----------------------------------------------------------
+static unsigned long long OutputSizeLimit(TxEncoding InFmt, TxEncoding OutFmt, unsigned long long Len)
+{
+   // Most output bytes for each input byte, in halves.  An
+   // invalid byte of UTF-8 can become a U+FFFD of three.
+   bool bOut16 = OutFmt == FMT_UTF16 || OutFmt == FMT_UTF16BE;
+   bool bOut32 = OutFmt == FMT_UTF32 || OutFmt == FMT_UTF32BE;
+   unsigned long long Halves = 0;
+   if (InFmt == FMT_UTF32 || InFmt == FMT_UTF32BE)
+      Halves = OutFmt == FMT_ANSI ? 1 : 2;
+   else if (InFmt == FMT_UTF16 || InFmt == FMT_UTF16BE)
+      Halves = bOut32 ? 4 : bOut16 ? 2 : OutFmt == FMT_UTF8 ? 3 : 1;
+   else if (InFmt == FMT_ANSI)
+      Halves = bOut32 ? 8 : bOut16 ? 4 : OutFmt == FMT_UTF8 ? 6 : 2;
+   else
+      Halves = bOut32 ? 8 : bOut16 ? 4 : OutFmt == FMT_UTF8 && OnError == ONERROR_REPLACE ? 6 : 2;
+   if (Eol == EOL_CRLF)
+      Halves *= 2;
+   return Len * Halves / 2;
+}
+
+//----------------------------------------------------------
+// Reserves 'Size' bytes of disk space for an output file up
+// front, so that it is laid out in one piece rather than
+// grown a block at a time, without changing its length.
+// Any left unused is given back by ReleaseUnused.
+//----------------------------------------------------------
+static void PreallocateFile(FILE *fp, unsigned long long Size)
+{
+#if defined(_WIN32)
+   FILE_ALLOCATION_INFO Info;
+   Info.AllocationSize.QuadPart = static_cast<LONGLONG>(Size);
+   SetFileInformationByHandle(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(fp))), FileAllocationInfo,
+      &Info, sizeof(Info));
+#elif defined(__linux__)
+   fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(Size));
+#else
+   (void)fp;
+   (void)Size;
+#endif
+}
+
+//----------------------------------------------------------
+// Gives back any space reserved by PreallocateFile past the
+// 'Length' bytes written.  Windows does that itself when the
+// file is closed.
+//----------------------------------------------------------
+static void ReleaseUnused(FILE *fp, unsigned long long Length)
+{
+#if defined(__linux__)
+   if (fflush(fp) == 0)
+      ftruncate(fileno(fp), static_cast<off_t>(Length));
+#else
+   (void)fp;
+   (void)Length;
+#endif
+}
+
+//----------------------------------------------------------
+// Copies 'Len' bytes from offset 'Offset' of a file to the
+// current position of an output file inside the operating
+// system, without passing them through the program.  Any
+// data buffered for fpOut must already have been written.
+// Returns the number of bytes copied, which is less than
+// 'Len' if the system can't copy between these files.
+//----------------------------------------------------------
+static size_t CopyFileBytes(const _TCHAR *InFile, size_t Offset, size_t Len, FILE *fpOut)
+{
+#ifdef __linux__
+   int fdIn = open(InFile, O_RDONLY);
+   if (fdIn < 0)
+      return 0;
+
+   int fdOut = fileno(fpOut);
+   off_t Pos = static_cast<off_t>(Offset);
+   size_t Done = 0;
+   while (Done < Len)
+   {
+      ssize_t n = copy_file_range(fdIn, &Pos, fdOut, NULL, Len - Done, 0);
+      if (n <= 0)
+         n = sendfile(fdOut, fdIn, &Pos, Len - Done);
+      if (n <= 0)
+         break;
+      Done += static_cast<size_t>(n);
+   }
+   close(fdIn);
+
+   // Make the stream's idea of its position agree.
+   fseek(fpOut, 0, SEEK_END);
+   return Done;
+#else
+   (void)InFile; (void)Offset; (void)Len; (void)fpOut;
+   return 0;
+#endif
+}
+
+//----------------------------------------------------------
+// Gathers the samples examined by DetectEncoding() into
+// 'Sample'; 'Starts' receives the index in 'Sample' at which
+// each one starts.  The first 'nData' bytes of the input are
+// in memory at pData; that is all of it for a mapped file,
+// in which case fp is NULL.  Otherwise 'Size' is the size of
+// the file fp, and the samples past nData are read from it
+// by seeking, after which it is put back where it was.
+// 'Size' may be 0 if the size of the file is not known, as
+// for a pipe, in which case only the start of the file is
+// sampled.
+//----------------------------------------------------------
+static void ReadSamples(
+   const unsigned char *pData,
+   size_t nData,
+   FILE *fp,
+   size_t Size,
+   std::vector<unsigned char> &Sample,
+   std::vector<size_t> &Starts
+   )
+{
+   Sample.assign(pData, pData + __min(nData, DETECT_HEAD));
+   Starts.assign(1, 0);
+
+   // Samples spread through the rest of the file.
+   if (Size <= DETECT_HEAD + DETECT_SAMPLES * DETECT_SAMPLE)
+      return;
+   long long OldPos = fp != NULL ? TellFile(fp) : 0;
+   size_t Stride = (Size - DETECT_HEAD) / DETECT_SAMPLES;
+   for (size_t k = 0; k < DETECT_SAMPLES; k++)
+   {
+      size_t Offset = (DETECT_HEAD + k * Stride + Stride / 2) & ~static_cast<size_t>(3);
+      size_t Len = __min(DETECT_SAMPLE, Size - Offset);
+      size_t Start = Sample.size();
+      if (Offset + Len <= nData)
+      {
+         Sample.insert(Sample.end(), pData + Offset, pData + Offset + Len);
+      }
+      else
+      {
+         if (fp == NULL || OldPos < 0 || !SeekFile(fp, static_cast<long long>(Offset), SEEK_SET))
+            break;
+         Sample.resize(Start + Len);
+         Sample.resize(Start + fread(&Sample[Start], 1, Len, fp));
+      }
+      Starts.push_back(Start);
+   }
+   if (fp != NULL && OldPos >= 0)
+      SeekFile(fp, OldPos, SEEK_SET);
+}
+
+//----------------------------------------------------------
+// Counts gathered while converting one or more files.
+//----------------------------------------------------------
+struct TxStats
+{
+   size_t             nFiles;      // Number of files converted.
+   size_t             nFailed;     // Number of files that failed.
+   size_t             nSkipped;    // Number of files skipped as up to date (/CACHE).
+   size_t             nUncounted;  // Number of files copied by the OS, lines not counted.
+   unsigned long long BytesIn;     // Number of bytes read.
+   unsigned long long BytesOut;    // Number of bytes written.
+   unsigned long long nLines;      // Number of line feeds read.
+   unsigned long long nChars;      // Number of characters read.
+   unsigned long long nBad;        // Number of invalid sequences replaced or skipped.
+   unsigned long long nUnmapped;   // Number of characters not in the code page.
+   unsigned long long nAllocs;     // Number of heap allocations (TXU_COUNT_ALLOCS).
+   double             ReadTime;    // Seconds spent reading input.
+   double             ConvertTime; // Seconds spent converting.
+   double             WriteTime;   // Seconds spent writing output.
+   double             Elapsed;     // Seconds from start to finish.
+};
+
+//----------------------------------------------------------
+// Clears a set of counts.
+//----------------------------------------------------------
+static void InitStats(TxStats &Stats)
+{
+   Stats.nFiles = Stats.nFailed = Stats.nSkipped = Stats.nUncounted = 0;
+   Stats.BytesIn = Stats.BytesOut = Stats.nLines = Stats.nChars = 0;
+   Stats.nBad = Stats.nUnmapped = Stats.nAllocs = 0;
+   Stats.ReadTime = Stats.ConvertTime = Stats.WriteTime = Stats.Elapsed = 0;
+}
+
+//----------------------------------------------------------
+// Adds one set of counts to another.
+//----------------------------------------------------------
+static void AddStats(TxStats &Total, const TxStats &Stats)
+{
+   Total.nFiles      += Stats.nFiles;
+   Total.nFailed     += Stats.nFailed;
+   Total.nSkipped    += Stats.nSkipped;
+   Total.nUncounted  += Stats.nUncounted;
+   Total.BytesIn     += Stats.BytesIn;
+   Total.BytesOut    += Stats.BytesOut;
+   Total.nLines      += Stats.nLines;
+   Total.nChars      += Stats.nChars;
+   Total.nBad        += Stats.nBad;
+   Total.nUnmapped   += Stats.nUnmapped;
+   Total.nAllocs     += Stats.nAllocs;
+   Total.ReadTime    += Stats.ReadTime;
+   Total.ConvertTime += Stats.ConvertTime;
+   Total.WriteTime   += Stats.WriteTime;
+   Total.Elapsed     += Stats.Elapsed;
+}
+
+// Serializes the /VERBOSE and /STATS reports of each file in
+// batch mode.
+static std::mutex VerboseLock;
+
+//----------------------------------------------------------
+// Writes a string to the stats file as a JSON string.
+//----------------------------------------------------------
+static void WriteJsonString(const _TCHAR *s)
+{
+   fputc('"', fpStats);
+   for (; *s; s++)
+   {
+      unsigned char c = static_cast<unsigned char>(*s);
+      if (c == '"' || c == '\\')
+         fprintf(fpStats, "\\%c", c);
+      else if (c < 0x20)
+         fprintf(fpStats, "\\u%04x", c);
+      else
+         fputc(c, fpStats);
+   }
+   fputc('"', fpStats);
+}
+
+//----------------------------------------------------------
+// Writes the counts and timings of a set of stats to the
+// stats file, as the members of a JSON object.
+//----------------------------------------------------------
+static void WriteJsonStats(const TxStats &Stats)
+{
+   double MB = static_cast<double>(Stats.BytesIn) / (1024.0 * 1024.0);
+   fprintf(fpStats, "\"bytes_in\":%llu,\"bytes_out\":%llu,\"chars\":%llu,"
+      "\"invalid\":%llu,\"unmapped\":%llu,"
+      "\"read_s\":%.6f,\"convert_s\":%.6f,\"write_s\":%.6f,\"elapsed_s\":%.6f,\"mb_per_s\":%.1f",
+      Stats.BytesIn, Stats.BytesOut, Stats.nChars, Stats.nBad, Stats.nUnmapped,
+      Stats.ReadTime, Stats.ConvertTime, Stats.WriteTime, Stats.Elapsed,
+      Stats.Elapsed > 0 ? MB / Stats.Elapsed : 0.0);
+#ifdef TXU_COUNT_ALLOCS
+   fprintf(fpStats, ",\"allocs\":%llu", Stats.nAllocs);
+#endif
+}
+
+//----------------------------------------------------------
+// /STATS=JSON:  writes the record of one file, as a line of
+// JSON.  'ThreadTime' is the time each /THREADS thread spent
+// converting, if the file was converted in parallel.
+//----------------------------------------------------------
+static void WriteFileStats(
+   const _TCHAR *szInName,
+   TxEncoding InFmt,
+   TxEncoding OutFmt,
+   bool bOk,
+   const TxStats &Stats,
+   const std::vector<double> &ThreadTime
+   )
+{
+   std::lock_guard<std::mutex> Lock(VerboseLock);
+   fprintf(fpStats, "{\"file\":");
+   WriteJsonString(szInName);
+   fprintf(fpStats, ",\"ok\":%s,\"in_format\":\"%s\",\"out_format\":\"%s\",",
+      bOk ? "true" : "false", TxEncodingToName(InFmt), TxEncodingToName(OutFmt));
+   WriteJsonStats(Stats);
+   if (!ThreadTime.empty())
+   {
+      fprintf(fpStats, ",\"thread_convert_s\":[");
+      for (size_t k = 0; k < ThreadTime.size(); k++)
+         fprintf(fpStats, "%s%.6f", k > 0 ? "," : "", ThreadTime[k]);
+      fprintf(fpStats, "]");
+   }
+   fprintf(fpStats, "}\n");
+   fflush(fpStats);
+}
+
+//----------------------------------------------------------
+// Converts one file.  If InFile is empty or "-", the input
+// comes from stdin, and if OutFile is empty, the output goes
+// to stdout.  InFmt may be FMT_AUTO, in which case the
+// encoding is found from the start of the file.
+// Standard input and other streams are never seeked back:
+// the start of the file, read for the BOM and to detect the
+// encoding, is held as a peek buffer that the reader then
+// decodes first, so txu can read from a pipe.
+// Returns true if successful, false if an error occurs
+// (which has been reported).
+//----------------------------------------------------------
+static bool ConvertFile(
+   const std::string & InFile,   // Name of the input file.
+   const std::string & OutFile,  // Name of the output file, or empty.
+   TxEncoding InFmt,             // Encoding of the input file.
+   TxEncoding OutFmt,            // Encoding of the output file.
+   TxWorkspace & Ws,             // Reader, writer and buffers to use.
+   TxStats & Stats               // Counts are added to this.
+   )
+{
+   TxReader &In = Ws.In;
+   TxWriter &Out = Ws.Out;
+   TxConverter &Cv = Ws.Cv;
+   std::vector<unsigned char> &Peek = Ws.Peek;
+   TxClock::time_point Start = TxClock::now();
+   unsigned long long AllocsBefore = HeapAllocs();
+
+   // Open the input file.  Files on local disk are mapped
+   // into memory if they are not too large; anything else is
+   // read as a stream.
+   bool bStdin = InFile.empty() || InFile == _T("-");
+   const _TCHAR *szInName = bStdin ? _T("(stdin)") : InFile.c_str();
+   if (bResume && (bStdin || OutFile.empty()))
+   {
+      msg("/RESUME needs an input file and an output file", szInName);
+      return false;
+   }
+   TxMapping Map;
+   FILE *fpIn = NULL;
+   size_t MaxMapSize = nMapLimit > ~static_cast<size_t>(0) / (1024 * 1024) ?
+      ~static_cast<size_t>(0) : nMapLimit * 1024 * 1024;
+   bool bMapped = !bStdin && MapInputFile(InFile.c_str(), MaxMapSize, Map);
+   if (bStdin)
+   {
+      fpIn = stdin;
+#ifdef _WIN32
+      _setmode(_fileno(stdin), _O_BINARY);
+#endif
+   }
+   else if (!bMapped && _tfopen_s(&fpIn, InFile.c_str(), "rb"))
+   {
+      msg("Failed opening input file", szInName);
+      return false;
+   }
+
+   // Get the start of the file, for BOM detection.  A stream
+   // is read into the peek buffer, enough of it to detect the
+   // encoding from too.  Reading it, and the samples for
+   // detection, counts as reading for /STATS.
+   TxClock::time_point HeadStart = TxClock::now();
+   const unsigned char *pHead = NULL;
+   size_t nHead = 0;
+   if (bMapped)
+   {
+      pHead = Map.pData;
+      nHead = Map.Size;
+   }
+   else
+   {
+      Peek.resize(DETECT_HEAD);
+      Peek.resize(fread(&Peek[0], 1, Peek.size(), fpIn));
+      pHead = Peek.empty() ? NULL : &Peek[0];
+      nHead = Peek.size();
+   }
+
+   // Compressed input is decompressed as it is read, so it is
+   // read as a stream even from a file that could be mapped,
+   // and the peek buffer then holds the start of the text.
+   TxCompression Packing = CheckCompression(pHead, nHead);
+   TxUnpacker *pUnpack = NULL;
+   if (Packing != COMPRESS_NONE)
+   {
+      if (!HasCompression(Packing))
+      {
+         msg("Input is compressed, and this txu was built without", TxCompressionToName(Packing));
+         CloseInput(fpIn, Map);
+         return false;
+      }
+      if (bResume)
+      {
+         msg("/RESUME can't be used with compressed input", szInName);
+         CloseInput(fpIn, Map);
+         return false;
+      }
+      pUnpack = &Ws.Unpack;
+      if (bMapped)
+      {
+         UnmapInputFile(Map);
+         bMapped = false;
+         if (_tfopen_s(&fpIn, InFile.c_str(), "rb"))
+         {
+            msg("Failed opening input file", szInName);
+            return false;
+         }
+         StartUnpacking(*pUnpack, Packing, NULL, 0);
+      }
+      else
+         StartUnpacking(*pUnpack, Packing, &Peek[0], Peek.size());
+      Peek.resize(DETECT_HEAD);
+      Peek.resize(ReadInput(fpIn, pUnpack, &Peek[0], Peek.size()));
+      pHead = Peek.empty() ? NULL : &Peek[0];
+      nHead = Peek.size();
+      if (pUnpack->bFailed)
+      {
+         msg("Bad or incomplete compressed input", szInName);
+         CloseInput(fpIn, Map);
+         return false;
+      }
+   }
+   if (nHead < 1)
+   {
+      msg("Empty input file", szInName);
+      CloseInput(fpIn, Map);
+      return false;
+   }
+
+   // If input mode was not specified, attempt to determine format
+   // from input data.
+   size_t BOMLen = 0;
+   TxEncoding BOMFmt = CheckBOM(pHead, nHead, BOMLen);
+   int Confidence = -1;
+   if (InFmt == FMT_AUTO && BOMFmt == FMT_UNKNOWN)
+   {
+      // No BOM, so work out the encoding from samples of the
+      // text, only from its start if it can't be seeked in.
+      ReadSamples(pHead, nHead, fpIn, pUnpack != NULL ? 0 : InputSize(fpIn, Map), Ws.Sample, Ws.Starts);
+      BOMFmt = DetectEncoding(Ws.Sample, Ws.Starts, Confidence);
+   }
+   double HeadTime = bMapped ? 0 : SecondsSince(HeadStart);
+   if (InFmt == FMT_AUTO)
+   {
+      if (BOMFmt == FMT_UNKNOWN)
+      {
+         msg("AUTO mode can't identify input format.  Please specify with /INFORMAT option.", szInName);
+         CloseInput(fpIn, Map);
+         return false;
+      }
+      InFmt = BOMFmt;
+   }
+
+   if (bVerbose)
+   {
+      std::lock_guard<std::mutex> Lock(VerboseLock);
+
+      size_t InLength = InputSize(fpIn, Map);
+      size_t bytes = __min(nHead, 8);
+      _ftprintf(stderr, _T("Input file:    \"%s\"\n"), szInName);
+      _ftprintf(stderr, _T("Input length:  %zu bytes\n"), InLength);
+      _ftprintf(stderr, _T("Input access:  %s\n"), bMapped ? _T("mapped") : bStdin ? _T("stdin") : _T("stream"));
+      if (Packing != COMPRESS_NONE)
+         _ftprintf(stderr, _T("Compressed:    %s\n"), TxCompressionToName(Packing));
+      _ftprintf(stderr, _T("Input format:  %s\n"), TxEncodingToName(InFmt));
+      if (Confidence >= 0)
+         _ftprintf(stderr, _T("Detected with: %d%% confidence\n"), Confidence);
+      _ftprintf(stderr, _T("Output file:   \"%s\"\n"), OutFile.size() > 0 ? OutFile.c_str() : _T("(stdout)"));
+      _ftprintf(stderr, _T("Output format: %s\n"), TxEncodingToName(OutFmt));
+      if (Compress != COMPRESS_NONE)
+         _ftprintf(stderr, _T("Compress to:   %s\n"), TxCompressionToName(Compress));
+      if (InFmt == FMT_ANSI || OutFmt == FMT_ANSI)
+         _ftprintf(stderr, _T("Code page:     %u (%s)\n"), CodePageNumber(), CodePageName());
+      _ftprintf(stderr, _T("SIMD kernels:  %s\n"), KernelsName());
+      _ftprintf(stderr, _T("Threads:       %zu\n"), nThreads);
+      _ftprintf(stderr, _T("First %zu bytes: "), bytes);
+      for (size_t i = 0; i < bytes; i++)
+         _ftprintf(stderr, _T(" %02X"), pHead[i]);
+      _ftprintf(stderr, _T("\n"));
+   }
+
+   // With /MEASURE or /COUNT the text is only looked at, read
+   // the same way it would be converted, and nothing is written.
+   if (bMeasure || bCount)
+   {
+      if (bMapped)
+         InitMappedReader(In, Map.pData, Map.Size, BOMLen, InFmt);
+      else
+         InitReader(In, fpIn, pUnpack, InFmt, nBufSize * 1024, pHead + BOMLen, Peek.size() - BOMLen, BOMLen);
+      TxInitConverter(Cv, InFmt, OutFmt);
+      size_t nBOM;
+      BOMBytes(OutFmt, nBOM);
+      unsigned long long Bytes = nBOM;
+      if (bCount)
+         CountStream(In, Cv.nChars, Cv.nLines);
+      else
+         MeasureStream(In, Cv, Bytes);
+      EndReader(In);
+      if (pUnpack != NULL && pUnpack->bFailed)
+      {
+         msg("Bad or incomplete compressed input", szInName);
+         In.bInvalid = true;
+      }
+      CloseInput(fpIn, Map);
+      if (In.bInvalid)
+         return false;
+      if (bCount)
+         _tprintf(_T("%s:  %zu lines, %zu code points, %zu bytes\n"), szInName, Cv.nLines, Cv.nChars,
+            In.Offset + In.ByteLen);
+      else
+         _tprintf(_T("%s:  %llu bytes, %zu code points\n"), szInName, Bytes, Cv.nChars);
+      return true;
+   }
+
+   // With /RESUME, look for a checkpoint left by an earlier
+   // conversion of this file that did not finish.
+   TxCheckpoint Resume;
+   bool bResuming = false;
+   if (bResume)
+   {
+      Resume.Name = OutFile + _T(".txuresume");
+      Resume.InSize = InputSize(fpIn, Map);
+      bResuming = LoadCheckpoint(Resume, InFmt, OutFmt);
+   }
+
+   // ANSI text in and out can be copied by the operating
+   // system when any byte is valid in the code page.  Other
+   // text must be checked, and is copied as it is checked.
+   // With /VERBOSE the text is read, to count the lines, and
+   // with /RESUME, to take checkpoints.
+   // It is only done for a file that can be opened again by
+   // name, when nothing is compressed.
+   bool bRawCopy = InFmt == FMT_ANSI && OutFmt == FMT_ANSI && CodePageHasEveryByte() &&
+      !bVerbose && !bResume && OutFile.size() > 0 &&
+      !bStdin && Eol == EOL_KEEP && pUnpack == NULL && Compress == COMPRESS_NONE;
+#ifdef _WIN32
+   // If even the BOM is the same, the output is a copy of the
+   // whole file.
+   bool bSameBOM = BOMLen > 0 ? BOMFmt == OutFmt : OutFmt == FMT_ANSI;
+   size_t Size = InputSize(fpIn, Map);
+   if (bRawCopy && bSameBOM)
+   {
+      CloseInput(fpIn, Map);
+      if (!CopyFileEx(InFile.c_str(), OutFile.c_str(), NULL, NULL, NULL, 0))
+      {
+         msg("Failed writing output file", OutFile.c_str());
+         return false;
+      }
+      TxStats File;
+      InitStats(File);
+      File.nFiles = 1;
+      File.nUncounted = 1;
+      File.BytesIn = File.BytesOut = Size;
+      File.nChars = Size - BOMLen;
+      File.Elapsed = File.WriteTime = SecondsSince(Start);
+      File.nAllocs = HeapAllocs() - AllocsBefore;
+      AddStats(Stats, File);
+      if (fpStats != NULL)
+         WriteFileStats(szInName, InFmt, OutFmt, true, File, std::vector<double>());
+      return true;
+   }
+#endif
+
+   // Open the output file, if any.
+   FILE *fpOut = stdout;
+   if (OutFile.size() > 0)
+   {
+      if (bResuming && !OpenResumedOutput(OutFile, Resume.OutOffset, fpOut))
+         bResuming = false;
+      if (!bResuming && _tfopen_s(&fpOut, OutFile.c_str(), "wb"))
+      {
+         msg("Failed opening output file", OutFile.c_str());
+         CloseInput(fpIn, Map);
+         return false;
+      }
+   }
+
+   // Reserve the space for the output up front, when the size
+   // of the input is known, and so the most the output can
+   // take, which it is not if either is compressed.
+   unsigned long long Reserved = 0;
+   size_t InLength = bStdin || pUnpack != NULL || Compress != COMPRESS_NONE ? 0 : InputSize(fpIn, Map);
+   if (OutFile.size() > 0 && !bResuming && InLength > BOMLen)
+   {
+      size_t nBOM;
+      BOMBytes(OutFmt, nBOM);
+      Reserved = OutputSizeLimit(InFmt, OutFmt, InLength - BOMLen) + nBOM;
+      if (Reserved >= PREALLOC_MIN)
+         PreallocateFile(fpOut, Reserved);
+      else
+         Reserved = 0;
+   }
+
+   // Write byte order marker at start of file, unless it is
+   // there already from before the checkpoint.  With
+   // /COMPRESS it is compressed along with the text.
+   InitWriter(Out, fpOut, OutFmt);
+   if (Compress != COMPRESS_NONE)
+   {
+      if (!StartPacking(Ws.Pack, Compress))
+      {
+         msg("Failed setting up compression", TxCompressionToName(Compress));
+         CloseInput(fpIn, Map);
+         if (OutFile.size() > 0)
+            fclose(fpOut);
+         return false;
+      }
+      Out.pPack = &Ws.Pack;
+   }
+   if (bResume)
+   {
+      Out.pResume = &Resume;
+      Out.Written = bResuming ? Resume.OutOffset : 0;
+      Resume.Next = (bResuming ? Resume.InOffset : 0) + RESUME_INTERVAL;
+   }
+   if (bResuming)
+   {
+      std::lock_guard<std::mutex> Lock(VerboseLock);
+      _ftprintf(stderr, _T("Resuming %s at input offset %llu, output offset %llu\n"), szInName,
+         Resume.InOffset, Resume.OutOffset);
+   }
+   if (!bResuming && !WriteBOM(Out))
+   {
+      CloseInput(fpIn, Map);
+      if (OutFile.size() > 0)
+         fclose(fpOut);
+      return false;
+   }
+
+   // Let the operating system copy what it can of a file that
+   // needs no conversion; the rest, if any, is copied below.
+   // That leaves the peek buffer behind, so the file is seeked
+   // to the rest, which is safe as it is not a pipe.
+   size_t Copied = 0;
+   size_t PeekPos = BOMLen;
+   if (bRawCopy && FlushWriter(Out) && WaitWriter(Out) && fflush(fpOut) == 0)
+   {
+      size_t Len = InputSize(fpIn, Map) - BOMLen;
+      TxClock::time_point CopyStart = TxClock::now();
+      Copied = CopyFileBytes(InFile.c_str(), BOMLen, Len, fpOut);
+      Out.WriteTime += SecondsSince(CopyStart);
+      Out.Written += Copied;
+      if (!bMapped && Copied > 0)
+      {
+         SeekFile(fpIn, static_cast<long long>(BOMLen + Copied), SEEK_SET);
+         PeekPos = Peek.size();
+      }
+   }
+
+   // A conversion being resumed starts from the checkpoint.
+   size_t ReadFrom = BOMLen + Copied;
+   if (bResuming)
+   {
+      ReadFrom = static_cast<size_t>(Resume.InOffset);
+      if (!bMapped)
+      {
+         SeekFile(fpIn, static_cast<long long>(ReadFrom), SEEK_SET);
+         PeekPos = Peek.size();
+      }
+   }
+
+   // Process the input file.
+   if (bMapped)
+      InitMappedReader(In, Map.pData, Map.Size, ReadFrom, InFmt);
+   else
+      InitReader(In, fpIn, pUnpack, InFmt, nThreads > 1 ? nThreads * THREAD_CHUNK : nBufSize * 1024,
+         pHead + PeekPos, Peek.size() - PeekPos, ReadFrom);
+   TxInitConverter(Cv, InFmt, OutFmt);
+   Cv.nChars = Copied;
+   if (bResuming)
+   {
+      Cv.bAfterCR = Resume.bAfterCR;
+      Cv.nChars = static_cast<size_t>(Resume.nChars);
+      Cv.nLines = static_cast<size_t>(Resume.nLines);
+      Cv.nBad = static_cast<size_t>(Resume.nBad);
+      Cv.nUnmapped = static_cast<size_t>(Resume.nUnmapped);
+   }
+
+   // The time spent converting is the time in the loop, less
+   // any spent waiting for the reads and writes going on in the
+   // background.
+   TxConvertFn Convert = GetConverter(InFmt, OutFmt);
+   TxClock::time_point ConvertStart = TxClock::now();
+   bool bConverted = Convert(Ws);
+   EndReader(In);
+   double ConvertTime = __max(SecondsSince(ConvertStart) - In.WaitTime - Out.WaitTime, 0.0);
+   bool bWritten = EndWriter(Out) && bConverted;
+   if (pUnpack != NULL && pUnpack->bFailed)
+   {
+      msg("Bad or incomplete compressed input", szInName);
+      In.bInvalid = true;
+   }
+   if (Reserved > 0)
+      ReleaseUnused(fpOut, Out.Written);
+   if (!bWritten)
+   {
+      msg("Failed writing output file", OutFile.c_str());
+      CloseInput(fpIn, Map);
+      if (OutFile.size() > 0)
+         fclose(fpOut);
+      return false;
+   }
+
+   TxStats File;
+   InitStats(File);
+   File.nFiles = 1;
+   File.nUncounted = Copied > 0 ? 1 : 0;
+   File.BytesIn = In.Offset + In.ByteLen;
+   File.BytesOut = Out.Written;
+   File.nLines = Cv.nLines;
+   File.nChars = Cv.nChars;
+   File.nBad = Cv.nBad;
+   File.nUnmapped = Cv.nUnmapped;
+   File.ReadTime = HeadTime + In.ReadTime;
+   File.ConvertTime = ConvertTime;
+   File.WriteTime = Out.WriteTime;
+   File.Elapsed = SecondsSince(Start);
+   File.nAllocs = HeapAllocs() - AllocsBefore;
+
+   // With /ONERROR=STOP the conversion ended at invalid input,
+   // which has been reported already.
+   if (In.bInvalid)
+   {
+      if (fpStats != NULL)
+         WriteFileStats(szInName, InFmt, OutFmt, false, File, In.ThreadTime);
+      CloseInput(fpIn, Map);
+      if (OutFile.size() > 0)
+         fclose(fpOut);
+      return false;
+   }
+
+   if (bVerbose || Cv.nBad > 0 || Cv.nUnmapped > 0)
+   {
+      std::lock_guard<std::mutex> Lock(VerboseLock);
+      if (Cv.nBad > 0)
+         _ftprintf(stderr, "Warning:  %zu invalid character sequences %s in %s\n", Cv.nBad,
+            OnError == ONERROR_REPLACE ? "replaced" : "skipped", szInName);
+      if (Cv.nUnmapped > 0)
+         _ftprintf(stderr, "Warning:  %zu characters not in code page %u %s in %s\n", Cv.nUnmapped,
+            CodePageNumber(), OnError == ONERROR_REPLACE ? "replaced" : "skipped", szInName);
+      if (bVerbose)
+      {
+         _ftprintf(stderr, "Lines Processed:  %zu\n", Cv.nLines);
+         _ftprintf(stderr, "Chars Processed:  %zu\n", Cv.nChars);
+#ifdef TXU_COUNT_ALLOCS
+         _ftprintf(stderr, "Heap allocations: %llu\n", File.nAllocs);
+#endif
+      }
+   }
+
+   AddStats(Stats, File);
+   if (fpStats != NULL)
+      WriteFileStats(szInName, InFmt, OutFmt, true, File, In.ThreadTime);
+
+   // Clean up.  The conversion is complete, so its checkpoint
+   // is no longer needed.
+   CloseInput(fpIn, Map);
+   if (OutFile.size() > 0)
+      fclose(fpOut);
+   if (bResume)
+      _tremove(Resume.Name.c_str());
+
+   return true;
+}
+
+//----------------------------------------------------------
+// Batch mode.  Many files are converted by one run of the
+// program, each by a single worker thread, using a pool of
+// nJobs workers.  The files are dealt out to the workers'
+// queues up front; a worker takes files from the front of
+// its own queue, and when that is empty steals from the
+// back of the others', so a worker that drew large files
+// does not hold up the end of the run.
+//----------------------------------------------------------
+
+#ifdef _WIN32
+const _TCHAR PATH_SEP = '\\';
+#else
+const _TCHAR PATH_SEP = '/';
+#endif
+
+// One file to be converted in batch mode.
+struct TxBatchItem
+{
+   std::string InFile;     // Path of the input file.
+   std::string SubDir;     // Subdirectory of the output directory, or empty.
+   std::string Name;       // File name without its directory.
+};
+
+// Settings and work shared by all batch workers.
+struct TxBatch
+{
+   std::vector<TxBatchItem> Items;   // Files to be converted.
+   std::string OutDir;               // Output directory, or empty.
+   std::string NameRule;             // Output name, with '*' for the input name.
+   TxEncoding  InFmt;                // Encoding of the input files.
+   TxEncoding  OutFmt;               // Encoding of the output files.
+   struct TxCache *pCache;           // Cache of converted files (/CACHE), or NULL.
+   std::string Settings;             // Settings, as the cache records them.
+};
+
+// Queue of work for one batch worker.
+struct TxWorkQueue
+{
+   std::mutex         Lock;          // Guards Items.
+   std::deque<size_t> Items;         // Indexes into TxBatch::Items.
+};
+
+//----------------------------------------------------------
+// Returns true if the path names an existing directory.
+//----------------------------------------------------------
+static bool IsDirectory(const std::string &Path)
+{
+#ifdef _WIN32
+   DWORD Attr = GetFileAttributes(Path.c_str());
+   return Attr != INVALID_FILE_ATTRIBUTES && (Attr & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+   struct stat st;
+   return stat(Path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+//----------------------------------------------------------
+// Returns true if the string contains '*' or '?' wildcards.
+//----------------------------------------------------------
+static bool HasWildcards(const std::string &s)
+{
+   return s.find_first_of(_T("*?")) != std::string::npos;
+}
+
+//----------------------------------------------------------
+// Ends a directory path, unless it is empty, with a path
+// separator, so that a file name can be appended to it.
+//----------------------------------------------------------
+static void EndWithSeparator(std::string &Path)
+{
+   if (!Path.empty() && Path[Path.size() - 1] != PATH_SEP && Path[Path.size() - 1] != '/')
+      Path += PATH_SEP;
+}
+
+//----------------------------------------------------------
+// Appends a file name to a directory path, in place.
+//----------------------------------------------------------
+static void AppendPath(std::string &Path, const std::string &Name)
+{
+   EndWithSeparator(Path);
+   Path += Name;
+}
+
+//----------------------------------------------------------
+// Appends a file name to a directory path.
+//----------------------------------------------------------
+static std::string JoinPath(const std::string &Dir, const std::string &Name)
+{
+   std::string Path = Dir;
+   AppendPath(Path, Name);
+   return Path;
+}
+
+//----------------------------------------------------------
+// Adds the files in directory 'Dir' whose names match the
+// wildcard 'Mask' to the batch, and if 'bRecurse' is set,
+// those in all of its subdirectories as well.  'SubDir' is
+// Dir relative to the directory the search started from.
+//----------------------------------------------------------
+static void FindFiles(
+   const std::string & Dir,
+   const std::string & Mask,
+   const std::string & SubDir,
+   bool bRecurse,
+   std::vector<TxBatchItem> & Items
+   )
+{
+   std::vector<std::string> SubDirs;
+
+#ifdef _WIN32
+   // Files matching the wildcard.
+   WIN32_FIND_DATA fd;
+   HANDLE h = FindFirstFile(JoinPath(Dir, Mask).c_str(), &fd);
+   if (h != INVALID_HANDLE_VALUE)
+   {
+      do
+      {
+         if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+         {
+            TxBatchItem Item = { JoinPath(Dir, fd.cFileName), SubDir, fd.cFileName };
+            Items.push_back(Item);
+         }
+      } while (FindNextFile(h, &fd));
+      FindClose(h);
+   }
+
+   // Subdirectories, whatever their names.
+   if (bRecurse)
+   {
+      h = FindFirstFile(JoinPath(Dir, _T("*")).c_str(), &fd);
+      if (h != INVALID_HANDLE_VALUE)
+      {
+         do
+         {
+            std::string Name = fd.cFileName;
+            if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && Name != _T(".") && Name != _T(".."))
+               SubDirs.push_back(Name);
+         } while (FindNextFile(h, &fd));
+         FindClose(h);
+      }
+   }
+#else
+   DIR *d = opendir(Dir.empty() ? "." : Dir.c_str());
+   if (d == NULL)
+      return;
+   while (struct dirent *e = readdir(d))
+   {
+      std::string Name = e->d_name;
+      if (Name == "." || Name == "..")
+         continue;
+      std::string Path = JoinPath(Dir, Name);
+      struct stat st;
+      if (stat(Path.c_str(), &st) != 0)
+         continue;
+      if (S_ISDIR(st.st_mode))
+         SubDirs.push_back(Name);
+      else if (S_ISREG(st.st_mode) && fnmatch(Mask.c_str(), Name.c_str(), 0) == 0)
+      {
+         TxBatchItem Item = { Path, SubDir, Name };
+         Items.push_back(Item);
+      }
+   }
+   closedir(d);
+#endif
+
+   if (bRecurse)
+   {
+      std::sort(SubDirs.begin(), SubDirs.end());
+      for (size_t i = 0; i < SubDirs.size(); i++)
+         FindFiles(JoinPath(Dir, SubDirs[i]), Mask, JoinPath(SubDir, SubDirs[i]), true, Items);
+   }
+}
+
+//----------------------------------------------------------
+// Adds the files named in a list file, one per line, to the
+// batch.
+// Returns true if successful, false if the list can't be read.
+//----------------------------------------------------------
+static bool ReadFileList(const std::string &ListFile, std::vector<TxBatchItem> &Items)
+{
+   FILE *fp = NULL;
+   if (_tfopen_s(&fp, ListFile.c_str(), "r"))
+      return false;
+
+   _TCHAR Line[4096];
+   while (_fgetts(Line, _countof(Line), fp) != NULL)
+   {
+      // Remove the line ending and any trailing blanks.
+      size_t n = _tcslen(Line);
+      while (n > 0 && (Line[n - 1] == '\n' || Line[n - 1] == '\r' || Line[n - 1] == ' ' || Line[n - 1] == '\t'))
+         Line[--n] = '\0';
+      if (n == 0)
+         continue;
+
+      std::string Path = Line;
+      size_t Sep = Path.find_last_of(_T("\\/"));
+      TxBatchItem Item = { Path, std::string(), Sep == std::string::npos ? Path : Path.substr(Sep + 1) };
+      Items.push_back(Item);
+   }
+   fclose(fp);
+   return true;
+}
+
+//----------------------------------------------------------
+// Creates a directory and any missing parent directories.
+// Returns true if the directory exists afterwards.
+//----------------------------------------------------------
+static bool MakeDirectories(const std::string &Dir)
+{
+   if (Dir.empty() || IsDirectory(Dir))
+      return true;
+
+   size_t Sep = Dir.find_last_of(_T("\\/"));
+   if (Sep != std::string::npos && Sep > 0 && !MakeDirectories(Dir.substr(0, Sep)))
+      return false;
+
+#ifdef _WIN32
+   CreateDirectory(Dir.c_str(), NULL);
+#else
+   mkdir(Dir.c_str(), 0777);
+#endif
+   return IsDirectory(Dir);
+}
+
+//----------------------------------------------------------
+// Works out the output file name for a batch item, from the
+// naming rule: '*' in the rule stands for the input file
+// name without its extension.  An empty rule keeps the input
+// name unchanged.  'Dir' receives the directory the output
+// goes in, and 'Path' the whole name.  Both are built in
+// place, so that strings kept from one file to the next
+// need not be allocated again.
+//----------------------------------------------------------
+static void OutputName(const TxBatch &Batch, const TxBatchItem &Item, std::string &Dir, std::string &Path)
+{
+   if (Batch.OutDir.empty())
+   {
+      // Output goes next to the input.
+      size_t Sep = Item.InFile.find_last_of(_T("\\/"));
+      Dir.assign(Item.InFile, 0, Sep == std::string::npos ? 0 : Sep);
+   }
+   else
+   {
+      Dir.assign(Batch.OutDir);
+      if (!Item.SubDir.empty())
+         AppendPath(Dir, Item.SubDir);
+   }
+
+   Path.assign(Dir);
+   EndWithSeparator(Path);
+   if (Batch.NameRule.empty())
+   {
+      Path += Item.Name;
+      return;
+   }
+   size_t BaseLen = __min(Item.Name.find_last_of(_T('.')), Item.Name.size());
+   for (size_t i = 0; i < Batch.NameRule.size(); i++)
+   {
+      if (Batch.NameRule[i] == '*')
+         Path.append(Item.Name, 0, BaseLen);
+      else
+         Path += Batch.NameRule[i];
+   }
+}
+
+//----------------------------------------------------------
+// Batch cache (/CACHE).  The cache file remembers, for each
+// input file converted, its size, the time it was written,
+// and a hash of its contents, with the settings used and the
+// output file made from it.  A later batch run skips a file
+// whose input and output are both still as remembered.  The
+// input is only hashed when its size and time match, so a
+// changed file costs no more than a stat; an unchanged one
+// costs a read, which is far cheaper than converting it.
+//----------------------------------------------------------
+
+// What the cache knows of one input file.
+struct TxCacheEntry
+{
+   unsigned long long InSize;    // Size of the input file.
+   unsigned long long InTime;    // Time the input file was last written.
+   unsigned long long Hash;      // XXH64 hash of the contents of the input file.
+   bool               bHashed;   // True if Hash has been worked out.
+   std::string        Settings;  // Settings it was converted with.
+   std::string        OutFile;   // Name of the output file.
+   unsigned long long OutSize;   // Size of the output file.
+   unsigned long long OutTime;   // Time the output file was written.
+};
+
+// The cache, shared by all batch workers.
+struct TxCache
+{
+   std::string                          Name;     // Name of the cache file.
+   std::mutex                           Lock;     // Guards Entries.
+   std::map<std::string, TxCacheEntry>  Entries;  // Entries by input file name.
+};
+
+// XXH64 constants.
+const unsigned long long XXH_PRIME1 = 11400714785074694791ULL;
+const unsigned long long XXH_PRIME2 = 14029467366897019727ULL;
+const unsigned long long XXH_PRIME3 = 1609587929392839161ULL;
+const unsigned long long XXH_PRIME4 = 9650029242287828579ULL;
+const unsigned long long XXH_PRIME5 = 2870177450012600261ULL;
+
+// State of an XXH64 hash being worked out a block at a time.
+struct TxHash
+{
+   unsigned long long V[4];      // Accumulators.
+   unsigned long long Total;     // Number of bytes hashed.
+   unsigned char      Buf[32];   // Bytes short of a whole stripe.
+   size_t             BufLen;    // Number of bytes in Buf.
+};
+
+static unsigned long long RotateLeft(unsigned long long x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+static unsigned long long Read64(const unsigned char *p)
+{
+   unsigned long long x = 0;
+   for (int i = 7; i >= 0; i--)
+      x = (x << 8) | p[i];
+   return x;
+}
+
+static unsigned long long HashRound(unsigned long long Acc, unsigned long long Input)
+{
+   return RotateLeft(Acc + Input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+static unsigned long long HashMerge(unsigned long long h, unsigned long long v)
+{
+   return (h ^ HashRound(0, v)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+//----------------------------------------------------------
+// Starts, adds to and finishes an XXH64 hash (seed 0).
+//----------------------------------------------------------
+static void InitHash(TxHash &h)
+{
+   h.V[0] = XXH_PRIME1 + XXH_PRIME2;
+   h.V[1] = XXH_PRIME2;
+   h.V[2] = 0;
+   h.V[3] = 0 - XXH_PRIME1;
+   h.Total = 0;
+   h.BufLen = 0;
+}
+
+static void AddToHash(TxHash &h, const unsigned char *p, size_t n)
+{
+   h.Total += n;
+   if (h.BufLen > 0)
+   {
+      size_t Fill = __min(32 - h.BufLen, n);
+      memcpy(h.Buf + h.BufLen, p, Fill);
+      h.BufLen += Fill;
+      p += Fill;
+      n -= Fill;
+      if (h.BufLen < 32)
+         return;
+      for (int k = 0; k < 4; k++)
+         h.V[k] = HashRound(h.V[k], Read64(h.Buf + 8 * k));
+      h.BufLen = 0;
+   }
+   for (; n >= 32; p += 32, n -= 32)
+   {
+      for (int k = 0; k < 4; k++)
+         h.V[k] = HashRound(h.V[k], Read64(p + 8 * k));
+   }
+   memcpy(h.Buf, p, n);
+   h.BufLen = n;
+}
+
+static unsigned long long FinishHash(const TxHash &h)
+{
+   unsigned long long x;
+   if (h.Total >= 32)
+   {
+      x = RotateLeft(h.V[0], 1) + RotateLeft(h.V[1], 7) + RotateLeft(h.V[2], 12) + RotateLeft(h.V[3], 18);
+      for (int k = 0; k < 4; k++)
+         x = HashMerge(x, h.V[k]);
+   }
+   else
+      x = h.V[2] + XXH_PRIME5;
+   x += h.Total;
+
+   const unsigned char *p = h.Buf;
+   size_t n = h.BufLen;
+   for (; n >= 8; p += 8, n -= 8)
+      x = RotateLeft(x ^ HashRound(0, Read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+   if (n >= 4)
+   {
+      unsigned long long k = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned long long>(p[3]) << 24);
+      x = RotateLeft(x ^ (k * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+      p += 4;
+      n -= 4;
+   }
+   for (; n > 0; p++, n--)
+      x = RotateLeft(x ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+   x ^= x >> 33;
+   x *= XXH_PRIME2;
+   x ^= x >> 29;
+   x *= XXH_PRIME3;
+   x ^= x >> 32;
+   return x;
+}
+
+//----------------------------------------------------------
+// Works out the XXH64 hash of the contents of a file.
+// Returns true if successful, false if it can't be read.
+//----------------------------------------------------------
+static bool HashFile(const std::string &Path, unsigned long long &Hash)
+{
+   FILE *fp;
+   if (_tfopen_s(&fp, Path.c_str(), "rb"))
+      return false;
+   std::vector<unsigned char> Block(nBufSize * 1024);
+   TxHash h;
+   InitHash(h);
+   size_t n;
+   while ((n = fread(&Block[0], 1, Block.size(), fp)) > 0)
+      AddToHash(h, &Block[0], n);
+   bool bRead = !ferror(fp);
+   fclose(fp);
+   Hash = FinishHash(h);
+   return bRead;
+}
+
+//----------------------------------------------------------
+// Retrieves the size of a file and the time it was last
+// written.
+// Returns true if successful, false if there is no such file.
+//----------------------------------------------------------
+static bool GetFileInfo(const std::string &Path, unsigned long long &Size, unsigned long long &Time)
+{
+#ifdef _WIN32
+   WIN32_FILE_ATTRIBUTE_DATA fa;
+   if (!GetFileAttributesEx(Path.c_str(), GetFileExInfoStandard, &fa))
+      return false;
+   Size = (static_cast<unsigned long long>(fa.nFileSizeHigh) << 32) | fa.nFileSizeLow;
+   Time = (static_cast<unsigned long long>(fa.ftLastWriteTime.dwHighDateTime) << 32) |
+      fa.ftLastWriteTime.dwLowDateTime;
+   return true;
+#else
+   struct stat st;
+   if (stat(Path.c_str(), &st) != 0)
+      return false;
+   Size = static_cast<unsigned long long>(st.st_size);
+#ifdef __APPLE__
+   Time = st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+   Time = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+   return true;
+#endif
+}
+
+//----------------------------------------------------------
+// Reads a number from 'Field' in the given base (10 or 16).
+// Returns true if the whole field is a number.
+//----------------------------------------------------------
+static bool ParseNumber(const std::string &Field, unsigned Base, unsigned long long &Value)
+{
+   Value = 0;
+   for (size_t i = 0; i < Field.size(); i++)
+   {
+      unsigned Digit;
+      _TCHAR c = Field[i];
+      if (c >= '0' && c <= '9')
+         Digit = c - '0';
+      else if (Base == 16 && c >= 'a' && c <= 'f')
+         Digit = c - 'a' + 10;
+      else
+         return false;
+      Value = Value * Base + Digit;
+   }
+   return !Field.empty();
+}
+
+//----------------------------------------------------------
+// Reads the cache file, if there is one.  Each line after
+// the first holds one entry, its fields separated by tabs:
+// the input file, its size, time and hash, the settings,
+// and the output file, its size and time.  Lines that can't
+// be read are left out, which only means those files are
+// converted again.
+//----------------------------------------------------------
+static void LoadCache(TxCache &Cache)
+{
+   FILE *fp;
+   if (_tfopen_s(&fp, Cache.Name.c_str(), "r"))
+      return;
+
+   _TCHAR Line[8192];
+   if (_fgetts(Line, _countof(Line), fp) != NULL && _tcscmp(Line, _T("txu cache 1\n")) == 0)
+   {
+      while (_fgetts(Line, _countof(Line), fp) != NULL)
+      {
+         std::vector<std::string> Fields;
+         std::string s = Line;
+         if (s.empty() || s[s.size() - 1] != '\n')
+            continue;
+         s.erase(s.size() - 1);
+         for (size_t Pos = 0;;)
+         {
+            size_t Tab = s.find('\t', Pos);
+            Fields.push_back(s.substr(Pos, Tab == std::string::npos ? std::string::npos : Tab - Pos));
+            if (Tab == std::string::npos)
+               break;
+            Pos = Tab + 1;
+         }
+
+         TxCacheEntry Entry;
+         if (Fields.size() == 8 && !Fields[0].empty() &&
+            ParseNumber(Fields[1], 10, Entry.InSize) && ParseNumber(Fields[2], 10, Entry.InTime) &&
+            ParseNumber(Fields[3], 16, Entry.Hash) && ParseNumber(Fields[6], 10, Entry.OutSize) &&
+            ParseNumber(Fields[7], 10, Entry.OutTime))
+         {
+            Entry.bHashed = true;
+            Entry.Settings = Fields[4];
+            Entry.OutFile = Fields[5];
+            Cache.Entries[Fields[0]] = Entry;
+         }
+      }
+   }
+   fclose(fp);
+}
+
+//----------------------------------------------------------
+// Writes the cache file, by way of a temporary file which
+// then takes its place, so that an interrupted run leaves
+// the old one behind instead of half of a new one.
+// Returns true if successful, false if write fails.
+//----------------------------------------------------------
+static bool SaveCache(TxCache &Cache)
+{
+   std::string TempName = Cache.Name + _T(".tmp");
+   FILE *fp;
+   if (_tfopen_s(&fp, TempName.c_str(), "w"))
+      return false;
+   _ftprintf(fp, _T("txu cache 1\n"));
+   for (std::map<std::string, TxCacheEntry>::const_iterator i = Cache.Entries.begin(); i != Cache.Entries.end(); ++i)
+   {
+      const TxCacheEntry &e = i->second;
+      _ftprintf(fp, _T("%s\t%llu\t%llu\t%016llx\t%s\t%s\t%llu\t%llu\n"), i->first.c_str(), e.InSize, e.InTime,
+         e.Hash, e.Settings.c_str(), e.OutFile.c_str(), e.OutSize, e.OutTime);
+   }
+   if (fclose(fp) != 0)
+   {
+      _tremove(TempName.c_str());
+      return false;
+   }
+#ifdef _WIN32
+   return MoveFileEx(TempName.c_str(), Cache.Name.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+   return rename(TempName.c_str(), Cache.Name.c_str()) == 0;
+#endif
+}
+
+//----------------------------------------------------------
+// Checks whether the output of a batch item is up to date:
+// the cache has an entry for the input with the same
+// settings, size, time and contents, and the output file is
+// still as it was written.  'Entry' receives what is known
+// of the input now, for RememberFile afterwards.
+// Returns true if the file can be skipped.
+//----------------------------------------------------------
+static bool IsUpToDate(
+   TxCache & Cache,
+   const std::string & InFile,
+   const std::string & OutFile,
+   const std::string & Settings,
+   TxCacheEntry & Entry
+   )
+{
+   Entry.InSize = Entry.InTime = 0;
+   Entry.bHashed = false;
+   Entry.Settings = Settings;
+   Entry.OutFile = OutFile;
+   if (!GetFileInfo(InFile, Entry.InSize, Entry.InTime))
+      return false;
+
+   TxCacheEntry Known;
+   {
+      std::lock_guard<std::mutex> Lock(Cache.Lock);
+      std::map<std::string, TxCacheEntry>::const_iterator i = Cache.Entries.find(InFile);
+      if (i == Cache.Entries.end())
+         return false;
+      Known = i->second;
+   }
+   unsigned long long OutSize, OutTime;
+   if (Known.Settings != Settings || Known.OutFile != OutFile || Known.InSize != Entry.InSize ||
+      Known.InTime != Entry.InTime || !GetFileInfo(OutFile, OutSize, OutTime) ||
+      OutSize != Known.OutSize || OutTime != Known.OutTime)
+      return false;
+
+   Entry.bHashed = HashFile(InFile, Entry.Hash);
+   return Entry.bHashed && Entry.Hash == Known.Hash;
+}
+
+//----------------------------------------------------------
+// Records in the cache a batch item that has just been
+// converted, or forgets it if it failed.
+//----------------------------------------------------------
+static void RememberFile(TxCache &Cache, const std::string &InFile, TxCacheEntry &Entry, bool bConverted)
+{
+   if (bConverted && !Entry.bHashed)
+      Entry.bHashed = HashFile(InFile, Entry.Hash);
+   bool bKnown = bConverted && Entry.bHashed && GetFileInfo(Entry.OutFile, Entry.OutSize, Entry.OutTime);
+
+   std::lock_guard<std::mutex> Lock(Cache.Lock);
+   if (bKnown)
+      Cache.Entries[InFile] = Entry;
+   else
+      Cache.Entries.erase(InFile);
+}
+
+//----------------------------------------------------------
+// Takes the next file for a batch worker: from the front of
+// its own queue, or failing that from the back of another
+// worker's queue.
+// Returns true if a file was taken, false if all the queues
+// are empty.
+//----------------------------------------------------------
+static bool TakeWork(std::vector<TxWorkQueue> &Queues, size_t Self, size_t &Item)
+{
+   {
+      std::lock_guard<std::mutex> Lock(Queues[Self].Lock);
+      if (!Queues[Self].Items.empty())
+      {
+         Item = Queues[Self].Items.front();
+         Queues[Self].Items.pop_front();
+         return true;
+      }
+   }
+
+   for (size_t i = 1; i < Queues.size(); i++)
+   {
+      TxWorkQueue &Victim = Queues[(Self + i) % Queues.size()];
+      std::lock_guard<std::mutex> Lock(Victim.Lock);
+      if (!Victim.Items.empty())
+      {
+         Item = Victim.Items.back();
+         Victim.Items.pop_back();
+         return true;
+      }
+   }
+   return false;
+}
+
+//----------------------------------------------------------
+// Body of one batch worker thread.  The files are converted
+// in the worker's own workspace, and counts are kept in the
+// worker's own 'Stats' and only added up at the end.
+//----------------------------------------------------------
+static void BatchWorker(const TxBatch &Batch, std::vector<TxWorkQueue> &Queues, size_t Self, TxStats &Stats)
+{
+   TxWorkspace Ws;
+   std::string OutDir, OutFile;
+   size_t i;
+   while (TakeWork(Queues, Self, i))
+   {
+      const TxBatchItem &Item = Batch.Items[i];
+      OutputName(Batch, Item, OutDir, OutFile);
+      if (OutFile == Item.InFile)
+      {
+         msg("Output file would replace input file", Item.InFile.c_str());
+         Stats.nFailed++;
+         continue;
+      }
+      if (!Item.SubDir.empty() && !MakeDirectories(OutDir))
+      {
+         msg("Failed creating output directory", OutDir.c_str());
+         Stats.nFailed++;
+         continue;
+      }
+
+      // With /CACHE, a file whose output is up to date is skipped.
+      TxCacheEntry Entry;
+      if (Batch.pCache != NULL && IsUpToDate(*Batch.pCache, Item.InFile, OutFile, Batch.Settings, Entry))
+      {
+         Stats.nSkipped++;
+         continue;
+      }
+      bool bConverted = ConvertFile(Item.InFile, OutFile, Batch.InFmt, Batch.OutFmt, Ws, Stats);
+      if (!bConverted)
+         Stats.nFailed++;
+      if (Batch.pCache != NULL)
+         RememberFile(*Batch.pCache, Item.InFile, Entry, bConverted);
+   }
+}
+
+//----------------------------------------------------------
+// Converts all the files of a batch on a pool of nJobs
+// worker threads, then reports the totals to stderr, or with
+// /STATS=JSON writes them as a last record, with the totals
+// of each worker.
+// Returns true if every file was converted.
+//----------------------------------------------------------
+static bool RunBatch(const TxBatch &Batch)
+{
+   std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+   size_t Workers = __max(__min(nJobs, Batch.Items.size()), 1);
+   std::vector<TxWorkQueue> Queues(Workers);
+   for (size_t i = 0; i < Batch.Items.size(); i++)
+      Queues[i % Workers].Items.push_back(i);
+
+   std::vector<TxStats> Stats(Workers);
+   for (size_t k = 0; k < Workers; k++)
+      InitStats(Stats[k]);
+
+   std::vector<std::thread> Threads;
+   for (size_t k = 1; k < Workers; k++)
+      Threads.push_back(std::thread(BatchWorker, std::cref(Batch), std::ref(Queues), k, std::ref(Stats[k])));
+   BatchWorker(Batch, Queues, 0, Stats[0]);
+   for (size_t k = 0; k < Threads.size(); k++)
+      Threads[k].join();
+
+   TxStats Total;
+   InitStats(Total);
+   for (size_t k = 0; k < Workers; k++)
+      AddStats(Total, Stats[k]);
+   if (Batch.pCache != NULL && !SaveCache(*Batch.pCache))
+      msg("Failed writing cache file", Batch.pCache->Name.c_str());
+
+   double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+   if (fpStats != NULL)
+   {
+      // Elapsed time is the wall clock time for the total, and
+      // the sum of the files' times for each worker.
+      Total.Elapsed = Seconds;
+      fprintf(fpStats, "{\"total\":true,\"files\":%zu,\"failed\":%zu,\"skipped\":%zu,\"workers\":%zu,",
+         Total.nFiles, Total.nFailed, Total.nSkipped, Workers);
+      WriteJsonStats(Total);
+      fprintf(fpStats, ",\"worker_stats\":[");
+      for (size_t k = 0; k < Workers; k++)
+      {
+         fprintf(fpStats, "%s{\"files\":%zu,\"failed\":%zu,\"skipped\":%zu,", k > 0 ? "," : "",
+            Stats[k].nFiles, Stats[k].nFailed, Stats[k].nSkipped);
+         WriteJsonStats(Stats[k]);
+         fprintf(fpStats, "}");
+      }
+      fprintf(fpStats, "]}\n");
+      fflush(fpStats);
+      return Total.nFailed == 0;
+   }
+
+   double MB = static_cast<double>(Total.BytesIn) / (1024.0 * 1024.0);
+   _ftprintf(stderr, _T("Files converted:  %zu\n"), Total.nFiles);
+   _ftprintf(stderr, _T("Files failed:     %zu\n"), Total.nFailed);
+   if (Batch.pCache != NULL)
+      _ftprintf(stderr, _T("Files skipped:    %zu\n"), Total.nSkipped);
+   _ftprintf(stderr, _T("Bytes read:       %llu\n"), Total.BytesIn);
+   _ftprintf(stderr, _T("Bytes written:    %llu\n"), Total.BytesOut);
+   if (Total.nUncounted > 0)
+      _ftprintf(stderr, _T("Lines processed:  %llu, not counting %zu file(s) copied whole\n"),
+         Total.nLines, Total.nUncounted);
+   else
+      _ftprintf(stderr, _T("Lines processed:  %llu\n"), Total.nLines);
+   _ftprintf(stderr, _T("Chars processed:  %llu\n"), Total.nChars);
+   _ftprintf(stderr, _T("Elapsed time:     %.3f s (%.1f MB/s, %u workers)\n"),
+      Seconds, Seconds > 0 ? MB / Seconds : 0.0, static_cast<unsigned>(Workers));
+
+   return Total.nFailed == 0;
+}
+
+//----------------------------------------------------------
+// Benchmarks.  /BENCH times the conversion loops on text
+// held in memory, so the figures are for the conversion
+// alone and not for the disk.  The output goes to the null
+// device.  Each run is repeated nBench times and the best
+// time is reported.
+//----------------------------------------------------------
+
+// Kinds of synthetic text for the benchmarks.
+enum TxCorpus
+{
+   CORPUS_ASCII,           // Plain English text.
+   CORPUS_LATIN1,          // Western European text, many accented letters.
+   CORPUS_CJK,             // Chinese/Japanese text.
+   CORPUS_EMOJI,           // Emoji, outside the Basic Multilingual Plane.
+   CORPUS_LONGLINES,       // Plain text with very long lines.
+   CORPUS_SHORTLINES,      // Plain text with very short lines.
+   CORPUS_COUNT
+};
+
+//----------------------------------------------------------
+// Retrieve human-readable name of TxCorpus value.
+//----------------------------------------------------------
+static const _TCHAR * TxCorpusToName(TxCorpus Corpus)
+{
+   switch(Corpus)
+   {
+      case CORPUS_ASCII:      return _T("ascii");
+      case CORPUS_LATIN1:     return _T("latin1");
+      case CORPUS_CJK:        return _T("cjk");
+      case CORPUS_EMOJI:      return _T("emoji");
+      case CORPUS_LONGLINES:  return _T("longlines");
+      case CORPUS_SHORTLINES: return _T("shortlines");
+      default:                return _T("unknown");
+   }
+}
+
+//----------------------------------------------------------
+// Fills 'Chars' with 'nChars' characters of synthetic text
+// of the given kind.  The text is the same on every run.
+//----------------------------------------------------------
+static void MakeCorpus(TxCorpus Corpus, size_t nChars, std::vector<unsigned> &Chars)
+{
+   Chars.resize(nChars);
+   unsigned Seed = 12345;
+   size_t LineLen = 0;
+   for (size_t i = 0; i < nChars; i++)
+   {
+      Seed = Seed * 1103515245 + 12345;
+      unsigned r = Seed >> 8;
+
+      // Decide where the lines end.
+      size_t MaxLine = 72;
+      if (Corpus == CORPUS_LONGLINES)
+         MaxLine = 1024 * 1024;
+      else if (Corpus == CORPUS_SHORTLINES)
+         MaxLine = 1 + r % 8;
+      if (LineLen >= MaxLine)
+      {
+         Chars[i] = '\n';
+         LineLen = 0;
+         continue;
+      }
+      LineLen++;
+
+      unsigned Char;
+      if (r % 6 == 0)
+         Char = ' ';
+      else if (Corpus == CORPUS_LATIN1 && r % 3 == 0)
+         Char = 0xC0 + (r >> 4) % 0x40;
+      else if (Corpus == CORPUS_CJK && r % 8 != 1)
+         Char = 0x4E00 + (r >> 4) % 0x5200;
+      else if (Corpus == CORPUS_EMOJI && r % 4 != 1)
+         Char = 0x1F300 + (r >> 4) % 0x350;
+      else
+         Char = 'a' + (r >> 4) % 26;
+      Chars[i] = Char;
+   }
+}
+
+//----------------------------------------------------------
+// Encodes a run of characters in the given encoding.
+//----------------------------------------------------------
+static void EncodeAll(TxEncoding Fmt, const std::vector<unsigned> &Chars, std::vector<unsigned char> &Bytes)
+{
+   Bytes.resize(Chars.size() * 4 + 1);
+   Bytes.resize(Chars.empty() ? 0 : TxEncodeChars(Fmt, &Chars[0], Chars.size(), &Bytes[0]));
+}
+
+//----------------------------------------------------------
+// Retrieves the most memory the process has used so far,
+// in bytes, or 0 if not known.
+//----------------------------------------------------------
+static size_t PeakMemory(void)
+{
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS pmc;
+   if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+      return pmc.PeakWorkingSetSize;
+   return 0;
+#else
+   struct rusage ru;
+   if (getrusage(RUSAGE_SELF, &ru) != 0)
+      return 0;
+#ifdef __APPLE__
+   return static_cast<size_t>(ru.ru_maxrss);
+#else
+   return static_cast<size_t>(ru.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//----------------------------------------------------------
+// Times the conversion of a block of text in memory from
+// one encoding to another, and prints a line of results.
+// Returns true if successful, false if the conversion fails.
+//----------------------------------------------------------
+static bool BenchPair(
+   const _TCHAR *szName,               // Name of the text, for the report.
+   const std::vector<unsigned char> &Bytes,  // Text in encoding InFmt.
+   TxEncoding InFmt,
+   TxEncoding OutFmt,
+   FILE *fpNull                        // The null device.
+   )
+{
+   TxConvertFn Convert = GetConverter(InFmt, OutFmt);
+   TxWorkspace Ws;
+   TxReader &In = Ws.In;
+   TxWriter &Out = Ws.Out;
+   TxConverter &Cv = Ws.Cv;
+   double Best = 0;
+   size_t nChars = 0;
+   for (size_t k = 0; k < nBench; k++)
+   {
+      InitMappedReader(In, Bytes.empty() ? NULL : &Bytes[0], Bytes.size(), 0, InFmt);
+      InitWriter(Out, fpNull, OutFmt);
+      TxInitConverter(Cv, InFmt, OutFmt);
+
+      std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+      bool bConverted = Convert(Ws);
+      if (!WaitWriter(Out) || !bConverted)
+         return false;
+      double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+      if (k == 0 || Seconds < Best)
+         Best = Seconds;
+      nChars = Cv.nChars;
+   }
+
+   double MB = static_cast<double>(Bytes.size()) / (1024.0 * 1024.0);
+   _tprintf(_T("%-12s %9.2f MB  %-7s -> %-7s  %9.1f MB/s  %9.1f Mchars/s\n"),
+      szName, MB, TxEncodingToName(InFmt), TxEncodingToName(OutFmt),
+      Best > 0 ? MB / Best : 0.0, Best > 0 ? nChars / Best / 1e6 : 0.0);
+   return true;
+}
+
+//----------------------------------------------------------
+// Opens the null device, for output that is thrown away.
+//----------------------------------------------------------
+static FILE * OpenNull(void)
+{
+   FILE *fp = NULL;
+#ifdef _WIN32
+   if (_tfopen_s(&fp, _T("NUL"), "wb"))
+#else
+   if (_tfopen_s(&fp, _T("/dev/null"), "wb"))
+#endif
+   {
+      msg("Failed opening the null device");
+      return NULL;
+   }
+   return fp;
+}
+
+// Real encodings, for running every pair.
+static const TxEncoding BenchFormats[] = { FMT_ANSI, FMT_UTF8, FMT_UTF16, FMT_UTF16BE, FMT_UTF32, FMT_UTF32BE };
+
+//----------------------------------------------------------
+// Runs the benchmark suite:  every pair of encodings on each
+// kind of synthetic text, at several sizes.
+// Returns true if successful, false if a conversion fails.
+//----------------------------------------------------------
+static bool RunBenchSuite(void)
+{
+   static const size_t Sizes[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+
+   FILE *fpNull = OpenNull();
+   if (fpNull == NULL)
+      return false;
+
+   _tprintf(_T("SIMD kernels:  %s\n"), KernelsName());
+   _tprintf(_T("Threads:       %zu\n"), nThreads);
+   _tprintf(_T("Repeats:       %zu\n\n"), nBench);
+
+   bool bOk = true;
+   std::vector<unsigned> Chars;
+   std::vector<unsigned char> Bytes;
+   for (int c = 0; c < CORPUS_COUNT && bOk; c++)
+   {
+      for (size_t s = 0; s < _countof(Sizes) && bOk; s++)
+      {
+         MakeCorpus(static_cast<TxCorpus>(c), Sizes[s], Chars);
+         for (size_t i = 0; i < _countof(BenchFormats) && bOk; i++)
+         {
+            EncodeAll(BenchFormats[i], Chars, Bytes);
+            for (size_t o = 0; o < _countof(BenchFormats) && bOk; o++)
+               bOk = BenchPair(TxCorpusToName(static_cast<TxCorpus>(c)), Bytes, BenchFormats[i], BenchFormats[o], fpNull);
+         }
+      }
+   }
+   fclose(fpNull);
+
+   _tprintf(_T("\nPeak memory:   %.1f MB\n"), PeakMemory() / (1024.0 * 1024.0));
+   return bOk;
+}
+
+//----------------------------------------------------------
+// Runs the benchmark on a file given by the user:  the file
+// is loaded into memory and converted to every encoding.
+// InFmt may be FMT_AUTO, in which case the encoding is
+// found from the start of the file.
+// Returns true if successful, false if an error occurs
+// (which has been reported).
+//----------------------------------------------------------
+static bool RunBenchFile(const std::string &InFile, TxEncoding InFmt)
+{
+   FILE *fp = NULL;
+   if (_tfopen_s(&fp, InFile.c_str(), "rb"))
+   {
+      msg("Failed opening input file", InFile.c_str());
+      return false;
+   }
+   std::vector<unsigned char> Bytes;
+   unsigned char Block[64 * 1024];
+   size_t n;
+   while ((n = fread(Block, 1, sizeof(Block), fp)) > 0)
+      Bytes.insert(Bytes.end(), Block, Block + n);
+   fclose(fp);
+
+   size_t BOMLen = 0;
+   TxEncoding BOMFmt = CheckBOM(Bytes.empty() ? Block : &Bytes[0], Bytes.size(), BOMLen);
+   if (InFmt == FMT_AUTO && BOMFmt == FMT_UNKNOWN && !Bytes.empty())
+   {
+      std::vector<unsigned char> Sample;
+      std::vector<size_t> Starts;
+      int Confidence;
+      ReadSamples(&Bytes[0], Bytes.size(), NULL, Bytes.size(), Sample, Starts);
+      BOMFmt = DetectEncoding(Sample, Starts, Confidence);
+   }
+   if (InFmt == FMT_AUTO)
+   {
+      if (BOMFmt == FMT_UNKNOWN)
+      {
+         msg("AUTO mode can't identify input format.  Please specify with /INFORMAT option.", InFile.c_str());
+         return false;
+      }
+      InFmt = BOMFmt;
+   }
+   Bytes.erase(Bytes.begin(), Bytes.begin() + BOMLen);
+
+   FILE *fpNull = OpenNull();
+   if (fpNull == NULL)
+      return false;
+
+   _tprintf(_T("Input file:    \"%s\"\n"), InFile.c_str());
+   _tprintf(_T("SIMD kernels:  %s\n"), KernelsName());
+   _tprintf(_T("Threads:       %zu\n"), nThreads);
+   _tprintf(_T("Repeats:       %zu\n\n"), nBench);
+
+   bool bOk = true;
+   for (size_t o = 0; o < _countof(BenchFormats) && bOk; o++)
+      bOk = BenchPair(_T("file"), Bytes, InFmt, BenchFormats[o], fpNull);
+   fclose(fpNull);
+
+   _tprintf(_T("\nPeak memory:   %.1f MB\n"), PeakMemory() / (1024.0 * 1024.0));
+   return bOk;
+}
+
+//----------------------------------------------------------
+// main:
+// Application entry point.
+// Uses standard arguments and return values.
+//----------------------------------------------------------
+#ifdef _UNICODE
+int wmain(int argc, wchar_t **argv)
+#else
+int main(int argc, char **argv)
+#endif
+{
+   // See if user needs command line help.
+   if (argc < 2)
+   {
+      Usage();
+      return EXIT_FAILURE;
+   }
+
+   // Program settings.
+   std::string InFile;
+   std::string OutFile;
+   TxEncoding  InFmt  = FMT_AUTO;
    TxEncoding  OutFmt = FMT_ANSI;
+   std::string ListFile;
+   std::string OutDir;
+   std::string NameRule;
+   std::string CacheFile;
+   bool        bRecurse = false;
+   SelectKernels(_T("AUTO"));
 
    // Parse command line options.
    int nonopts = 0;
    for (int n = 1; n < argc; n++)
    {
       // If this argument is an option switch...
-      if (argv[n][0] == '/' || argv[n][0] == '-')
+      if (IsOption(argv[n]))
       {
          if (OptionNameIs(argv[n], "INFORMAT") || OptionNameIs(argv[n], "I"))
          {
@@ -642,6 +3625,186 @@ int main(int argc, char **argv)
                return EXIT_FAILURE;
             }
          }
+         else if (OptionNameIs(argv[n], "MAPLIMIT"))
+         {
+            // Specify the largest input file to be mapped into memory.
+            if (!OptionNumber(argv[n], nMapLimit))
+            {
+               msg("Invalid number in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "BUFSIZE"))
+         {
+            // Specify the size of the blocks read and written.
+            if (!OptionNumber(argv[n], nBufSize) || nBufSize == 0)
+            {
+               msg("Invalid number in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+            nBufSize = __min(__max(nBufSize, MIN_BUFSIZE), MAX_BUFSIZE);
+         }
+         else if (OptionNameIs(argv[n], "THREADS"))
+         {
+            // Specify the number of conversion threads.
+            if (!OptionNumber(argv[n], nThreads))
+            {
+               msg("Invalid number in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+            if (nThreads == 0)
+               nThreads = __max(std::thread::hardware_concurrency(), 1u);
+         }
+         else if (OptionNameIs(argv[n], "JOBS"))
+         {
+            // Specify the number of files converted at once.
+            if (!OptionNumber(argv[n], nJobs))
+            {
+               msg("Invalid number in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "LIST"))
+         {
+            // Specify a file listing the input files.
+            ListFile = OptionValue(argv[n]);
+         }
+         else if (OptionNameIs(argv[n], "CACHE"))
+         {
+            // Specify the cache of files converted by earlier batch runs.
+            CacheFile = OptionValue(argv[n]);
+         }
+         else if (OptionNameIs(argv[n], "OUTDIR"))
+         {
+            // Specify the output directory for batch mode.
+            OutDir = OptionValue(argv[n]);
+         }
+         else if (OptionNameIs(argv[n], "NAME"))
+         {
+            // Specify the naming rule for batch mode output files.
+            NameRule = OptionValue(argv[n]);
+            if (NameRule.find('*') == std::string::npos)
+            {
+               msg("Naming rule must contain '*'", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "RECURSE") || OptionNameIs(argv[n], "R"))
+         {
+            bRecurse = true;
+         }
+         else if (OptionNameIs(argv[n], "BENCH"))
+         {
+            // Run benchmarks instead of converting.
+            nBench = 3;
+            if (OptionValue(argv[n])[0] != '\0' && (!OptionNumber(argv[n], nBench) || nBench == 0))
+            {
+               msg("Invalid number in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "CODEPAGE") || OptionNameIs(argv[n], "CP"))
+         {
+            // Specify the code page of ANSI text.
+            size_t Number;
+            if (!OptionNumber(argv[n], Number) || Number > 0xFFFF ||
+                !SelectCodePage(static_cast<unsigned>(Number)))
+            {
+               msg("Unsupported code page in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "EOL"))
+         {
+            // Specify the line endings to be written.
+            const _TCHAR *szEol = OptionValue(argv[n]);
+            if (_tcsicmp(szEol, _T("KEEP")) == 0)
+               Eol = EOL_KEEP;
+            else if (_tcsicmp(szEol, _T("LF")) == 0)
+               Eol = EOL_LF;
+            else if (_tcsicmp(szEol, _T("CRLF")) == 0)
+               Eol = EOL_CRLF;
+            else if (_tcsicmp(szEol, _T("CR")) == 0)
+               Eol = EOL_CR;
+            else
+            {
+               msg("Unrecognized line ending in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "ONERROR"))
+         {
+            // Specify what to do about invalid input.
+            const _TCHAR *szAction = OptionValue(argv[n]);
+            if (_tcsicmp(szAction, _T("STOP")) == 0)
+               OnError = ONERROR_STOP;
+            else if (_tcsicmp(szAction, _T("REPLACE")) == 0)
+               OnError = ONERROR_REPLACE;
+            else if (_tcsicmp(szAction, _T("SKIP")) == 0)
+               OnError = ONERROR_SKIP;
+            else
+            {
+               msg("Unrecognized action in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "SIMD"))
+         {
+            // Specify the SIMD kernels for the ASCII fast path.
+            if (!SelectKernels(OptionValue(argv[n])))
+            {
+               msg("SIMD kernels unknown or not supported by this CPU", argv[n]);
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "STATS"))
+         {
+            // Specify the format of the stats.  JSON is the only one.
+            if (_tcsicmp(OptionValue(argv[n]), _T("JSON")) != 0)
+            {
+               msg("Unrecognized stats format in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+            if (fpStats == NULL)
+               fpStats = stderr;
+         }
+         else if (OptionNameIs(argv[n], "STATSFILE"))
+         {
+            // Specify the file the stats are written to.
+            if (fpStats != NULL && fpStats != stderr)
+               fclose(fpStats);
+            if (_tfopen_s(&fpStats, OptionValue(argv[n]), "w"))
+            {
+               msg("Failed opening stats file", OptionValue(argv[n]));
+               return EXIT_FAILURE;
+            }
+         }
+         else if (OptionNameIs(argv[n], "RESUME"))
+         {
+            bResume = true;
+         }
+         else if (OptionNameIs(argv[n], "MEASURE"))
+         {
+            bMeasure = true;
+         }
+         else if (OptionNameIs(argv[n], "COUNT"))
+         {
+            bCount = true;
+         }
+         else if (OptionNameIs(argv[n], "COMPRESS"))
+         {
+            // Specify how the output is compressed.
+            if (!TxCompressionFromName(OptionValue(argv[n]), Compress))
+            {
+               msg("Unrecognized compression in option", argv[n]);
+               return EXIT_FAILURE;
+            }
+            if (!HasCompression(Compress))
+            {
+               msg("This txu was built without", TxCompressionToName(Compress));
+               return EXIT_FAILURE;
+            }
+         }
          else if (OptionNameIs(argv[n], "VERBOSE") || OptionNameIs(argv[n], "V"))
          {
             bVerbose = true;
@@ -668,111 +3831,136 @@ int main(int argc, char **argv)
       }
    }
 
-   // Make sure required argument(s) were given.
-   if (InFile.size() < 1)
+   if (nBench > 0)
    {
-      msg("No input file specified");
-      return EXIT_FAILURE;
+      // The benchmarks time whole conversions, so characters an
+      // encoding can't hold are replaced rather than stopping.
+      if (OnError == ONERROR_STOP)
+         OnError = ONERROR_REPLACE;
+      bool bOk = InFile.empty() ? RunBenchSuite() : RunBenchFile(InFile, InFmt);
+      return bOk ? EXIT_SUCCESS : EXIT_FAILURE;
    }
 
-   // Open the input file.
-   FILE *fpIn = NULL;
-   if (_tfopen_s(&fpIn, InFile.c_str(), "rb"))
+   // Checkpoints are offsets in the output file, which can't
+   // be carried on from in the middle of compressed data.
+   if (bResume && Compress != COMPRESS_NONE)
    {
-      msg("Failed opening input file", InFile.c_str());
+      msg("/RESUME can't be used with /COMPRESS");
       return EXIT_FAILURE;
    }
 
-   // If input mode was not specified, attempt to determine format
-   // from input data.
-   TxEncoding BOMFmt = CheckBOM(fpIn);
-   if (InFmt == FMT_AUTO)
+   // A list file, a wildcard, a directory or /RECURSE as the
+   // input means batch mode.
+   bool bBatch = !ListFile.empty() || bRecurse || !OutDir.empty() ||
+      HasWildcards(InFile) || (!InFile.empty() && IsDirectory(InFile));
+   if (bBatch)
    {
-      if (BOMFmt == FMT_UNKNOWN)
+      if (bMeasure || bCount)
       {
-         msg("AUTO mode can't identify input format.  Please specify with /INFORMAT option.");
-         fclose(fpIn);
+         msg(bMeasure ? "/MEASURE is not for batch mode" : "/COUNT is not for batch mode");
          return EXIT_FAILURE;
       }
-      InFmt = BOMFmt;
-   }
 
-   if (bVerbose)
-   {
-      // Determine file size.
-      size_t OldPos = fseek(fpIn, 0, SEEK_CUR);
-      size_t InLength = fseek(fpIn, 0, SEEK_END);
-      fseek(fpIn, static_cast<long>(OldPos), SEEK_SET);
-   
-      // Read first few bytes of file.
-      unsigned char ch[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-      fseek(fpIn, 0, SEEK_SET);
-      size_t bytes = fread(&ch, 1, 8, fpIn);
-      fseek(fpIn, static_cast<long>(OldPos), SEEK_SET);
-      if (bytes < 1)
-      {
-         msg("Empty input file");
-         fclose(fpIn);
-         return EXIT_FAILURE;
-      }
+      TxBatch Batch;
+      Batch.OutDir = OutDir;
+      Batch.NameRule = NameRule;
+      Batch.InFmt = InFmt;
+      Batch.OutFmt = OutFmt;
+      Batch.pCache = NULL;
 
-      _tprintf(_T("Input file:    \"%s\"\n"), InFile.c_str());
-      _tprintf(_T("Input length:  %Iu bytes\n"), InLength);
-      _tprintf(_T("Input format:  %s\n"), TxEncodingToName(InFmt));
-      _tprintf(_T("Output file:   \"%s\"\n"), OutFile.size() > 0 ? OutFile.c_str() : _T("(stdout)"));
-      _tprintf(_T("Output format: %s\n"), TxEncodingToName(OutFmt));
-      _tprintf(_T("First %Iu bytes: "), bytes);
-      for (size_t i = 0; i < bytes; i++)
-         _tprintf(_T(" %02X"), ch[i]);
-      _tprintf(_T("\n"));
-   }
+      // The cache keeps what each output depends on besides the
+      // input file.
+      TxCache Cache;
+      if (!CacheFile.empty())
+      {
+         Cache.Name = CacheFile;
+         LoadCache(Cache);
+         Batch.pCache = &Cache;
+         Batch.Settings = std::string(TxEncodingToName(InFmt)) + _T(">") + TxEncodingToName(OutFmt) +
+            _T(" cp=") + std::to_string(CodePageNumber()) + _T(" eol=") + std::to_string(Eol) +
+            _T(" onerror=") + std::to_string(OnError) + _T(" compress=") + std::to_string(Compress);
+      }
 
-   // Open the output file, if any.
-   FILE *fpOut = stdout;
-   if (OutFile.size() > 0)
-   {
-      if (_tfopen_s(&fpOut, OutFile.c_str(), "wb"))
+      if (!OutFile.empty())
       {
-         msg("Failed opening output file", OutFile.c_str());
+         msg("Use /OUTDIR to give the output directory in batch mode", OutFile.c_str());
+         return EXIT_FAILURE;
+      }
+      if (OutDir.empty() && NameRule.empty())
+      {
+         msg("Batch mode needs /OUTDIR or /NAME for the output files");
+         return EXIT_FAILURE;
+      }
+      if (!ListFile.empty() && !ReadFileList(ListFile, Batch.Items))
+      {
+         msg("Failed reading list file", ListFile.c_str());
+         return EXIT_FAILURE;
+      }
+      if (!InFile.empty())
+      {
+         // Split the input into a directory and a wildcard.
+         std::string Dir = InFile;
+         std::string Mask = _T("*");
+         if (!IsDirectory(InFile))
+         {
+            size_t Sep = InFile.find_last_of(_T("\\/"));
+            Dir = Sep == std::string::npos ? std::string() : InFile.substr(0, Sep);
+            Mask = InFile.substr(Sep == std::string::npos ? 0 : Sep + 1);
+         }
+         FindFiles(Dir, Mask, std::string(), bRecurse, Batch.Items);
+      }
+      if (Batch.Items.empty())
+      {
+         msg("No input files found");
+         return EXIT_FAILURE;
+      }
+      if (!MakeDirectories(OutDir))
+      {
+         msg("Failed creating output directory", OutDir.c_str());
          return EXIT_FAILURE;
       }
-   }
 
-   // Write byte order marker at start of file.
-   if (!WriteBOM(fpOut, OutFmt))
+      if (nJobs == 0)
+         nJobs = __max(std::thread::hardware_concurrency(), 1u);
+      return RunBatch(Batch) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+   if (!CacheFile.empty())
    {
-      fclose(fpIn);
-      if (OutFile.size() > 0)
-         fclose(fpOut);
+      msg("/CACHE is only for batch mode", CacheFile.c_str());
       return EXIT_FAILURE;
    }
-
-   // Process the input file.
-   std::vector<unsigned> Line;
-   nLines = nChars = 0;
-   while (ReadLine(fpIn, InFmt, Line))
+   if (bMeasure && bCount)
    {
-      nLines++;
-      if (!WriteLine(fpOut, OutFmt, Line))
-      {
-         msg("Failed writing output file");
-         fclose(fpIn);
-         if (OutFile.size() > 0)
-            fclose(fpOut);
-         return EXIT_FAILURE;
-      }
+      msg("Use either /MEASURE or /COUNT");
+      return EXIT_FAILURE;
+   }
+   if ((bMeasure || bCount) && !OutFile.empty())
+   {
+      msg(bMeasure ? "/MEASURE writes no output file" : "/COUNT writes no output file", OutFile.c_str());
+      return EXIT_FAILURE;
    }
 
-   if (bVerbose)
+   // With no input file, or "-", the input is read from stdin.
+   // With no output file, or "-", the output goes to stdout,
+   // which is put in binary mode, so that line feeds in UTF-16
+   // are not changed, and unbuffered, so that each block from
+   // the writer goes straight to the pipe in one write.
+   if (OutFile == _T("-"))
+      OutFile.clear();
+   if (OutFile.empty())
    {
-      _ftprintf(stderr, "Lines Processed:  %Iu\n", nLines);
-      _ftprintf(stderr, "Chars Processed:  %Iu\n", nChars);
+      fflush(stdout);
+#ifdef _WIN32
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      setvbuf(stdout, NULL, _IONBF, 0);
    }
 
-   // Clean up.
-   fclose(fpIn);
-   if (OutFile.size() > 0)
-      fclose(fpOut);
+   TxWorkspace Ws;
+   TxStats Stats;
+   InitStats(Stats);
+   if (!ConvertFile(InFile, OutFile, InFmt, OutFmt, Ws, Stats))
+      return EXIT_FAILURE;
 
    return EXIT_SUCCESS;
 }
@@ -0,0 +1,3894 @@
+//---------------------------------------------------------------
+// txulib.cpp
+// libtxu:  converts text between the ANSI, UTF-8, UTF-16 and
+// UTF-32 character formats from one buffer in memory to
+// another.
+// See txulib.h for the interface.
+//
+// (C) Copyright 2011 Ammon R. Campbell.
+// You may use this program freely for non-commercial purposes
+// provided you do so entirely at your own risk.  Commercial
+// use is not permitted without the author's express consent.
+//---------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "txulib.h"
+
+// SIMD intrinsics for the ASCII fast path.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TXU_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define TXU_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit instructions for an extended instruction
+// set inside functions marked for it; MSVC needs no marking.
+#if defined(__GNUC__) && defined(TXU_X86)
+#define TXU_TARGET_SSE2  __attribute__((target("sse2")))
+#define TXU_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TXU_TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#define TXU_TARGET_SSE2
+#define TXU_TARGET_SSSE3
+#define TXU_TARGET_AVX2
+#endif
+
+// Settings shared by every conversion (see txulib.h).
+TxOnError OnError = ONERROR_STOP;
+TxEol Eol = EOL_KEEP;
+
+//----------------------------------------------------------
+// Retrieve human-readable name of TxEncoding value.
+//----------------------------------------------------------
+const _TCHAR * TxEncodingToName(TxEncoding t)
+{
+   if (t == FMT_AUTO)      return _T("AUTO");
+   if (t == FMT_ANSI)      return _T("ANSI");
+   if (t == FMT_UTF8)      return _T("UTF8");
+   if (t == FMT_UTF16)     return _T("UTF16");
+   if (t == FMT_UTF16BE)   return _T("UTF16BE");
+   if (t == FMT_UTF32)     return _T("UTF32");
+   if (t == FMT_UTF32BE)   return _T("UTF32BE");
+   return _T("UNKNOWN");
+}
+
+//----------------------------------------------------------
+// Retrieve TxEncoding for the given name.
+//----------------------------------------------------------
+TxEncoding TxEncodingFromName(const _TCHAR *t)
+{
+   if (_tcsicmp(t, _T("AUTO")) == 0)      return FMT_AUTO;
+   if (_tcsicmp(t, _T("ANSI")) == 0)      return FMT_ANSI;
+   if (_tcsicmp(t, _T("UTF8")) == 0)      return FMT_UTF8;
+   if (_tcsicmp(t, _T("UTF16")) == 0)     return FMT_UTF16;
+   if (_tcsicmp(t, _T("UTF16BE")) == 0)   return FMT_UTF16BE;
+   if (_tcsicmp(t, _T("UTF32")) == 0)     return FMT_UTF32;
+   if (_tcsicmp(t, _T("UTF32BE")) == 0)   return FMT_UTF32BE;
+   return FMT_UNKNOWN;
+}
+
+// Number of characters decoded and encoded at a time.  This
+// is kept small enough for the code points to stay in cache
+// between the two steps.
+const size_t CHUNK_SIZE = 16 * 1024;
+
+//----------------------------------------------------------
+// ASCII fast path.  Most text is plain 7-bit ASCII, which
+// is the same bytes in ANSI and UTF-8 and needs no real
+// decoding, so runs of it are widened to code points (and
+// narrowed back to bytes or UTF-16 units) a vector at a
+// time.  Each kernel converts characters for as long as
+// they are ASCII and returns how many it converted, leaving
+// the first non-ASCII character to the scalar code.
+//
+// The kernels are chosen at startup by SelectKernels(),
+// based on what the CPU supports, so a single executable
+// can use AVX2 where it is available and SSE2 elsewhere.
+//----------------------------------------------------------
+struct TxKernels
+{
+   const _TCHAR *Name;
+
+   // Widens ASCII bytes to code points.
+   size_t (*WidenAscii)(const unsigned char *pIn, size_t n, unsigned *pOut);
+
+   // Widens all 'n' bytes to code points (ANSI input).
+   void   (*WidenBytes)(const unsigned char *pIn, size_t n, unsigned *pOut);
+
+   // Narrows ASCII code points to bytes (ANSI or UTF-8 output).
+   size_t (*NarrowAscii)(const unsigned *pIn, size_t n, unsigned char *pOut);
+
+   // Narrows code points below U+10000 to UTF-16 / UTF-16BE units,
+   // up to the first surrogate.
+   size_t (*NarrowBmp16)(const unsigned *pIn, size_t n, unsigned char *pOut);
+   size_t (*NarrowBmp16BE)(const unsigned *pIn, size_t n, unsigned char *pOut);
+
+   // Widens UTF-16 / UTF-16BE units to code points, up to the
+   // first surrogate.  'n' is the number of units.
+   size_t (*WidenUnits16)(const unsigned char *pIn, size_t n, unsigned *pOut);
+   size_t (*WidenUnits16BE)(const unsigned char *pIn, size_t n, unsigned *pOut);
+
+   // Counts the UTF-16 / UTF-16BE units at the start of a run
+   // before the first surrogate (passthrough).  'n' is the
+   // number of units.
+   size_t (*CountBmp16)(const unsigned char *pIn, size_t n);
+   size_t (*CountBmp16BE)(const unsigned char *pIn, size_t n);
+
+   // Widens UTF-32 / UTF-32BE units to code points, and narrows
+   // code points back to them, up to the first that is not a
+   // character:  a surrogate, or above U+10FFFF.  'n' is the
+   // number of units.
+   size_t (*WidenUnits32)(const unsigned char *pIn, size_t n, unsigned *pOut);
+   size_t (*WidenUnits32BE)(const unsigned char *pIn, size_t n, unsigned *pOut);
+   size_t (*NarrowUnits32)(const unsigned *pIn, size_t n, unsigned char *pOut);
+   size_t (*NarrowUnits32BE)(const unsigned *pIn, size_t n, unsigned char *pOut);
+
+   // Swaps the bytes of 'n' / 2 16-bit units (UTF-16 <-> UTF-16BE).
+   // pIn and pOut may be the same buffer.
+   void   (*SwapBytes16)(const unsigned char *pIn, size_t n, unsigned char *pOut);
+
+   // Counts the ASCII bytes at the start of a run (encoding detection).
+   size_t (*CountAscii)(const unsigned char *pIn, size_t n);
+
+   // Counts the code points before the first one equal to 'a' or 'b' (/EOL).
+   size_t (*CountToChar)(const unsigned *pIn, size_t n, unsigned a, unsigned b);
+
+   // Counts the bytes that start a UTF-8 character, that is all
+   // but 10xxxxxx, and adds the line feeds to 'nLines' (/COUNT).
+   size_t (*CountUTF8)(const unsigned char *pIn, size_t n, size_t &nLines);
+
+   // Counts the UTF-16 / UTF-16BE units that start a character,
+   // that is all but low surrogates, and adds the line feeds to
+   // 'nLines' (/COUNT).  'n' is the number of units.
+   size_t (*CountUnits16)(const unsigned char *pIn, size_t n, size_t &nLines);
+   size_t (*CountUnits16BE)(const unsigned char *pIn, size_t n, size_t &nLines);
+};
+
+static size_t WidenAscii_Scalar(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   while (i < n && pIn[i] < 0x80)
+   {
+      pOut[i] = pIn[i];
+      i++;
+   }
+   return i;
+}
+
+static void WidenBytes_Scalar(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   for (size_t i = 0; i < n; i++)
+      pOut[i] = pIn[i];
+}
+
+static size_t NarrowAscii_Scalar(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   while (i < n && pIn[i] < 0x80)
+   {
+      pOut[i] = static_cast<unsigned char>(pIn[i]);
+      i++;
+   }
+   return i;
+}
+
+static size_t NarrowBmp16_Scalar(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   while (i < n && pIn[i] < 0x10000 && (pIn[i] & 0xF800) != 0xD800)
+   {
+      pOut[i * 2] = static_cast<unsigned char>(pIn[i]);
+      pOut[i * 2 + 1] = static_cast<unsigned char>(pIn[i] >> 8);
+      i++;
+   }
+   return i;
+}
+
+static size_t NarrowBmp16BE_Scalar(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   while (i < n && pIn[i] < 0x10000 && (pIn[i] & 0xF800) != 0xD800)
+   {
+      pOut[i * 2] = static_cast<unsigned char>(pIn[i] >> 8);
+      pOut[i * 2 + 1] = static_cast<unsigned char>(pIn[i]);
+      i++;
+   }
+   return i;
+}
+
+static size_t WidenUnits16_Scalar(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i < n; i++)
+   {
+      unsigned Unit = pIn[i * 2] + pIn[i * 2 + 1] * 256;
+      if ((Unit & 0xF800) == 0xD800)
+         break;
+      pOut[i] = Unit;
+   }
+   return i;
+}
+
+static size_t WidenUnits16BE_Scalar(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i < n; i++)
+   {
+      unsigned Unit = pIn[i * 2] * 256 + pIn[i * 2 + 1];
+      if ((Unit & 0xF800) == 0xD800)
+         break;
+      pOut[i] = Unit;
+   }
+   return i;
+}
+
+static size_t CountBmp16_Scalar(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   while (i < n && (pIn[i * 2 + 1] & 0xF8) != 0xD8)
+      i++;
+   return i;
+}
+
+static size_t CountBmp16BE_Scalar(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   while (i < n && (pIn[i * 2] & 0xF8) != 0xD8)
+      i++;
+   return i;
+}
+
+// Returns true if a UTF-32 unit is a character, that is no
+// higher than U+10FFFF and not a surrogate.
+static inline bool IsChar32(unsigned Unit)
+{
+   return Unit <= 0x10FFFF && (Unit & 0xFFFFF800) != 0xD800;
+}
+
+static size_t WidenUnits32_Scalar(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i < n; i++)
+   {
+      const unsigned char *p = pIn + i * 4;
+      unsigned Unit = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned>(p[3]) << 24);
+      if (!IsChar32(Unit))
+         break;
+      pOut[i] = Unit;
+   }
+   return i;
+}
+
+static size_t WidenUnits32BE_Scalar(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i < n; i++)
+   {
+      const unsigned char *p = pIn + i * 4;
+      unsigned Unit = (static_cast<unsigned>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+      if (!IsChar32(Unit))
+         break;
+      pOut[i] = Unit;
+   }
+   return i;
+}
+
+static size_t NarrowUnits32_Scalar(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i < n && IsChar32(pIn[i]); i++)
+   {
+      pOut[i * 4] = static_cast<unsigned char>(pIn[i]);
+      pOut[i * 4 + 1] = static_cast<unsigned char>(pIn[i] >> 8);
+      pOut[i * 4 + 2] = static_cast<unsigned char>(pIn[i] >> 16);
+      pOut[i * 4 + 3] = 0;
+   }
+   return i;
+}
+
+static size_t NarrowUnits32BE_Scalar(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i < n && IsChar32(pIn[i]); i++)
+   {
+      pOut[i * 4] = 0;
+      pOut[i * 4 + 1] = static_cast<unsigned char>(pIn[i] >> 16);
+      pOut[i * 4 + 2] = static_cast<unsigned char>(pIn[i] >> 8);
+      pOut[i * 4 + 3] = static_cast<unsigned char>(pIn[i]);
+   }
+   return i;
+}
+
+static void SwapBytes16_Scalar(const unsigned char *pIn, size_t n, unsigned char *pOut)
+{
+   for (size_t i = 0; i + 2 <= n; i += 2)
+   {
+      unsigned char c = pIn[i];
+      pOut[i] = pIn[i + 1];
+      pOut[i + 1] = c;
+   }
+}
+
+static size_t CountAscii_Scalar(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   while (i < n && pIn[i] < 0x80)
+      i++;
+   return i;
+}
+
+static size_t CountToChar_Scalar(const unsigned *pIn, size_t n, unsigned a, unsigned b)
+{
+   size_t i = 0;
+   while (i < n && pIn[i] != a && pIn[i] != b)
+      i++;
+   return i;
+}
+
+static size_t CountUTF8_Scalar(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t nChars = 0;
+   for (size_t i = 0; i < n; i++)
+   {
+      nChars += (pIn[i] & 0xC0) != 0x80 ? 1 : 0;
+      nLines += pIn[i] == '\n' ? 1 : 0;
+   }
+   return nChars;
+}
+
+static size_t CountUnits16_Scalar(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t nChars = 0;
+   for (size_t i = 0; i < n; i++)
+   {
+      unsigned Unit = pIn[i * 2] + pIn[i * 2 + 1] * 256;
+      nChars += (Unit & 0xFC00) != 0xDC00 ? 1 : 0;
+      nLines += Unit == '\n' ? 1 : 0;
+   }
+   return nChars;
+}
+
+static size_t CountUnits16BE_Scalar(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t nChars = 0;
+   for (size_t i = 0; i < n; i++)
+   {
+      unsigned Unit = pIn[i * 2] * 256 + pIn[i * 2 + 1];
+      nChars += (Unit & 0xFC00) != 0xDC00 ? 1 : 0;
+      nLines += Unit == '\n' ? 1 : 0;
+   }
+   return nChars;
+}
+
+static const TxKernels ScalarKernels =
+{
+   _T("NONE"),
+   WidenAscii_Scalar,
+   WidenBytes_Scalar,
+   NarrowAscii_Scalar,
+   NarrowBmp16_Scalar,
+   NarrowBmp16BE_Scalar,
+   WidenUnits16_Scalar,
+   WidenUnits16BE_Scalar,
+   CountBmp16_Scalar,
+   CountBmp16BE_Scalar,
+   WidenUnits32_Scalar,
+   WidenUnits32BE_Scalar,
+   NarrowUnits32_Scalar,
+   NarrowUnits32BE_Scalar,
+   SwapBytes16_Scalar,
+   CountAscii_Scalar,
+   CountToChar_Scalar,
+   CountUTF8_Scalar,
+   CountUnits16_Scalar,
+   CountUnits16BE_Scalar
+};
+
+// Counting kernels add up their matches a vector at a time,
+// in lanes of 8 or 16 bits, for as many vectors as those can
+// count without overflowing, and then sum the lanes.
+const size_t COUNT_VECTORS8 = 255;
+const size_t COUNT_VECTORS16 = 4096;
+
+#ifdef TXU_X86
+
+// Widens 16 bytes to 16 code points.
+TXU_TARGET_SSE2 static inline void Widen16_SSE2(__m128i v, unsigned *p)
+{
+   const __m128i z = _mm_setzero_si128();
+   __m128i lo = _mm_unpacklo_epi8(v, z);
+   __m128i hi = _mm_unpackhi_epi8(v, z);
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(p),      _mm_unpacklo_epi16(lo, z));
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 4),  _mm_unpackhi_epi16(lo, z));
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 8),  _mm_unpacklo_epi16(hi, z));
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 12), _mm_unpackhi_epi16(hi, z));
+}
+
+// Returns true if all code points in 'v' are ASCII.
+TXU_TARGET_SSE2 static inline bool IsAscii32_SSE2(__m128i v)
+{
+   __m128i High = _mm_and_si128(v, _mm_set1_epi32(~0x7F));
+   return _mm_movemask_epi8(_mm_cmpeq_epi32(High, _mm_setzero_si128())) == 0xFFFF;
+}
+
+TXU_TARGET_SSE2 static size_t WidenAscii_SSE2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i));
+      if (_mm_movemask_epi8(v) != 0)
+         break;
+      Widen16_SSE2(v, pOut + i);
+   }
+   return i + WidenAscii_Scalar(pIn + i, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static void WidenBytes_SSE2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+      Widen16_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i)), pOut + i);
+   WidenBytes_Scalar(pIn + i, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static size_t NarrowAscii_SSE2(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i);
+      __m128i a = _mm_loadu_si128(p);
+      __m128i b = _mm_loadu_si128(p + 1);
+      __m128i c = _mm_loadu_si128(p + 2);
+      __m128i d = _mm_loadu_si128(p + 3);
+      if (!IsAscii32_SSE2(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+         break;
+      __m128i v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i), v);
+   }
+   return i + NarrowAscii_Scalar(pIn + i, n - i, pOut + i);
+}
+
+// Returns true if all code points in 'v' are below U+10000.
+TXU_TARGET_SSE2 static inline bool IsBmp32_SSE2(__m128i v)
+{
+   __m128i High = _mm_srli_epi32(v, 16);
+   return _mm_movemask_epi8(_mm_cmpeq_epi32(High, _mm_setzero_si128())) == 0xFFFF;
+}
+
+// Packs two vectors of code points below U+10000 to 16-bit
+// units.  SSE2 only packs with signed saturation, so the
+// units are sign extended first.
+TXU_TARGET_SSE2 static inline __m128i PackBmp_SSE2(__m128i a, __m128i b)
+{
+   a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+   b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+   return _mm_packs_epi32(a, b);
+}
+
+// Returns true if none of the 16-bit units in 'v' is a surrogate.
+TXU_TARGET_SSE2 static inline bool NoSurrogates_SSE2(__m128i v)
+{
+   __m128i Top = _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xF800)));
+   return _mm_movemask_epi8(_mm_cmpeq_epi16(Top, _mm_set1_epi16(static_cast<short>(0xD800)))) == 0;
+}
+
+TXU_TARGET_SSE2 static size_t NarrowBmp16_SSE2(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i);
+      __m128i a = _mm_loadu_si128(p);
+      __m128i b = _mm_loadu_si128(p + 1);
+      if (!IsBmp32_SSE2(_mm_or_si128(a, b)))
+         break;
+      __m128i v = PackBmp_SSE2(a, b);
+      if (!NoSurrogates_SSE2(v))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 2), v);
+   }
+   return i + NarrowBmp16_Scalar(pIn + i, n - i, pOut + i * 2);
+}
+
+TXU_TARGET_SSE2 static size_t NarrowBmp16BE_SSE2(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i);
+      __m128i a = _mm_loadu_si128(p);
+      __m128i b = _mm_loadu_si128(p + 1);
+      if (!IsBmp32_SSE2(_mm_or_si128(a, b)))
+         break;
+      __m128i v = PackBmp_SSE2(a, b);
+      if (!NoSurrogates_SSE2(v))
+         break;
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 2), v);
+   }
+   return i + NarrowBmp16BE_Scalar(pIn + i, n - i, pOut + i * 2);
+}
+
+TXU_TARGET_SSE2 static size_t WidenUnits16_SSE2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   const __m128i z = _mm_setzero_si128();
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2));
+      if (!NoSurrogates_SSE2(v))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i),     _mm_unpacklo_epi16(v, z));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i + 4), _mm_unpackhi_epi16(v, z));
+   }
+   return i + WidenUnits16_Scalar(pIn + i * 2, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static size_t WidenUnits16BE_SSE2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   const __m128i z = _mm_setzero_si128();
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2));
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      if (!NoSurrogates_SSE2(v))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i),     _mm_unpacklo_epi16(v, z));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i + 4), _mm_unpackhi_epi16(v, z));
+   }
+   return i + WidenUnits16BE_Scalar(pIn + i * 2, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static size_t CountBmp16_SSE2(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      if (!NoSurrogates_SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2))))
+         break;
+   }
+   return i + CountBmp16_Scalar(pIn + i * 2, n - i);
+}
+
+TXU_TARGET_SSE2 static size_t CountBmp16BE_SSE2(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2));
+      if (!NoSurrogates_SSE2(_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8))))
+         break;
+   }
+   return i + CountBmp16BE_Scalar(pIn + i * 2, n - i);
+}
+
+// Returns true if all the 32-bit values in 'a' and 'b' are
+// characters, no higher than U+10FFFF and not surrogates.
+TXU_TARGET_SSE2 static inline bool InRange32_SSE2(__m128i a, __m128i b)
+{
+   const __m128i Planes = _mm_set1_epi32(0x10);
+   const __m128i Top = _mm_set1_epi32(static_cast<int>(0xFFFFF800));
+   const __m128i Surrogate = _mm_set1_epi32(0xD800);
+   __m128i Over = _mm_or_si128(_mm_cmpgt_epi32(_mm_srli_epi32(a, 16), Planes),
+      _mm_cmpgt_epi32(_mm_srli_epi32(b, 16), Planes));
+   __m128i Surr = _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(a, Top), Surrogate),
+      _mm_cmpeq_epi32(_mm_and_si128(b, Top), Surrogate));
+   return _mm_movemask_epi8(_mm_or_si128(Over, Surr)) == 0;
+}
+
+// Reverses the bytes of each 32-bit value in 'v'.
+TXU_TARGET_SSE2 static inline __m128i Swap32_SSE2(__m128i v)
+{
+   v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+   v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+   return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+// UTF-32 units are the same bytes as code points on an x86
+// CPU, which is little endian, so they are only checked and
+// copied.
+TXU_TARGET_SSE2 static size_t WidenUnits32_SSE2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i * 4);
+      __m128i a = _mm_loadu_si128(p);
+      __m128i b = _mm_loadu_si128(p + 1);
+      if (!InRange32_SSE2(a, b))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i),     a);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i + 4), b);
+   }
+   return i + WidenUnits32_Scalar(pIn + i * 4, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static size_t WidenUnits32BE_SSE2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i * 4);
+      __m128i a = Swap32_SSE2(_mm_loadu_si128(p));
+      __m128i b = Swap32_SSE2(_mm_loadu_si128(p + 1));
+      if (!InRange32_SSE2(a, b))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i),     a);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i + 4), b);
+   }
+   return i + WidenUnits32BE_Scalar(pIn + i * 4, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static size_t NarrowUnits32_SSE2(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i);
+      __m128i a = _mm_loadu_si128(p);
+      __m128i b = _mm_loadu_si128(p + 1);
+      if (!InRange32_SSE2(a, b))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 4),      a);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 4 + 16), b);
+   }
+   return i + NarrowUnits32_Scalar(pIn + i, n - i, pOut + i * 4);
+}
+
+TXU_TARGET_SSE2 static size_t NarrowUnits32BE_SSE2(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i *p = reinterpret_cast<const __m128i *>(pIn + i);
+      __m128i a = _mm_loadu_si128(p);
+      __m128i b = _mm_loadu_si128(p + 1);
+      if (!InRange32_SSE2(a, b))
+         break;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 4),      Swap32_SSE2(a));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i * 4 + 16), Swap32_SSE2(b));
+   }
+   return i + NarrowUnits32BE_Scalar(pIn + i, n - i, pOut + i * 4);
+}
+
+TXU_TARGET_SSE2 static void SwapBytes16_SSE2(const unsigned char *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i));
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i), v);
+   }
+   SwapBytes16_Scalar(pIn + i, n - i, pOut + i);
+}
+
+TXU_TARGET_SSSE3 static void SwapBytes16_SSSE3(const unsigned char *pIn, size_t n, unsigned char *pOut)
+{
+   const __m128i Swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut + i), _mm_shuffle_epi8(v, Swap));
+   }
+   SwapBytes16_Scalar(pIn + i, n - i, pOut + i);
+}
+
+TXU_TARGET_SSE2 static size_t CountAscii_SSE2(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i))) != 0)
+         break;
+   }
+   return i + CountAscii_Scalar(pIn + i, n - i);
+}
+
+TXU_TARGET_SSE2 static size_t CountToChar_SSE2(const unsigned *pIn, size_t n, unsigned a, unsigned b)
+{
+   const __m128i MatchA = _mm_set1_epi32(static_cast<int>(a));
+   const __m128i MatchB = _mm_set1_epi32(static_cast<int>(b));
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i));
+      __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i + 4));
+      __m128i Hit = _mm_or_si128(
+         _mm_or_si128(_mm_cmpeq_epi32(v, MatchA), _mm_cmpeq_epi32(v, MatchB)),
+         _mm_or_si128(_mm_cmpeq_epi32(w, MatchA), _mm_cmpeq_epi32(w, MatchB)));
+      if (_mm_movemask_epi8(Hit) != 0)
+         break;
+   }
+   return i + CountToChar_Scalar(pIn + i, n - i, a, b);
+}
+
+// Sums the 8-bit lanes of 'v'.
+TXU_TARGET_SSE2 static inline size_t Sum8_SSE2(__m128i v)
+{
+   __m128i s = _mm_sad_epu8(v, _mm_setzero_si128());
+   return static_cast<size_t>(_mm_cvtsi128_si32(s)) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+}
+
+// Sums the 16-bit lanes of 'v'.
+TXU_TARGET_SSE2 static inline size_t Sum16_SSE2(__m128i v)
+{
+   __m128i s = _mm_madd_epi16(v, _mm_set1_epi16(1));
+   s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+   s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+   return static_cast<unsigned>(_mm_cvtsi128_si32(s));
+}
+
+TXU_TARGET_SSE2 static size_t CountUTF8_SSE2(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   // Bytes above 0xBF, taken as signed, are not 10xxxxxx.
+   const __m128i Cont = _mm_set1_epi8(static_cast<char>(0xBF));
+   const __m128i Lf = _mm_set1_epi8('\n');
+   size_t nChars = 0;
+   size_t i = 0;
+   while (i + 16 <= n)
+   {
+      __m128i Chars = _mm_setzero_si128();
+      __m128i Lines = _mm_setzero_si128();
+      for (size_t k = 0; k < COUNT_VECTORS8 && i + 16 <= n; k++, i += 16)
+      {
+         __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i));
+         Chars = _mm_sub_epi8(Chars, _mm_cmpgt_epi8(v, Cont));
+         Lines = _mm_sub_epi8(Lines, _mm_cmpeq_epi8(v, Lf));
+      }
+      nChars += Sum8_SSE2(Chars);
+      nLines += Sum8_SSE2(Lines);
+   }
+   return nChars + CountUTF8_Scalar(pIn + i, n - i, nLines);
+}
+
+// Counts the units that start a character in as many whole
+// vectors of the 'n' UTF-16 units (UTF-16BE if 'bSwap') as
+// there are, and sets 'Done' to the number of units in them.
+TXU_TARGET_SSE2 static inline size_t CountVectors16_SSE2(const unsigned char *pIn, size_t n, bool bSwap,
+   size_t &nLines, size_t &Done)
+{
+   const __m128i Top = _mm_set1_epi16(static_cast<short>(0xFC00));
+   const __m128i Low = _mm_set1_epi16(static_cast<short>(0xDC00));
+   const __m128i Lf = _mm_set1_epi16('\n');
+   size_t nChars = 0;
+   size_t i = 0;
+   while (i + 8 <= n)
+   {
+      __m128i Lows = _mm_setzero_si128();
+      __m128i Lines = _mm_setzero_si128();
+      size_t Start = i;
+      for (size_t k = 0; k < COUNT_VECTORS16 && i + 8 <= n; k++, i += 8)
+      {
+         __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn + i * 2));
+         if (bSwap)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+         Lows = _mm_sub_epi16(Lows, _mm_cmpeq_epi16(_mm_and_si128(v, Top), Low));
+         Lines = _mm_sub_epi16(Lines, _mm_cmpeq_epi16(v, Lf));
+      }
+      nChars += (i - Start) - Sum16_SSE2(Lows);
+      nLines += Sum16_SSE2(Lines);
+   }
+   Done = i;
+   return nChars;
+}
+
+TXU_TARGET_SSE2 static size_t CountUnits16_SSE2(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t i;
+   size_t nChars = CountVectors16_SSE2(pIn, n, false, nLines, i);
+   return nChars + CountUnits16_Scalar(pIn + i * 2, n - i, nLines);
+}
+
+TXU_TARGET_SSE2 static size_t CountUnits16BE_SSE2(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t i;
+   size_t nChars = CountVectors16_SSE2(pIn, n, true, nLines, i);
+   return nChars + CountUnits16BE_Scalar(pIn + i * 2, n - i, nLines);
+}
+
+TXU_TARGET_AVX2 static size_t WidenAscii_AVX2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 32 <= n; i += 32)
+   {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i));
+      if (_mm256_movemask_epi8(v) != 0)
+         break;
+      for (size_t k = 0; k < 32; k += 8)
+      {
+         __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(pIn + i + k));
+         _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i + k), _mm256_cvtepu8_epi32(b));
+      }
+   }
+
+   // Clear the upper halves of the YMM registers before going
+   // back to SSE code, which otherwise runs with a penalty.
+   _mm256_zeroupper();
+   return i + WidenAscii_SSE2(pIn + i, n - i, pOut + i);
+}
+
+TXU_TARGET_AVX2 static void WidenBytes_AVX2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(pIn + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i), _mm256_cvtepu8_epi32(b));
+   }
+   _mm256_zeroupper();
+   WidenBytes_Scalar(pIn + i, n - i, pOut + i);
+}
+
+TXU_TARGET_AVX2 static void SwapBytes16_AVX2(const unsigned char *pIn, size_t n, unsigned char *pOut)
+{
+   const __m256i Swap = _mm256_setr_epi8(
+      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+   size_t i = 0;
+   for (; i + 32 <= n; i += 32)
+   {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i), _mm256_shuffle_epi8(v, Swap));
+   }
+   _mm256_zeroupper();
+   SwapBytes16_Scalar(pIn + i, n - i, pOut + i);
+}
+
+// Returns true if all the 32-bit values in 'v' are characters,
+// no higher than U+10FFFF and not surrogates.
+TXU_TARGET_AVX2 static inline bool InRange32_AVX2(__m256i v)
+{
+   __m256i Over = _mm256_cmpgt_epi32(_mm256_srli_epi32(v, 16), _mm256_set1_epi32(0x10));
+   __m256i Surr = _mm256_cmpeq_epi32(_mm256_and_si256(v, _mm256_set1_epi32(static_cast<int>(0xFFFFF800))),
+      _mm256_set1_epi32(0xD800));
+   return _mm256_movemask_epi8(_mm256_or_si256(Over, Surr)) == 0;
+}
+
+// UTF-32BE is byte swapped with a shuffle, which SSE2 lacks.
+TXU_TARGET_AVX2 static size_t WidenUnits32BE_AVX2(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   const __m256i Swap = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i * 4));
+      v = _mm256_shuffle_epi8(v, Swap);
+      if (!InRange32_AVX2(v))
+         break;
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i), v);
+   }
+   _mm256_zeroupper();
+   return i + WidenUnits32BE_SSE2(pIn + i * 4, n - i, pOut + i);
+}
+
+TXU_TARGET_AVX2 static size_t NarrowUnits32BE_AVX2(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   const __m256i Swap = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i));
+      if (!InRange32_AVX2(v))
+         break;
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOut + i * 4), _mm256_shuffle_epi8(v, Swap));
+   }
+   _mm256_zeroupper();
+   return i + NarrowUnits32BE_SSE2(pIn + i, n - i, pOut + i * 4);
+}
+
+TXU_TARGET_AVX2 static size_t CountAscii_AVX2(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 32 <= n; i += 32)
+   {
+      if (_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i))) != 0)
+         break;
+   }
+   _mm256_zeroupper();
+   return i + CountAscii_SSE2(pIn + i, n - i);
+}
+
+TXU_TARGET_AVX2 static size_t CountToChar_AVX2(const unsigned *pIn, size_t n, unsigned a, unsigned b)
+{
+   const __m256i MatchA = _mm256_set1_epi32(static_cast<int>(a));
+   const __m256i MatchB = _mm256_set1_epi32(static_cast<int>(b));
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i));
+      __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i + 8));
+      __m256i Hit = _mm256_or_si256(
+         _mm256_or_si256(_mm256_cmpeq_epi32(v, MatchA), _mm256_cmpeq_epi32(v, MatchB)),
+         _mm256_or_si256(_mm256_cmpeq_epi32(w, MatchA), _mm256_cmpeq_epi32(w, MatchB)));
+      if (_mm256_movemask_epi8(Hit) != 0)
+         break;
+   }
+   _mm256_zeroupper();
+   return i + CountToChar_SSE2(pIn + i, n - i, a, b);
+}
+
+// Sums the 8-bit lanes of 'v'.
+TXU_TARGET_AVX2 static inline size_t Sum8_AVX2(__m256i v)
+{
+   __m256i s = _mm256_sad_epu8(v, _mm256_setzero_si256());
+   __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+   return static_cast<size_t>(_mm_cvtsi128_si32(t)) + _mm_cvtsi128_si32(_mm_srli_si128(t, 8));
+}
+
+TXU_TARGET_AVX2 static size_t CountUTF8_AVX2(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   const __m256i Cont = _mm256_set1_epi8(static_cast<char>(0xBF));
+   const __m256i Lf = _mm256_set1_epi8('\n');
+   size_t nChars = 0;
+   size_t i = 0;
+   while (i + 32 <= n)
+   {
+      __m256i Chars = _mm256_setzero_si256();
+      __m256i Lines = _mm256_setzero_si256();
+      for (size_t k = 0; k < COUNT_VECTORS8 && i + 32 <= n; k++, i += 32)
+      {
+         __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pIn + i));
+         Chars = _mm256_sub_epi8(Chars, _mm256_cmpgt_epi8(v, Cont));
+         Lines = _mm256_sub_epi8(Lines, _mm256_cmpeq_epi8(v, Lf));
+      }
+      nChars += Sum8_AVX2(Chars);
+      nLines += Sum8_AVX2(Lines);
+   }
+   _mm256_zeroupper();
+   return nChars + CountUTF8_SSE2(pIn + i, n - i, nLines);
+}
+
+static const TxKernels SSE2Kernels =
+{
+   _T("SSE2"),
+   WidenAscii_SSE2,
+   WidenBytes_SSE2,
+   NarrowAscii_SSE2,
+   NarrowBmp16_SSE2,
+   NarrowBmp16BE_SSE2,
+   WidenUnits16_SSE2,
+   WidenUnits16BE_SSE2,
+   CountBmp16_SSE2,
+   CountBmp16BE_SSE2,
+   WidenUnits32_SSE2,
+   WidenUnits32BE_SSE2,
+   NarrowUnits32_SSE2,
+   NarrowUnits32BE_SSE2,
+   SwapBytes16_SSE2,
+   CountAscii_SSE2,
+   CountToChar_SSE2,
+   CountUTF8_SSE2,
+   CountUnits16_SSE2,
+   CountUnits16BE_SSE2
+};
+
+// Narrowing, counting UTF-16 and copying UTF-32 are limited
+// by memory bandwidth rather than by the width of the
+// vectors, so AVX2 reuses the SSE2 code.
+static const TxKernels AVX2Kernels =
+{
+   _T("AVX2"),
+   WidenAscii_AVX2,
+   WidenBytes_AVX2,
+   NarrowAscii_SSE2,
+   NarrowBmp16_SSE2,
+   NarrowBmp16BE_SSE2,
+   WidenUnits16_SSE2,
+   WidenUnits16BE_SSE2,
+   CountBmp16_SSE2,
+   CountBmp16BE_SSE2,
+   WidenUnits32_SSE2,
+   WidenUnits32BE_AVX2,
+   NarrowUnits32_SSE2,
+   NarrowUnits32BE_AVX2,
+   SwapBytes16_AVX2,
+   CountAscii_AVX2,
+   CountToChar_AVX2,
+   CountUTF8_AVX2,
+   CountUnits16_SSE2,
+   CountUnits16BE_SSE2
+};
+
+//----------------------------------------------------------
+// Determines which SIMD instruction sets the CPU and the
+// operating system support.
+//----------------------------------------------------------
+static void DetectCPU(bool &bSSE2, bool &bSSSE3, bool &bAVX2)
+{
+   unsigned Regs[4] = { 0, 0, 0, 0 };   // EAX, EBX, ECX, EDX
+   unsigned MaxLeaf;
+#ifdef _MSC_VER
+   int r[4];
+   __cpuid(r, 0);
+   MaxLeaf = r[0];
+   __cpuid(r, 1);
+   for (int i = 0; i < 4; i++)
+      Regs[i] = r[i];
+#else
+   MaxLeaf = __get_cpuid_max(0, NULL);
+   __get_cpuid(1, &Regs[0], &Regs[1], &Regs[2], &Regs[3]);
+#endif
+   bSSE2 = (Regs[3] & (1u << 26)) != 0;
+   bSSSE3 = (Regs[2] & (1u << 9)) != 0;
+   bAVX2 = false;
+
+   // AVX2 needs the OS to save the YMM registers (OSXSAVE and
+   // XCR0 bits 1-2), as well as the CPUID feature bit.
+   bool bOSXSAVE = (Regs[2] & (1u << 27)) != 0;
+   bool bAVX = (Regs[2] & (1u << 28)) != 0;
+   if (!bOSXSAVE || !bAVX || MaxLeaf < 7)
+      return;
+#ifdef _MSC_VER
+   unsigned long long XCR0 = _xgetbv(0);
+   __cpuidex(r, 7, 0);
+   Regs[1] = r[1];
+#else
+   unsigned Lo, Hi;
+   __asm__ __volatile__("xgetbv" : "=a"(Lo), "=d"(Hi) : "c"(0));
+   unsigned long long XCR0 = (static_cast<unsigned long long>(Hi) << 32) | Lo;
+   __cpuid_count(7, 0, Regs[0], Regs[1], Regs[2], Regs[3]);
+#endif
+   bAVX2 = (XCR0 & 6) == 6 && (Regs[1] & (1u << 5)) != 0;
+}
+
+#endif // TXU_X86
+
+#ifdef TXU_NEON
+
+// Widens 16 bytes to 16 code points.
+static inline void Widen16_NEON(uint8x16_t v, unsigned *p)
+{
+   uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+   uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+   vst1q_u32(p,      vmovl_u16(vget_low_u16(lo)));
+   vst1q_u32(p + 4,  vmovl_u16(vget_high_u16(lo)));
+   vst1q_u32(p + 8,  vmovl_u16(vget_low_u16(hi)));
+   vst1q_u32(p + 12, vmovl_u16(vget_high_u16(hi)));
+}
+
+static size_t WidenAscii_NEON(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      uint8x16_t v = vld1q_u8(pIn + i);
+      if (vmaxvq_u8(v) >= 0x80)
+         break;
+      Widen16_NEON(v, pOut + i);
+   }
+   return i + WidenAscii_Scalar(pIn + i, n - i, pOut + i);
+}
+
+static void WidenBytes_NEON(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+      Widen16_NEON(vld1q_u8(pIn + i), pOut + i);
+   WidenBytes_Scalar(pIn + i, n - i, pOut + i);
+}
+
+static size_t NarrowAscii_NEON(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      uint32x4_t a = vld1q_u32(pIn + i);
+      uint32x4_t b = vld1q_u32(pIn + i + 4);
+      uint32x4_t c = vld1q_u32(pIn + i + 8);
+      uint32x4_t d = vld1q_u32(pIn + i + 12);
+      if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80)
+         break;
+      uint16x8_t ab = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+      uint16x8_t cd = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+      vst1q_u8(pOut + i, vcombine_u8(vmovn_u16(ab), vmovn_u16(cd)));
+   }
+   return i + NarrowAscii_Scalar(pIn + i, n - i, pOut + i);
+}
+
+// Returns true if none of the 16-bit units in 'v' is a surrogate.
+static inline bool NoSurrogates_NEON(uint16x8_t v)
+{
+   uint16x8_t Top = vandq_u16(v, vdupq_n_u16(0xF800));
+   return vmaxvq_u16(vceqq_u16(Top, vdupq_n_u16(0xD800))) == 0;
+}
+
+static size_t NarrowBmp16_NEON(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t a = vld1q_u32(pIn + i);
+      uint32x4_t b = vld1q_u32(pIn + i + 4);
+      if (vmaxvq_u32(vorrq_u32(a, b)) >= 0x10000)
+         break;
+      uint16x8_t v = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+      if (!NoSurrogates_NEON(v))
+         break;
+      vst1q_u8(pOut + i * 2, vreinterpretq_u8_u16(v));
+   }
+   return i + NarrowBmp16_Scalar(pIn + i, n - i, pOut + i * 2);
+}
+
+static size_t NarrowBmp16BE_NEON(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t a = vld1q_u32(pIn + i);
+      uint32x4_t b = vld1q_u32(pIn + i + 4);
+      if (vmaxvq_u32(vorrq_u32(a, b)) >= 0x10000)
+         break;
+      uint16x8_t v = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+      if (!NoSurrogates_NEON(v))
+         break;
+      vst1q_u8(pOut + i * 2, vrev16q_u8(vreinterpretq_u8_u16(v)));
+   }
+   return i + NarrowBmp16BE_Scalar(pIn + i, n - i, pOut + i * 2);
+}
+
+static size_t WidenUnits16_NEON(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(pIn + i * 2));
+      if (!NoSurrogates_NEON(v))
+         break;
+      vst1q_u32(pOut + i,     vmovl_u16(vget_low_u16(v)));
+      vst1q_u32(pOut + i + 4, vmovl_u16(vget_high_u16(v)));
+   }
+   return i + WidenUnits16_Scalar(pIn + i * 2, n - i, pOut + i);
+}
+
+static size_t WidenUnits16BE_NEON(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint16x8_t v = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(pIn + i * 2)));
+      if (!NoSurrogates_NEON(v))
+         break;
+      vst1q_u32(pOut + i,     vmovl_u16(vget_low_u16(v)));
+      vst1q_u32(pOut + i + 4, vmovl_u16(vget_high_u16(v)));
+   }
+   return i + WidenUnits16BE_Scalar(pIn + i * 2, n - i, pOut + i);
+}
+
+static size_t CountBmp16_NEON(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      if (!NoSurrogates_NEON(vreinterpretq_u16_u8(vld1q_u8(pIn + i * 2))))
+         break;
+   }
+   return i + CountBmp16_Scalar(pIn + i * 2, n - i);
+}
+
+static size_t CountBmp16BE_NEON(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      if (!NoSurrogates_NEON(vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(pIn + i * 2)))))
+         break;
+   }
+   return i + CountBmp16BE_Scalar(pIn + i * 2, n - i);
+}
+
+// Returns true if all the 32-bit values in 'a' and 'b' are
+// characters, no higher than U+10FFFF and not surrogates.
+static inline bool InRange32_NEON(uint32x4_t a, uint32x4_t b)
+{
+   const uint32x4_t Top = vdupq_n_u32(0xFFFFF800);
+   const uint32x4_t Surrogate = vdupq_n_u32(0xD800);
+   uint32x4_t Surr = vorrq_u32(vceqq_u32(vandq_u32(a, Top), Surrogate),
+      vceqq_u32(vandq_u32(b, Top), Surrogate));
+   return vmaxvq_u32(vmaxq_u32(a, b)) <= 0x10FFFF && vmaxvq_u32(Surr) == 0;
+}
+
+// UTF-32 units are the same bytes as code points on a little
+// endian CPU, so they are only checked and copied.
+static size_t WidenUnits32_NEON(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t a = vreinterpretq_u32_u8(vld1q_u8(pIn + i * 4));
+      uint32x4_t b = vreinterpretq_u32_u8(vld1q_u8(pIn + i * 4 + 16));
+      if (!InRange32_NEON(a, b))
+         break;
+      vst1q_u32(pOut + i,     a);
+      vst1q_u32(pOut + i + 4, b);
+   }
+   return i + WidenUnits32_Scalar(pIn + i * 4, n - i, pOut + i);
+}
+
+static size_t WidenUnits32BE_NEON(const unsigned char *pIn, size_t n, unsigned *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t a = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(pIn + i * 4)));
+      uint32x4_t b = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(pIn + i * 4 + 16)));
+      if (!InRange32_NEON(a, b))
+         break;
+      vst1q_u32(pOut + i,     a);
+      vst1q_u32(pOut + i + 4, b);
+   }
+   return i + WidenUnits32BE_Scalar(pIn + i * 4, n - i, pOut + i);
+}
+
+static size_t NarrowUnits32_NEON(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t a = vld1q_u32(pIn + i);
+      uint32x4_t b = vld1q_u32(pIn + i + 4);
+      if (!InRange32_NEON(a, b))
+         break;
+      vst1q_u8(pOut + i * 4,      vreinterpretq_u8_u32(a));
+      vst1q_u8(pOut + i * 4 + 16, vreinterpretq_u8_u32(b));
+   }
+   return i + NarrowUnits32_Scalar(pIn + i, n - i, pOut + i * 4);
+}
+
+static size_t NarrowUnits32BE_NEON(const unsigned *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t a = vld1q_u32(pIn + i);
+      uint32x4_t b = vld1q_u32(pIn + i + 4);
+      if (!InRange32_NEON(a, b))
+         break;
+      vst1q_u8(pOut + i * 4,      vrev32q_u8(vreinterpretq_u8_u32(a)));
+      vst1q_u8(pOut + i * 4 + 16, vrev32q_u8(vreinterpretq_u8_u32(b)));
+   }
+   return i + NarrowUnits32BE_Scalar(pIn + i, n - i, pOut + i * 4);
+}
+
+static void SwapBytes16_NEON(const unsigned char *pIn, size_t n, unsigned char *pOut)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+      vst1q_u8(pOut + i, vrev16q_u8(vld1q_u8(pIn + i)));
+   SwapBytes16_Scalar(pIn + i, n - i, pOut + i);
+}
+
+static size_t CountAscii_NEON(const unsigned char *pIn, size_t n)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      if (vmaxvq_u8(vld1q_u8(pIn + i)) >= 0x80)
+         break;
+   }
+   return i + CountAscii_Scalar(pIn + i, n - i);
+}
+
+static size_t CountToChar_NEON(const unsigned *pIn, size_t n, unsigned a, unsigned b)
+{
+   const uint32x4_t MatchA = vdupq_n_u32(a);
+   const uint32x4_t MatchB = vdupq_n_u32(b);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      uint32x4_t v = vld1q_u32(pIn + i);
+      uint32x4_t w = vld1q_u32(pIn + i + 4);
+      uint32x4_t Hit = vorrq_u32(
+         vorrq_u32(vceqq_u32(v, MatchA), vceqq_u32(v, MatchB)),
+         vorrq_u32(vceqq_u32(w, MatchA), vceqq_u32(w, MatchB)));
+      if (vmaxvq_u32(Hit) != 0)
+         break;
+   }
+   return i + CountToChar_Scalar(pIn + i, n - i, a, b);
+}
+
+static size_t CountUTF8_NEON(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   const int8x16_t Cont = vdupq_n_s8(static_cast<signed char>(0xBF));
+   const uint8x16_t Lf = vdupq_n_u8('\n');
+   size_t nChars = 0;
+   size_t i = 0;
+   while (i + 16 <= n)
+   {
+      uint8x16_t Chars = vdupq_n_u8(0);
+      uint8x16_t Lines = vdupq_n_u8(0);
+      for (size_t k = 0; k < COUNT_VECTORS8 && i + 16 <= n; k++, i += 16)
+      {
+         uint8x16_t v = vld1q_u8(pIn + i);
+         Chars = vsubq_u8(Chars, vcgtq_s8(vreinterpretq_s8_u8(v), Cont));
+         Lines = vsubq_u8(Lines, vceqq_u8(v, Lf));
+      }
+      nChars += vaddlvq_u8(Chars);
+      nLines += vaddlvq_u8(Lines);
+   }
+   return nChars + CountUTF8_Scalar(pIn + i, n - i, nLines);
+}
+
+// Counts the units that start a character in as many whole
+// vectors of the 'n' UTF-16 units (UTF-16BE if 'bSwap') as
+// there are, and sets 'Done' to the number of units in them.
+static inline size_t CountVectors16_NEON(const unsigned char *pIn, size_t n, bool bSwap,
+   size_t &nLines, size_t &Done)
+{
+   const uint16x8_t Top = vdupq_n_u16(0xFC00);
+   const uint16x8_t Low = vdupq_n_u16(0xDC00);
+   const uint16x8_t Lf = vdupq_n_u16('\n');
+   size_t nChars = 0;
+   size_t i = 0;
+   while (i + 8 <= n)
+   {
+      uint16x8_t Lows = vdupq_n_u16(0);
+      uint16x8_t Lines = vdupq_n_u16(0);
+      size_t Start = i;
+      for (size_t k = 0; k < COUNT_VECTORS16 && i + 8 <= n; k++, i += 8)
+      {
+         uint8x16_t b = vld1q_u8(pIn + i * 2);
+         uint16x8_t v = vreinterpretq_u16_u8(bSwap ? vrev16q_u8(b) : b);
+         Lows = vsubq_u16(Lows, vceqq_u16(vandq_u16(v, Top), Low));
+         Lines = vsubq_u16(Lines, vceqq_u16(v, Lf));
+      }
+      nChars += (i - Start) - vaddlvq_u16(Lows);
+      nLines += vaddlvq_u16(Lines);
+   }
+   Done = i;
+   return nChars;
+}
+
+static size_t CountUnits16_NEON(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t i;
+   size_t nChars = CountVectors16_NEON(pIn, n, false, nLines, i);
+   return nChars + CountUnits16_Scalar(pIn + i * 2, n - i, nLines);
+}
+
+static size_t CountUnits16BE_NEON(const unsigned char *pIn, size_t n, size_t &nLines)
+{
+   size_t i;
+   size_t nChars = CountVectors16_NEON(pIn, n, true, nLines, i);
+   return nChars + CountUnits16BE_Scalar(pIn + i * 2, n - i, nLines);
+}
+
+static const TxKernels NEONKernels =
+{
+   _T("NEON"),
+   WidenAscii_NEON,
+   WidenBytes_NEON,
+   NarrowAscii_NEON,
+   NarrowBmp16_NEON,
+   NarrowBmp16BE_NEON,
+   WidenUnits16_NEON,
+   WidenUnits16BE_NEON,
+   CountBmp16_NEON,
+   CountBmp16BE_NEON,
+   WidenUnits32_NEON,
+   WidenUnits32BE_NEON,
+   NarrowUnits32_NEON,
+   NarrowUnits32BE_NEON,
+   SwapBytes16_NEON,
+   CountAscii_NEON,
+   CountToChar_NEON,
+   CountUTF8_NEON,
+   CountUnits16_NEON,
+   CountUnits16BE_NEON
+};
+
+#endif // TXU_NEON
+
+// Kernels in use; set by SelectKernels().
+static TxKernels Kernels = ScalarKernels;
+
+//----------------------------------------------------------
+// Chooses the ASCII fast path kernels.  'Name' is one of
+// AUTO, NONE, SSE2, AVX2 or NEON; AUTO picks the best set
+// the CPU supports.
+//
+// Returns true if successful, false if the named kernels
+// are unknown or not supported by this CPU.
+//----------------------------------------------------------
+bool SelectKernels(const _TCHAR *Name)
+{
+   bool bAuto = _tcsicmp(Name, _T("AUTO")) == 0;
+   const TxKernels *pChoice = NULL;
+   if (bAuto || _tcsicmp(Name, _T("NONE")) == 0)
+      pChoice = &ScalarKernels;
+
+#ifdef TXU_X86
+   bool bSSE2, bSSSE3, bAVX2;
+   DetectCPU(bSSE2, bSSSE3, bAVX2);
+   if (bSSE2 && (bAuto || _tcsicmp(Name, _T("SSE2")) == 0))
+      pChoice = &SSE2Kernels;
+   if (bAVX2 && (bAuto || _tcsicmp(Name, _T("AVX2")) == 0))
+      pChoice = &AVX2Kernels;
+#endif
+
+#ifdef TXU_NEON
+   // NEON is always present on 64-bit ARM.
+   if (bAuto || _tcsicmp(Name, _T("NEON")) == 0)
+      pChoice = &NEONKernels;
+#endif
+
+   if (pChoice == NULL)
+      return false;
+   Kernels = *pChoice;
+
+#ifdef TXU_X86
+   // Nearly every CPU with SSE2 also has the SSSE3 byte shuffle.
+   if (pChoice == &SSE2Kernels && bSSSE3)
+      Kernels.SwapBytes16 = SwapBytes16_SSSE3;
+#endif
+   return true;
+}
+
+//----------------------------------------------------------
+// Retrieves the name of the kernels in use.
+//----------------------------------------------------------
+const _TCHAR * KernelsName(void)
+{
+   return Kernels.Name;
+}
+
+// Possible outcomes of decoding one character.
+enum TxDecodeResult
+{
+   DEC_OK = 0,             // A character was decoded.
+   DEC_PARTIAL,            // The buffer ends in the middle of a character.
+   DEC_INVALID             // The bytes are not a valid character.
+};
+
+//----------------------------------------------------------
+// Character codecs.  TxCodec<Fmt> holds the routines that
+// decode and encode one encoding:
+//
+//   Decode()     Decodes one character from 'p', placing the
+//                result into 'Char' and the number of bytes
+//                it occupied into 'Used'.
+//   DecodeRun()  Decodes a leading run of up to 'n'
+//                characters that has a fast path (e.g. ASCII)
+//                in bulk.  Returns the number of characters
+//                decoded, each of which took RUN_BYTES bytes.
+//   Encode()     Encodes one character into 'p', which has
+//                room for MAX_BYTES bytes.  Returns the
+//                number of bytes produced.
+//   EncodeRun()  Encodes a leading run of characters that
+//                has a fast path in bulk.  Returns the number
+//                of characters encoded, each of which took
+//                RUN_BYTES bytes.
+//   SplitPoint() Returns the start of the character that
+//                contains byte 'Pos', where the input can be
+//                split between two threads.
+//
+// The conversion loops further down are templates over the
+// input and output codecs, so every pair of encodings gets
+// its own loop with no test of the format per character.
+//----------------------------------------------------------
+template <TxEncoding Fmt> struct TxCodec;
+
+//----------------------------------------------------------
+// Code pages for ANSI text (/CODEPAGE).  Each is one byte a
+// character, with ASCII in the lower half; the tables below
+// give the code points of the upper half, from the mapping
+// files published by the Unicode consortium.  NO_CHAR marks
+// a byte with no character in the code page.
+//
+// From each table a TxCodePageMap is built at compile time:
+// a 256 entry table for decoding, so that each byte costs one
+// lookup, and for encoding a small hash table of the upper
+// half keyed by code point.  The default, ISO 8859-1, maps
+// bytes to code points 1:1, so the codec goes around its
+// tables.
+//----------------------------------------------------------
+const unsigned short NO_CHAR = 0xFFFF;
+
+// 437  OEM United States
+static constexpr unsigned short CodePage437[128] =
+{
+   0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+   0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+   0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+   0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+   0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+   0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+   0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+   0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+   0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+   0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+   0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+   0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+   0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+   0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+   0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+   0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+};
+
+// 850  OEM Multilingual Latin 1
+static constexpr unsigned short CodePage850[128] =
+{
+   0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+   0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+   0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+   0x00FF, 0x00D6, 0x00DC, 0x00F8, 0x00A3, 0x00D8, 0x00D7, 0x0192,
+   0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+   0x00BF, 0x00AE, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+   0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x00C1, 0x00C2, 0x00C0,
+   0x00A9, 0x2563, 0x2551, 0x2557, 0x255D, 0x00A2, 0x00A5, 0x2510,
+   0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x00E3, 0x00C3,
+   0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x00A4,
+   0x00F0, 0x00D0, 0x00CA, 0x00CB, 0x00C8, 0x0131, 0x00CD, 0x00CE,
+   0x00CF, 0x2518, 0x250C, 0x2588, 0x2584, 0x00A6, 0x00CC, 0x2580,
+   0x00D3, 0x00DF, 0x00D4, 0x00D2, 0x00F5, 0x00D5, 0x00B5, 0x00FE,
+   0x00DE, 0x00DA, 0x00DB, 0x00D9, 0x00FD, 0x00DD, 0x00AF, 0x00B4,
+   0x00AD, 0x00B1, 0x2017, 0x00BE, 0x00B6, 0x00A7, 0x00F7, 0x00B8,
+   0x00B0, 0x00A8, 0x00B7, 0x00B9, 0x00B3, 0x00B2, 0x25A0, 0x00A0
+};
+
+// 852  OEM Latin 2
+static constexpr unsigned short CodePage852[128] =
+{
+   0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x016F, 0x0107, 0x00E7,
+   0x0142, 0x00EB, 0x0150, 0x0151, 0x00EE, 0x0179, 0x00C4, 0x0106,
+   0x00C9, 0x0139, 0x013A, 0x00F4, 0x00F6, 0x013D, 0x013E, 0x015A,
+   0x015B, 0x00D6, 0x00DC, 0x0164, 0x0165, 0x0141, 0x00D7, 0x010D,
+   0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x0104, 0x0105, 0x017D, 0x017E,
+   0x0118, 0x0119, 0x00AC, 0x017A, 0x010C, 0x015F, 0x00AB, 0x00BB,
+   0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x00C1, 0x00C2, 0x011A,
+   0x015E, 0x2563, 0x2551, 0x2557, 0x255D, 0x017B, 0x017C, 0x2510,
+   0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x0102, 0x0103,
+   0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x00A4,
+   0x0111, 0x0110, 0x010E, 0x00CB, 0x010F, 0x0147, 0x00CD, 0x00CE,
+   0x011B, 0x2518, 0x250C, 0x2588, 0x2584, 0x0162, 0x016E, 0x2580,
+   0x00D3, 0x00DF, 0x00D4, 0x0143, 0x0144, 0x0148, 0x0160, 0x0161,
+   0x0154, 0x00DA, 0x0155, 0x0170, 0x00FD, 0x00DD, 0x0163, 0x00B4,
+   0x00AD, 0x02DD, 0x02DB, 0x02C7, 0x02D8, 0x00A7, 0x00F7, 0x00B8,
+   0x00B0, 0x00A8, 0x02D9, 0x0171, 0x0158, 0x0159, 0x25A0, 0x00A0
+};
+
+// 866  OEM Russian
+static constexpr unsigned short CodePage866[128] =
+{
+   0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+   0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+   0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+   0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+   0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+   0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+   0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+   0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+   0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+   0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+   0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+   0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+   0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+   0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+   0x0401, 0x0451, 0x0404, 0x0454, 0x0407, 0x0457, 0x040E, 0x045E,
+   0x00B0, 0x2219, 0x00B7, 0x221A, 0x2116, 0x00A4, 0x25A0, 0x00A0
+};
+
+// 874  Windows Thai
+static constexpr unsigned short CodePage874[128] =
+{
+   0x20AC, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, 0x2026, NO_CHAR, NO_CHAR,
+   NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   0x00A0, 0x0E01, 0x0E02, 0x0E03, 0x0E04, 0x0E05, 0x0E06, 0x0E07,
+   0x0E08, 0x0E09, 0x0E0A, 0x0E0B, 0x0E0C, 0x0E0D, 0x0E0E, 0x0E0F,
+   0x0E10, 0x0E11, 0x0E12, 0x0E13, 0x0E14, 0x0E15, 0x0E16, 0x0E17,
+   0x0E18, 0x0E19, 0x0E1A, 0x0E1B, 0x0E1C, 0x0E1D, 0x0E1E, 0x0E1F,
+   0x0E20, 0x0E21, 0x0E22, 0x0E23, 0x0E24, 0x0E25, 0x0E26, 0x0E27,
+   0x0E28, 0x0E29, 0x0E2A, 0x0E2B, 0x0E2C, 0x0E2D, 0x0E2E, 0x0E2F,
+   0x0E30, 0x0E31, 0x0E32, 0x0E33, 0x0E34, 0x0E35, 0x0E36, 0x0E37,
+   0x0E38, 0x0E39, 0x0E3A, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, 0x0E3F,
+   0x0E40, 0x0E41, 0x0E42, 0x0E43, 0x0E44, 0x0E45, 0x0E46, 0x0E47,
+   0x0E48, 0x0E49, 0x0E4A, 0x0E4B, 0x0E4C, 0x0E4D, 0x0E4E, 0x0E4F,
+   0x0E50, 0x0E51, 0x0E52, 0x0E53, 0x0E54, 0x0E55, 0x0E56, 0x0E57,
+   0x0E58, 0x0E59, 0x0E5A, 0x0E5B, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR
+};
+
+// 1250  Windows Central European
+static constexpr unsigned short CodePage1250[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, NO_CHAR, 0x201E, 0x2026, 0x2020, 0x2021,
+   NO_CHAR, 0x2030, 0x0160, 0x2039, 0x015A, 0x0164, 0x017D, 0x0179,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   NO_CHAR, 0x2122, 0x0161, 0x203A, 0x015B, 0x0165, 0x017E, 0x017A,
+   0x00A0, 0x02C7, 0x02D8, 0x0141, 0x00A4, 0x0104, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x015E, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x017B,
+   0x00B0, 0x00B1, 0x02DB, 0x0142, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x0105, 0x015F, 0x00BB, 0x013D, 0x02DD, 0x013E, 0x017C,
+   0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+   0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+   0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+   0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+   0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+   0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+   0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+   0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+};
+
+// 1251  Windows Cyrillic
+static constexpr unsigned short CodePage1251[128] =
+{
+   0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+   0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+   0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   NO_CHAR, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+   0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+   0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+   0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+   0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+   0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+   0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+   0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+   0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+   0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+   0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+   0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+   0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+};
+
+// 1252  Windows Western European
+static constexpr unsigned short CodePage1252[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+   0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, NO_CHAR, 0x017D, NO_CHAR,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, NO_CHAR, 0x017E, 0x0178,
+   0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+   0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+   0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+   0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+   0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+   0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+   0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+   0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+   0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+};
+
+// 1253  Windows Greek
+static constexpr unsigned short CodePage1253[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+   NO_CHAR, 0x2030, NO_CHAR, 0x2039, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   NO_CHAR, 0x2122, NO_CHAR, 0x203A, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   0x00A0, 0x0385, 0x0386, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, NO_CHAR, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x2015,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x0384, 0x00B5, 0x00B6, 0x00B7,
+   0x0388, 0x0389, 0x038A, 0x00BB, 0x038C, 0x00BD, 0x038E, 0x038F,
+   0x0390, 0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397,
+   0x0398, 0x0399, 0x039A, 0x039B, 0x039C, 0x039D, 0x039E, 0x039F,
+   0x03A0, 0x03A1, NO_CHAR, 0x03A3, 0x03A4, 0x03A5, 0x03A6, 0x03A7,
+   0x03A8, 0x03A9, 0x03AA, 0x03AB, 0x03AC, 0x03AD, 0x03AE, 0x03AF,
+   0x03B0, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+   0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+   0x03C0, 0x03C1, 0x03C2, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+   0x03C8, 0x03C9, 0x03CA, 0x03CB, 0x03CC, 0x03CD, 0x03CE, NO_CHAR
+};
+
+// 1254  Windows Turkish
+static constexpr unsigned short CodePage1254[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+   0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, NO_CHAR, NO_CHAR, NO_CHAR,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, NO_CHAR, NO_CHAR, 0x0178,
+   0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+   0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+   0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+   0x011E, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+   0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x0130, 0x015E, 0x00DF,
+   0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+   0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+   0x011F, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+   0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x0131, 0x015F, 0x00FF
+};
+
+// 1255  Windows Hebrew
+static constexpr unsigned short CodePage1255[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+   0x02C6, 0x2030, NO_CHAR, 0x2039, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   0x02DC, 0x2122, NO_CHAR, 0x203A, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AA, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x00D7, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x00B9, 0x00F7, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+   0x05B0, 0x05B1, 0x05B2, 0x05B3, 0x05B4, 0x05B5, 0x05B6, 0x05B7,
+   0x05B8, 0x05B9, NO_CHAR, 0x05BB, 0x05BC, 0x05BD, 0x05BE, 0x05BF,
+   0x05C0, 0x05C1, 0x05C2, 0x05C3, 0x05F0, 0x05F1, 0x05F2, 0x05F3,
+   0x05F4, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR, NO_CHAR,
+   0x05D0, 0x05D1, 0x05D2, 0x05D3, 0x05D4, 0x05D5, 0x05D6, 0x05D7,
+   0x05D8, 0x05D9, 0x05DA, 0x05DB, 0x05DC, 0x05DD, 0x05DE, 0x05DF,
+   0x05E0, 0x05E1, 0x05E2, 0x05E3, 0x05E4, 0x05E5, 0x05E6, 0x05E7,
+   0x05E8, 0x05E9, 0x05EA, NO_CHAR, NO_CHAR, 0x200E, 0x200F, NO_CHAR
+};
+
+// 1256  Windows Arabic
+static constexpr unsigned short CodePage1256[128] =
+{
+   0x20AC, 0x067E, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+   0x02C6, 0x2030, 0x0679, 0x2039, 0x0152, 0x0686, 0x0698, 0x0688,
+   0x06AF, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   0x06A9, 0x2122, 0x0691, 0x203A, 0x0153, 0x200C, 0x200D, 0x06BA,
+   0x00A0, 0x060C, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x06BE, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x00B9, 0x061B, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x061F,
+   0x06C1, 0x0621, 0x0622, 0x0623, 0x0624, 0x0625, 0x0626, 0x0627,
+   0x0628, 0x0629, 0x062A, 0x062B, 0x062C, 0x062D, 0x062E, 0x062F,
+   0x0630, 0x0631, 0x0632, 0x0633, 0x0634, 0x0635, 0x0636, 0x00D7,
+   0x0637, 0x0638, 0x0639, 0x063A, 0x0640, 0x0641, 0x0642, 0x0643,
+   0x00E0, 0x0644, 0x00E2, 0x0645, 0x0646, 0x0647, 0x0648, 0x00E7,
+   0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x0649, 0x064A, 0x00EE, 0x00EF,
+   0x064B, 0x064C, 0x064D, 0x064E, 0x00F4, 0x064F, 0x0650, 0x00F7,
+   0x0651, 0x00F9, 0x0652, 0x00FB, 0x00FC, 0x200E, 0x200F, 0x06D2
+};
+
+// 1257  Windows Baltic
+static constexpr unsigned short CodePage1257[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, NO_CHAR, 0x201E, 0x2026, 0x2020, 0x2021,
+   NO_CHAR, 0x2030, NO_CHAR, 0x2039, NO_CHAR, 0x00A8, 0x02C7, 0x00B8,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   NO_CHAR, 0x2122, NO_CHAR, 0x203A, NO_CHAR, 0x00AF, 0x02DB, NO_CHAR,
+   0x00A0, NO_CHAR, 0x00A2, 0x00A3, 0x00A4, NO_CHAR, 0x00A6, 0x00A7,
+   0x00D8, 0x00A9, 0x0156, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00C6,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00F8, 0x00B9, 0x0157, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00E6,
+   0x0104, 0x012E, 0x0100, 0x0106, 0x00C4, 0x00C5, 0x0118, 0x0112,
+   0x010C, 0x00C9, 0x0179, 0x0116, 0x0122, 0x0136, 0x012A, 0x013B,
+   0x0160, 0x0143, 0x0145, 0x00D3, 0x014C, 0x00D5, 0x00D6, 0x00D7,
+   0x0172, 0x0141, 0x015A, 0x016A, 0x00DC, 0x017B, 0x017D, 0x00DF,
+   0x0105, 0x012F, 0x0101, 0x0107, 0x00E4, 0x00E5, 0x0119, 0x0113,
+   0x010D, 0x00E9, 0x017A, 0x0117, 0x0123, 0x0137, 0x012B, 0x013C,
+   0x0161, 0x0144, 0x0146, 0x00F3, 0x014D, 0x00F5, 0x00F6, 0x00F7,
+   0x0173, 0x0142, 0x015B, 0x016B, 0x00FC, 0x017C, 0x017E, 0x02D9
+};
+
+// 1258  Windows Vietnamese
+static constexpr unsigned short CodePage1258[128] =
+{
+   0x20AC, NO_CHAR, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+   0x02C6, 0x2030, NO_CHAR, 0x2039, 0x0152, NO_CHAR, NO_CHAR, NO_CHAR,
+   NO_CHAR, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+   0x02DC, 0x2122, NO_CHAR, 0x203A, 0x0153, NO_CHAR, NO_CHAR, 0x0178,
+   0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+   0x00C0, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+   0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x0300, 0x00CD, 0x00CE, 0x00CF,
+   0x0110, 0x00D1, 0x0309, 0x00D3, 0x00D4, 0x01A0, 0x00D6, 0x00D7,
+   0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x01AF, 0x0303, 0x00DF,
+   0x00E0, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+   0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x0301, 0x00ED, 0x00EE, 0x00EF,
+   0x0111, 0x00F1, 0x0323, 0x00F3, 0x00F4, 0x01A1, 0x00F6, 0x00F7,
+   0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x01B0, 0x20AB, 0x00FF
+};
+
+// 20866  KOI8-R Russian
+static constexpr unsigned short CodePage20866[128] =
+{
+   0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524,
+   0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+   0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248,
+   0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+   0x2550, 0x2551, 0x2552, 0x0451, 0x2553, 0x2554, 0x2555, 0x2556,
+   0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x255C, 0x255D, 0x255E,
+   0x255F, 0x2560, 0x2561, 0x0401, 0x2562, 0x2563, 0x2564, 0x2565,
+   0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x256B, 0x256C, 0x00A9,
+   0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+   0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+   0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+   0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+   0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+   0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+   0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+   0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A
+};
+
+// 21866  KOI8-U Ukrainian
+static constexpr unsigned short CodePage21866[128] =
+{
+   0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524,
+   0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+   0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248,
+   0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+   0x2550, 0x2551, 0x2552, 0x0451, 0x0454, 0x2554, 0x0456, 0x0457,
+   0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x0491, 0x255D, 0x255E,
+   0x255F, 0x2560, 0x2561, 0x0401, 0x0404, 0x2563, 0x0406, 0x0407,
+   0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x0490, 0x256C, 0x00A9,
+   0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+   0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+   0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+   0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+   0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+   0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+   0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+   0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A
+};
+
+// 28591  ISO 8859-1 Latin 1
+static constexpr unsigned short CodePage28591[128] =
+{
+   0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+   0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+   0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+   0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+   0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+   0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+   0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+   0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+   0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+   0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+   0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+   0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+   0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+   0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+   0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+};
+
+// 28592  ISO 8859-2 Latin 2
+static constexpr unsigned short CodePage28592[128] =
+{
+   0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+   0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+   0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+   0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+   0x00A0, 0x0104, 0x02D8, 0x0141, 0x00A4, 0x013D, 0x015A, 0x00A7,
+   0x00A8, 0x0160, 0x015E, 0x0164, 0x0179, 0x00AD, 0x017D, 0x017B,
+   0x00B0, 0x0105, 0x02DB, 0x0142, 0x00B4, 0x013E, 0x015B, 0x02C7,
+   0x00B8, 0x0161, 0x015F, 0x0165, 0x017A, 0x02DD, 0x017E, 0x017C,
+   0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+   0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+   0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+   0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+   0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+   0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+   0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+   0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+};
+
+// 28595  ISO 8859-5 Cyrillic
+static constexpr unsigned short CodePage28595[128] =
+{
+   0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+   0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+   0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+   0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+   0x00A0, 0x0401, 0x0402, 0x0403, 0x0404, 0x0405, 0x0406, 0x0407,
+   0x0408, 0x0409, 0x040A, 0x040B, 0x040C, 0x00AD, 0x040E, 0x040F,
+   0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+   0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+   0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+   0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+   0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+   0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+   0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+   0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+   0x2116, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+   0x0458, 0x0459, 0x045A, 0x045B, 0x045C, 0x00A7, 0x045E, 0x045F
+};
+
+// 28605  ISO 8859-15 Latin 9
+static constexpr unsigned short CodePage28605[128] =
+{
+   0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+   0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+   0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+   0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+   0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AC, 0x00A5, 0x0160, 0x00A7,
+   0x0161, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+   0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x017D, 0x00B5, 0x00B6, 0x00B7,
+   0x017E, 0x00B9, 0x00BA, 0x00BB, 0x0152, 0x0153, 0x0178, 0x00BF,
+   0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+   0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+   0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+   0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+   0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+   0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+   0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+   0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+};
+
+struct TxCodePageMap
+{
+   unsigned short Decode[256];   // Code point of each byte, or NO_CHAR.
+   unsigned short Key[256];      // Code points of the upper half, hashed, or 0 if free.
+   unsigned char  Byte[256];     // Byte for the code point in Key.
+   bool           bEveryByte;    // True if no byte is NO_CHAR.
+};
+
+// Hash table slot for a code point.
+static constexpr unsigned CodePageSlot(unsigned Char)
+{
+   return (Char * 0x9E3779B1u) >> 24;
+}
+
+template <size_t N>
+static constexpr TxCodePageMap MakeCodePageMap(const unsigned short (&High)[N])
+{
+   TxCodePageMap Map = {};
+   Map.bEveryByte = true;
+   for (unsigned b = 0; b < 0x80; b++)
+      Map.Decode[b] = static_cast<unsigned short>(b);
+   for (unsigned b = 0; b < N; b++)
+   {
+      unsigned Char = High[b];
+      Map.Decode[0x80 + b] = static_cast<unsigned short>(Char);
+      if (Char == NO_CHAR)
+      {
+         Map.bEveryByte = false;
+         continue;
+      }
+      unsigned Slot = CodePageSlot(Char);
+      while (Map.Key[Slot] != 0)
+         Slot = (Slot + 1) & 0xFF;
+      Map.Key[Slot] = static_cast<unsigned short>(Char);
+      Map.Byte[Slot] = static_cast<unsigned char>(0x80 + b);
+   }
+   return Map;
+}
+
+struct TxCodePage
+{
+   unsigned             Number;  // Number of the code page, as on Windows.
+   const _TCHAR        *Name;    // Description.
+   TxCodePageMap        Map;     // Tables for decoding and encoding.
+};
+
+// ISO 8859-1 first, as the default.
+static constexpr TxCodePage CodePages[] =
+{
+   { 28591, _T("ISO 8859-1 Latin 1"),          MakeCodePageMap(CodePage28591) },
+   {   437, _T("OEM United States"),           MakeCodePageMap(CodePage437) },
+   {   850, _T("OEM Multilingual Latin 1"),    MakeCodePageMap(CodePage850) },
+   {   852, _T("OEM Latin 2"),                 MakeCodePageMap(CodePage852) },
+   {   866, _T("OEM Russian"),                 MakeCodePageMap(CodePage866) },
+   {   874, _T("Windows Thai"),                MakeCodePageMap(CodePage874) },
+   {  1250, _T("Windows Central European"),    MakeCodePageMap(CodePage1250) },
+   {  1251, _T("Windows Cyrillic"),            MakeCodePageMap(CodePage1251) },
+   {  1252, _T("Windows Western European"),    MakeCodePageMap(CodePage1252) },
+   {  1253, _T("Windows Greek"),               MakeCodePageMap(CodePage1253) },
+   {  1254, _T("Windows Turkish"),             MakeCodePageMap(CodePage1254) },
+   {  1255, _T("Windows Hebrew"),              MakeCodePageMap(CodePage1255) },
+   {  1256, _T("Windows Arabic"),              MakeCodePageMap(CodePage1256) },
+   {  1257, _T("Windows Baltic"),              MakeCodePageMap(CodePage1257) },
+   {  1258, _T("Windows Vietnamese"),          MakeCodePageMap(CodePage1258) },
+   { 20866, _T("KOI8-R Russian"),              MakeCodePageMap(CodePage20866) },
+   { 21866, _T("KOI8-U Ukrainian"),            MakeCodePageMap(CodePage21866) },
+   { 28592, _T("ISO 8859-2 Latin 2"),          MakeCodePageMap(CodePage28592) },
+   { 28595, _T("ISO 8859-5 Cyrillic"),         MakeCodePageMap(CodePage28595) },
+   { 28605, _T("ISO 8859-15 Latin 9"),         MakeCodePageMap(CodePage28605) }
+};
+
+// Code page of ANSI text.
+static const TxCodePage *pCodePage = &CodePages[0];
+
+// Number of characters the ANSI codec found no byte for in
+// the code page, on this thread, not yet counted by the
+// writer.
+static thread_local size_t nUnmappable = 0;
+
+//----------------------------------------------------------
+// Selects the code page for ANSI text.
+// Returns false if the code page is not supported.
+//----------------------------------------------------------
+bool SelectCodePage(unsigned Number)
+{
+   for (size_t k = 0; k < _countof(CodePages); k++)
+   {
+      if (CodePages[k].Number == Number)
+      {
+         pCodePage = &CodePages[k];
+         return true;
+      }
+   }
+   return false;
+}
+
+//----------------------------------------------------------
+// Retrieves the number and the name of the code page of ANSI
+// text.
+//----------------------------------------------------------
+unsigned CodePageNumber(void)
+{
+   return pCodePage->Number;
+}
+
+const _TCHAR * CodePageName(void)
+{
+   return pCodePage->Name;
+}
+
+//----------------------------------------------------------
+// Returns true if every byte is a character in the code
+// page of ANSI text, so that any ANSI text is valid.
+//----------------------------------------------------------
+bool CodePageHasEveryByte(void)
+{
+   return pCodePage->Map.bEveryByte;
+}
+
+template <> struct TxCodec<FMT_ANSI>
+{
+   enum { MAX_BYTES = 1, RUN_BYTES = 1 };
+
+   // A byte with no character in the code page is invalid.
+   static TxDecodeResult Decode(const unsigned char *p, size_t Avail, unsigned & Char, size_t & Used)
+   {
+      if (Avail < 1)
+         return DEC_PARTIAL;
+      Char = pCodePage->Map.Decode[p[0]];
+      Used = 1;
+      return Char == NO_CHAR ? DEC_INVALID : DEC_OK;
+   }
+
+   // Every ANSI byte is a character of its own:  in ISO 8859-1
+   // the same number, otherwise ASCII runs are widened by the
+   // kernel and the bytes between looked up one at a time.
+   static size_t DecodeRun(const unsigned char *p, size_t n, unsigned *pOut)
+   {
+      if (pCodePage == &CodePages[0])
+      {
+         Kernels.WidenBytes(p, n, pOut);
+         return n;
+      }
+      const unsigned short *pDecode = pCodePage->Map.Decode;
+      size_t i = 0;
+      while (i < n)
+      {
+         if (p[i] < 0x80 && i + 1 < n && p[i + 1] < 0x80)
+         {
+            i += Kernels.WidenAscii(p + i, n - i, pOut + i);
+            continue;
+         }
+         unsigned Char = pDecode[p[i]];
+         if (Char == NO_CHAR)
+            break;
+         pOut[i++] = Char;
+      }
+      return i;
+   }
+
+   // A character that is not in the code page is counted in
+   // nUnmappable, and dealt with as /ONERROR says:  it is
+   // left out for ONERROR_SKIP, otherwise replaced by '?'.
+   static size_t Encode(unsigned char *p, unsigned Char)
+   {
+      if (Char < 0x80 || (Char <= 0xFF && pCodePage == &CodePages[0]))
+      {
+         p[0] = static_cast<unsigned char>(Char);
+         return 1;
+      }
+      if (Char < NO_CHAR && pCodePage != &CodePages[0])
+      {
+         const TxCodePageMap &Map = pCodePage->Map;
+         for (unsigned Slot = CodePageSlot(Char); Map.Key[Slot] != 0; Slot = (Slot + 1) & 0xFF)
+         {
+            if (Map.Key[Slot] == Char)
+            {
+               p[0] = Map.Byte[Slot];
+               return 1;
+            }
+         }
+      }
+      nUnmappable++;
+      if (OnError == ONERROR_SKIP)
+         return 0;
+      p[0] = '?';
+      return 1;
+   }
+
+   static size_t EncodeRun(const unsigned *p, size_t n, unsigned char *pOut)
+   {
+      return p[0] < 0x80 ? Kernels.NarrowAscii(p, n, pOut) : 0;
+   }
+
+   static size_t SplitPoint(const unsigned char *, size_t Pos)
+   {
+      return Pos;
+   }
+};
+
+//----------------------------------------------------------
+// UTF-8 decoding automaton (after Bjoern Hoehrmann).  The
+// first 256 entries map each byte to a class; the rest map a
+// state plus a class to the next state.  States are
+// multiples of 12.  UTF8_REJECT is entered on any byte that
+// can't come next in well formed UTF-8, so overlong forms,
+// surrogates, code points above U+10FFFF and stray or missing
+// continuation bytes are all rejected, and is never left.
+//----------------------------------------------------------
+const unsigned UTF8_ACCEPT = 0;
+const unsigned UTF8_REJECT = 12;
+
+static const unsigned char Utf8Dfa[256 + 108] =
+{
+   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+   1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+   7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+   8,8,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
+  10,3,3,3,3,3,3,3,3,3,3,3,3,4,3,3,11,6,6,6,5,8,8,8,8,8,8,8,8,8,8,8,
+
+   0,12,24,36,60,96,84,12,12,12,48,72, 12,12,12,12,12,12,12,12,12,12,12,12,
+  12, 0,12,12,12,12,12, 0,12, 0,12,12, 12,24,12,12,12,12,12,24,12,24,12,12,
+  12,12,12,12,12,12,12,24,12,12,12,12, 12,24,12,12,12,12,12,12,12,24,12,12,
+  12,12,12,12,12,12,12,36,12,36,12,12, 12,36,12,12,12,12,12,36,12,36,12,12,
+  12,36,12,12,12,12,12,12,12,12,12,12
+};
+
+// Feeds one byte to the automaton, adding its bits to 'Char'.
+static inline unsigned StepUTF8(unsigned State, unsigned & Char, unsigned char b)
+{
+   unsigned Class = Utf8Dfa[b];
+   Char = State != UTF8_ACCEPT ? (b & 0x3Fu) | (Char << 6) : (0xFFu >> Class) & b;
+   return Utf8Dfa[256 + State + Class];
+}
+
+template <> struct TxCodec<FMT_UTF8>
+{
+   enum { MAX_BYTES = 4, RUN_BYTES = 1 };
+
+   // Malformed input is reported one maximal invalid sequence
+   // at a time, as the Unicode standard recommends:  'Used' is
+   // set to the bytes up to (not including) the one that was
+   // rejected, or to 1 if the first byte was.
+   static TxDecodeResult Decode(const unsigned char *p, size_t Avail, unsigned & Char, size_t & Used)
+   {
+      unsigned State = UTF8_ACCEPT;
+      for (size_t i = 0; i < Avail; i++)
+      {
+         State = StepUTF8(State, Char, p[i]);
+         if (State == UTF8_ACCEPT)
+         {
+            Used = i + 1;
+            return DEC_OK;
+         }
+         if (State == UTF8_REJECT)
+         {
+            Used = __max(i, 1);
+            return DEC_INVALID;
+         }
+      }
+      return DEC_PARTIAL;
+   }
+
+   static size_t DecodeRun(const unsigned char *p, size_t n, unsigned *pOut)
+   {
+      return p[0] < 0x80 ? Kernels.WidenAscii(p, n, pOut) : 0;
+   }
+
+   // The magic numbers below are from the UTF specs.  There is
+   // no UTF-8 for a surrogate or above U+10FFFF, so anything
+   // there is replaced.
+   static size_t Encode(unsigned char *p, unsigned Char)
+   {
+      if ((Char & 0xFFFFF800) == 0xD800)
+         return Encode(p, 0xFFFD);
+      if (Char <= 0x7F)
+      {
+         p[0] = static_cast<unsigned char>(Char);
+         return 1;
+      }
+      else if (Char <= 0x7FF)
+      {
+         p[0] = static_cast<unsigned char>(0xC0 | (Char >> 6));
+         p[1] = static_cast<unsigned char>(0x80 | (Char & 0x3F));
+         return 2;
+      }
+      else if (Char <= 0xFFFF)
+      {
+         p[0] = static_cast<unsigned char>(0xE0 | (Char >> 12));
+         p[1] = static_cast<unsigned char>(0x80 | ((Char >> 6) & 0x3F));
+         p[2] = static_cast<unsigned char>(0x80 | (Char & 0x3F));
+         return 3;
+      }
+      else if (Char <= 0x10FFFF)
+      {
+         p[0] = static_cast<unsigned char>(0xF0 | (Char >> 18));
+         p[1] = static_cast<unsigned char>(0x80 | ((Char >> 12) & 0x3F));
+         p[2] = static_cast<unsigned char>(0x80 | ((Char >> 6) & 0x3F));
+         p[3] = static_cast<unsigned char>(0x80 | (Char & 0x3F));
+         return 4;
+      }
+      return Encode(p, 0xFFFD);
+   }
+
+   static size_t EncodeRun(const unsigned *p, size_t n, unsigned char *pOut)
+   {
+      return p[0] < 0x80 ? Kernels.NarrowAscii(p, n, pOut) : 0;
+   }
+
+   // Back up over continuation bytes to the lead byte.
+   static size_t SplitPoint(const unsigned char *p, size_t Pos)
+   {
+      size_t i = Pos;
+      while (i > 0 && Pos - i < MAX_BYTES && (p[i] & 0xC0) == 0x80)
+         i--;
+      return (p[i] & 0xC0) == 0x80 ? Pos : i;
+   }
+};
+
+template <> struct TxCodec<FMT_UTF16>
+{
+   enum { MAX_BYTES = 4, RUN_BYTES = 2 };
+
+   // A surrogate pair is combined into one character.  A lone
+   // surrogate is invalid.
+   static TxDecodeResult Decode(const unsigned char *p, size_t Avail, unsigned & Char, size_t & Used)
+   {
+      if (Avail < 2)
+         return DEC_PARTIAL;
+      Char = p[0] + static_cast<unsigned short>(p[1]) * 256;
+      Used = 2;
+      if ((Char & 0xF800) != 0xD800)
+         return DEC_OK;
+      if (Char >= 0xDC00)
+         return DEC_INVALID;
+      if (Avail < 4)
+         return DEC_PARTIAL;
+      unsigned Low = p[2] + static_cast<unsigned short>(p[3]) * 256;
+      if ((Low & 0xFC00) != 0xDC00)
+         return DEC_INVALID;
+      Char = 0x10000 + ((Char - 0xD800) << 10) + (Low - 0xDC00);
+      Used = 4;
+      return DEC_OK;
+   }
+
+   // Text with no surrogates is widened a vector at a time.
+   static size_t DecodeRun(const unsigned char *p, size_t n, unsigned *pOut)
+   {
+      return Kernels.WidenUnits16(p, n, pOut);
+   }
+
+   // A surrogate or anything above U+10FFFF is replaced.
+   static size_t Encode(unsigned char *p, unsigned Char)
+   {
+      if ((Char & 0xFFFFF800) == 0xD800)
+         Char = 0xFFFD;
+      if (Char >= 0x10000)
+      {
+         if (Char > 0x10FFFF)
+            Char = 0xFFFD;
+         else
+         {
+            unsigned High = 0xD800 + ((Char - 0x10000) >> 10);
+            unsigned Low = 0xDC00 + ((Char - 0x10000) & 0x3FF);
+            p[0] = static_cast<unsigned char>(High & 0xFF);
+            p[1] = static_cast<unsigned char>(High >> 8);
+            p[2] = static_cast<unsigned char>(Low & 0xFF);
+            p[3] = static_cast<unsigned char>(Low >> 8);
+            return 4;
+         }
+      }
+      p[0] = static_cast<unsigned char>(Char & 0xFF);
+      p[1] = static_cast<unsigned char>((Char >> 8) & 0xFF);
+      return 2;
+   }
+
+   static size_t EncodeRun(const unsigned *p, size_t n, unsigned char *pOut)
+   {
+      return Kernels.NarrowBmp16(p, n, pOut);
+   }
+
+   // Split between whole units, and not after a high surrogate.
+   static size_t SplitPoint(const unsigned char *p, size_t Pos)
+   {
+      Pos &= ~static_cast<size_t>(1);
+      if (Pos >= 2 && (p[Pos - 1] & 0xFC) == 0xD8)
+         Pos -= 2;
+      return Pos;
+   }
+};
+
+template <> struct TxCodec<FMT_UTF16BE>
+{
+   enum { MAX_BYTES = 4, RUN_BYTES = 2 };
+
+   static TxDecodeResult Decode(const unsigned char *p, size_t Avail, unsigned & Char, size_t & Used)
+   {
+      if (Avail < 2)
+         return DEC_PARTIAL;
+      Char = p[0] * 256 + static_cast<unsigned short>(p[1]);
+      Used = 2;
+      if ((Char & 0xF800) != 0xD800)
+         return DEC_OK;
+      if (Char >= 0xDC00)
+         return DEC_INVALID;
+      if (Avail < 4)
+         return DEC_PARTIAL;
+      unsigned Low = p[2] * 256 + static_cast<unsigned short>(p[3]);
+      if ((Low & 0xFC00) != 0xDC00)
+         return DEC_INVALID;
+      Char = 0x10000 + ((Char - 0xD800) << 10) + (Low - 0xDC00);
+      Used = 4;
+      return DEC_OK;
+   }
+
+   static size_t DecodeRun(const unsigned char *p, size_t n, unsigned *pOut)
+   {
+      return Kernels.WidenUnits16BE(p, n, pOut);
+   }
+
+   static size_t Encode(unsigned char *p, unsigned Char)
+   {
+      if ((Char & 0xFFFFF800) == 0xD800)
+         Char = 0xFFFD;
+      if (Char >= 0x10000)
+      {
+         if (Char > 0x10FFFF)
+            Char = 0xFFFD;
+         else
+         {
+            unsigned High = 0xD800 + ((Char - 0x10000) >> 10);
+            unsigned Low = 0xDC00 + ((Char - 0x10000) & 0x3FF);
+            p[0] = static_cast<unsigned char>(High >> 8);
+            p[1] = static_cast<unsigned char>(High & 0xFF);
+            p[2] = static_cast<unsigned char>(Low >> 8);
+            p[3] = static_cast<unsigned char>(Low & 0xFF);
+            return 4;
+         }
+      }
+      p[0] = static_cast<unsigned char>((Char >> 8) & 0xFF);
+      p[1] = static_cast<unsigned char>(Char & 0xFF);
+      return 2;
+   }
+
+   static size_t EncodeRun(const unsigned *p, size_t n, unsigned char *pOut)
+   {
+      return Kernels.NarrowBmp16BE(p, n, pOut);
+   }
+
+   // Split between whole units, and not after a high surrogate.
+   static size_t SplitPoint(const unsigned char *p, size_t Pos)
+   {
+      Pos &= ~static_cast<size_t>(1);
+      if (Pos >= 2 && (p[Pos - 2] & 0xFC) == 0xD8)
+         Pos -= 2;
+      return Pos;
+   }
+};
+
+template <> struct TxCodec<FMT_UTF32>
+{
+   enum { MAX_BYTES = 4, RUN_BYTES = 4 };
+
+   // There is no character above U+10FFFF, and a surrogate is
+   // not a character in UTF-32, not even one of a pair.
+   static TxDecodeResult Decode(const unsigned char *p, size_t Avail, unsigned & Char, size_t & Used)
+   {
+      if (Avail < 4)
+         return DEC_PARTIAL;
+      Char = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned>(p[3]) << 24);
+      Used = 4;
+      return IsChar32(Char) ? DEC_OK : DEC_INVALID;
+   }
+
+   static size_t DecodeRun(const unsigned char *p, size_t n, unsigned *pOut)
+   {
+      return Kernels.WidenUnits32(p, n, pOut);
+   }
+
+   static size_t Encode(unsigned char *p, unsigned Char)
+   {
+      if (!IsChar32(Char))
+         Char = 0xFFFD;
+      p[0] = static_cast<unsigned char>(Char & 0xFF);
+      p[1] = static_cast<unsigned char>((Char >> 8) & 0xFF);
+      p[2] = static_cast<unsigned char>(Char >> 16);
+      p[3] = 0;
+      return 4;
+   }
+
+   static size_t EncodeRun(const unsigned *p, size_t n, unsigned char *pOut)
+   {
+      return Kernels.NarrowUnits32(p, n, pOut);
+   }
+
+   // Split between whole units.
+   static size_t SplitPoint(const unsigned char *, size_t Pos)
+   {
+      return Pos & ~static_cast<size_t>(3);
+   }
+};
+
+template <> struct TxCodec<FMT_UTF32BE>
+{
+   enum { MAX_BYTES = 4, RUN_BYTES = 4 };
+
+   static TxDecodeResult Decode(const unsigned char *p, size_t Avail, unsigned & Char, size_t & Used)
+   {
+      if (Avail < 4)
+         return DEC_PARTIAL;
+      Char = (static_cast<unsigned>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+      Used = 4;
+      return IsChar32(Char) ? DEC_OK : DEC_INVALID;
+   }
+
+   static size_t DecodeRun(const unsigned char *p, size_t n, unsigned *pOut)
+   {
+      return Kernels.WidenUnits32BE(p, n, pOut);
+   }
+
+   static size_t Encode(unsigned char *p, unsigned Char)
+   {
+      if (!IsChar32(Char))
+         Char = 0xFFFD;
+      p[0] = 0;
+      p[1] = static_cast<unsigned char>(Char >> 16);
+      p[2] = static_cast<unsigned char>((Char >> 8) & 0xFF);
+      p[3] = static_cast<unsigned char>(Char & 0xFF);
+      return 4;
+   }
+
+   static size_t EncodeRun(const unsigned *p, size_t n, unsigned char *pOut)
+   {
+      return Kernels.NarrowUnits32BE(p, n, pOut);
+   }
+
+   static size_t SplitPoint(const unsigned char *, size_t Pos)
+   {
+      return Pos & ~static_cast<size_t>(3);
+   }
+};
+
+//----------------------------------------------------------
+// Decodes as many whole characters as will fit in 'pOut'
+// from the given buffer.  Stops early at a character that
+// is split off by the end of the buffer.  Invalid input is
+// dealt with as /ONERROR says:  with ONERROR_STOP decoding
+// stops there and 'bInvalid' is set; otherwise each invalid
+// sequence is replaced by U+FFFD or skipped, and counted in
+// 'nBad'.
+// Returns the number of characters decoded, and sets 'Used'
+// to the number of bytes they occupied.
+//----------------------------------------------------------
+template <TxEncoding InFmt>
+static size_t DecodeBlock(
+   const unsigned char *pIn,  // Bytes to be decoded.
+   size_t InLen,              // Number of bytes at pIn.
+   unsigned *pOut,            // Receives the decoded characters.
+   size_t OutCap,             // Capacity of pOut, in characters.
+   size_t & Used,             // Receives number of bytes decoded.
+   bool & bInvalid,           // Set to true if decoding stopped at invalid input.
+   size_t & nBad              // Incremented for each invalid sequence passed over.
+   )
+{
+   typedef TxCodec<InFmt> Codec;
+   size_t nOut = 0;
+   size_t Pos = 0;
+   bInvalid = false;
+   while (nOut < OutCap && Pos < InLen)
+   {
+      // Take runs the codec has a fast path for in bulk.
+      size_t n = Codec::DecodeRun(pIn + Pos, __min((InLen - Pos) / Codec::RUN_BYTES, OutCap - nOut), pOut + nOut);
+      Pos += n * Codec::RUN_BYTES;
+      nOut += n;
+      if (nOut == OutCap || Pos == InLen)
+         break;
+
+      TxDecodeResult r = Codec::Decode(pIn + Pos, InLen - Pos, pOut[nOut], n);
+      if (r == DEC_PARTIAL)
+         break;
+      if (r == DEC_INVALID)
+      {
+         if (OnError == ONERROR_STOP)
+         {
+            bInvalid = true;
+            break;
+         }
+         Pos += n;
+         nBad++;
+         if (OnError == ONERROR_REPLACE)
+            pOut[nOut++] = 0xFFFD;
+         continue;
+      }
+      Pos += n;
+      nOut++;
+   }
+   Used = Pos;
+   return nOut;
+}
+
+//----------------------------------------------------------
+// Encodes a run of characters into the given buffer, which
+// must have room for TxCodec<OutFmt>::MAX_BYTES bytes per
+// character.
+// Returns the number of bytes placed in the buffer.
+//----------------------------------------------------------
+template <TxEncoding OutFmt>
+static size_t EncodeBlock(
+   const unsigned *pIn,       // Characters to be encoded.
+   size_t InLen,              // Number of characters at pIn.
+   unsigned char *pOut        // Receives the encoded bytes.
+   )
+{
+   typedef TxCodec<OutFmt> Codec;
+   unsigned char *p = pOut;
+   size_t i = 0;
+   while (i < InLen)
+   {
+      // Take runs the codec has a fast path for in bulk.
+      size_t n = Codec::EncodeRun(pIn + i, InLen - i, p);
+      p += n * Codec::RUN_BYTES;
+      i += n;
+      if (i == InLen)
+         break;
+
+      p += Codec::Encode(p, pIn[i]);
+      i++;
+   }
+   return p - pOut;
+}
+
+//----------------------------------------------------------
+// Changes the line endings in a run of characters to the one
+// chosen with /EOL, in the same pass as the conversion, so
+// that they can then be encoded in bulk by EncodeBlock.  A
+// CR, CR LF or LF becomes the new line ending.  'bAfterCR'
+// says whether the character before pIn[0] was a CR, so that
+// a CR LF split between two runs is still one line ending,
+// and is updated for the next run.
+//
+// For LF or CR, a run without the other character is
+// returned as it is.  Otherwise the new text is made in
+// 'Buf', and 'n' is set to its length.  The text between
+// line endings is found with the CountToChar kernel and
+// copied whole; each line ending is put in without branches.
+// Returns the run with the new line endings.
+//----------------------------------------------------------
+static const unsigned * NormalizeEol(
+   const unsigned *pIn,       // Characters to be changed.
+   size_t & n,                // Number of characters at pIn.
+   std::vector<unsigned> &Buf, // Receives the changed run, if needed.
+   bool & bAfterCR            // True if the last character was a CR.
+   )
+{
+   if (n == 0)
+      return pIn;
+   bool bSplitCRLF = bAfterCR && pIn[0] == '\n';
+   bAfterCR = pIn[n - 1] == '\r';
+   if (Eol != EOL_CRLF && !bSplitCRLF)
+   {
+      unsigned Other = Eol == EOL_LF ? '\r' : '\n';
+      if (Kernels.CountToChar(pIn, n, Other, Other) == n)
+         return pIn;
+   }
+
+   // Each line ending is written as the new one, and the
+   // output moved past it unless it is the LF of a CR LF.
+   Buf.resize(2 * n + 1);
+   unsigned *pOut = &Buf[0];
+   unsigned First = Eol == EOL_LF ? '\n' : '\r';
+   size_t Len = Eol == EOL_CRLF ? 2 : 1;
+   size_t i = bSplitCRLF ? 1 : 0;
+   size_t j = 0;
+   for (;;)
+   {
+      size_t Text = Kernels.CountToChar(pIn + i, n - i, '\r', '\n');
+      memcpy(pOut + j, pIn + i, Text * sizeof(unsigned));
+      i += Text;
+      j += Text;
+      if (i == n)
+         break;
+
+      size_t Drop = pIn[i] == '\n' && i > 0 && pIn[i - 1] == '\r';
+      pOut[j] = First;
+      pOut[j + 1] = '\n';
+      j += Len & (Drop - 1);
+      i++;
+   }
+   n = j;
+   return pOut;
+}
+
+//----------------------------------------------------------
+// Counts the line feeds in a run of UTF-32 or UTF-32BE units.
+//----------------------------------------------------------
+static size_t CountLines32(const unsigned char *p, size_t n, TxEncoding Fmt)
+{
+   size_t Count = 0;
+   for (size_t i = 0; i + 4 <= n; i += 4)
+   {
+      unsigned Unit = (Fmt == FMT_UTF32) ?
+         p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) | (static_cast<unsigned>(p[i + 3]) << 24) :
+         (static_cast<unsigned>(p[i]) << 24) | (p[i + 1] << 16) | (p[i + 2] << 8) | p[i + 3];
+      Count += Unit == '\n' ? 1 : 0;
+   }
+   return Count;
+}
+
+//----------------------------------------------------------
+// Returns how many of the 'n' UTF-32 or UTF-32BE units at 'p'
+// at the start are characters, that is have a zero top byte
+// and no more than 0x10 in the next, and are not surrogates
+// (D800 to DFFF).
+// Blocks of units are checked with no branches per unit.
+//----------------------------------------------------------
+static size_t ValidUnits32(const unsigned char *p, size_t n, TxEncoding Fmt)
+{
+   const size_t BLOCK = 64;
+   size_t Top = (Fmt == FMT_UTF32) ? 3 : 0;
+   size_t Plane = (Fmt == FMT_UTF32) ? 2 : 1;
+   size_t High = (Fmt == FMT_UTF32) ? 1 : 2;
+   size_t i = 0;
+   for (; i + BLOCK <= n; i += BLOCK)
+   {
+      unsigned Bad = 0;
+      for (size_t k = i; k < i + BLOCK; k++)
+      {
+         const unsigned char *u = p + k * 4;
+         Bad |= u[Top] | (u[Plane] > 0x10 ? 1u : 0u) | (u[Plane] == 0 && (u[High] & 0xF8) == 0xD8 ? 1u : 0u);
+      }
+      if (Bad != 0)
+         break;
+   }
+   while (i < n && p[i * 4 + Top] == 0 && p[i * 4 + Plane] <= 0x10 &&
+          (p[i * 4 + Plane] != 0 || (p[i * 4 + High] & 0xF8) != 0xD8))
+      i++;
+   return i;
+}
+
+//----------------------------------------------------------
+// Returns how many of the 'n' UTF-16 or UTF-16BE units at 'p'
+// at the start are well formed, that is have each high
+// surrogate followed by a low one and no other surrogates,
+// and adds the number of characters in them to 'nChars'.  A
+// high surrogate in the last unit is left out, as its low
+// one may be in the next input.
+// Runs with no surrogates are found by the kernel.
+//----------------------------------------------------------
+template <TxEncoding Fmt>
+static size_t ValidUnits16(const unsigned char *p, size_t n, size_t &nChars)
+{
+   const size_t High = (Fmt == FMT_UTF16) ? 1 : 0;
+   size_t i = 0, nPairs = 0;
+   for (;;)
+   {
+      i += (Fmt == FMT_UTF16) ? Kernels.CountBmp16(p + i * 2, n - i) : Kernels.CountBmp16BE(p + i * 2, n - i);
+      if (i + 1 >= n || (p[i * 2 + High] & 0xFC) != 0xD8 || (p[i * 2 + 2 + High] & 0xFC) != 0xDC)
+         break;
+      i += 2;
+      nPairs++;
+   }
+   nChars += i - nPairs;
+   return i;
+}
+
+//----------------------------------------------------------
+// Returns the length of the well formed UTF-8 character at
+// 'p', 0 if the bytes there are not a well formed character,
+// or -1 if the character runs past the 'Avail' bytes given.
+// Overlong forms, surrogates and code points above U+10FFFF
+// are not well formed.
+//----------------------------------------------------------
+static int CheckUTF8(const unsigned char *p, size_t Avail)
+{
+   unsigned State = UTF8_ACCEPT;
+   unsigned Char = 0;
+   for (size_t i = 0; i < Avail && i < 4; i++)
+   {
+      State = StepUTF8(State, Char, p[i]);
+      if (State == UTF8_ACCEPT)
+         return static_cast<int>(i + 1);
+      if (State == UTF8_REJECT)
+         return 0;
+   }
+   return -1;
+}
+
+//----------------------------------------------------------
+// Returns the length of the longest run of well formed UTF-8
+// characters at the start of the 'n' bytes at 'p', and adds
+// the number of characters in it to 'nChars'.
+// ASCII is skipped with the CountAscii kernel.  Anything
+// else is run through the automaton a block at a time with
+// no branches per byte:  the end of the last whole character
+// and the count of lead bytes are kept with conditional
+// moves, and since UTF8_REJECT is never left it is only
+// looked for at the end of each block.
+//----------------------------------------------------------
+static size_t ValidPrefixUTF8(const unsigned char *p, size_t n, size_t &nChars)
+{
+   const size_t BLOCK = 64;
+   size_t i = 0;
+   for (;;)
+   {
+      size_t a = Kernels.CountAscii(p + i, n - i);
+      nChars += a;
+      i += a;
+      if (i >= n)
+         return i;
+
+      unsigned State = UTF8_ACCEPT;
+      size_t Good = i;        // End of the last whole character.
+      size_t nLeads = 0;      // Characters up to Good.
+      size_t nSeen = 0;       // Bytes that didn't continue a character.
+      while (i < n)
+      {
+         size_t End = __min(n, i + BLOCK);
+         for (; i < End; i++)
+         {
+            unsigned Class = Utf8Dfa[p[i]];
+            nSeen += Class != 1 && Class != 7 && Class != 9 ? 1 : 0;  // Not 10xxxxxx.
+            State = Utf8Dfa[256 + State + Class];
+            bool bWhole = State == UTF8_ACCEPT;
+            Good = bWhole ? i + 1 : Good;
+            nLeads = bWhole ? nSeen : nLeads;
+         }
+         if (State == UTF8_REJECT)
+            break;
+
+         // Hand long runs of ASCII back to the kernel.
+         if (State == UTF8_ACCEPT && i < n && p[i] < 0x80)
+            break;
+      }
+      nChars += nLeads;
+      if (State != UTF8_ACCEPT)
+         return Good;
+   }
+}
+
+//----------------------------------------------------------
+// Passthrough.  Where the input bytes of a character are
+// also its output bytes, they are copied in bulk instead of
+// being decoded and encoded again:  when the input and the
+// output encodings are the same, and for ASCII between ANSI
+// and UTF-8.  TxCopy<InFmt, OutFmt>::Prefix() returns how
+// many of the 'n' bytes at 'p' can be copied that way, and
+// adds the number of characters in them to 'nChars'.
+//
+// UTF-8 and UTF-16 are copied only as far as they are well
+// formed, UTF-32 as far as each unit is a character, and
+// ANSI as far as each byte is in the code page, so that
+// anything else still goes through the decoder and the
+// output is the same as from ConvertStream.
+//----------------------------------------------------------
+template <TxEncoding InFmt, TxEncoding OutFmt> struct TxCopy
+{
+   enum { ENABLED = false };
+
+   static size_t Prefix(const unsigned char *, size_t, size_t &)
+   {
+      return 0;
+   }
+};
+
+// ANSI in and out is copied whole if the code page has a
+// character for every byte.
+template <> struct TxCopy<FMT_ANSI, FMT_ANSI>
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars)
+   {
+      size_t i = n;
+      if (!pCodePage->Map.bEveryByte)
+      {
+         const unsigned short *pDecode = pCodePage->Map.Decode;
+         i = 0;
+         while (i < n)
+         {
+            i += Kernels.CountAscii(p + i, n - i);
+            while (i < n && p[i] >= 0x80 && pDecode[p[i]] != NO_CHAR)
+               i++;
+            if (i < n && p[i] >= 0x80)
+               break;
+         }
+      }
+      nChars += i;
+      return i;
+   }
+};
+
+template <> struct TxCopy<FMT_UTF8, FMT_UTF8>
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars)
+   {
+      return ValidPrefixUTF8(p, n, nChars);
+   }
+};
+
+template <TxEncoding Fmt> struct TxCopyUTF16
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars)
+   {
+      return ValidUnits16<Fmt>(p, n / 2, nChars) * 2;
+   }
+};
+
+template <> struct TxCopy<FMT_UTF16, FMT_UTF16> : TxCopyUTF16<FMT_UTF16>
+{
+};
+
+template <> struct TxCopy<FMT_UTF16BE, FMT_UTF16BE> : TxCopyUTF16<FMT_UTF16BE>
+{
+};
+
+template <TxEncoding Fmt> struct TxCopyUTF32
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars)
+   {
+      size_t Units = ValidUnits32(p, n / 4, Fmt);
+      nChars += Units;
+      return Units * 4;
+   }
+};
+
+template <> struct TxCopy<FMT_UTF32, FMT_UTF32> : TxCopyUTF32<FMT_UTF32>
+{
+};
+
+template <> struct TxCopy<FMT_UTF32BE, FMT_UTF32BE> : TxCopyUTF32<FMT_UTF32BE>
+{
+};
+
+template <> struct TxCopy<FMT_ANSI, FMT_UTF8>
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars)
+   {
+      size_t a = Kernels.CountAscii(p, n);
+      nChars += a;
+      return a;
+   }
+};
+
+template <> struct TxCopy<FMT_UTF8, FMT_ANSI> : TxCopy<FMT_ANSI, FMT_UTF8>
+{
+};
+
+//----------------------------------------------------------
+// Counting.  For some pairs of encodings the size of the
+// output can be worked out from valid input without
+// converting it, which is how TxMeasure() sizes it.
+// TxCount<InFmt, OutFmt>::Prefix() returns how many of the
+// 'n' bytes at 'p' it could size that way, adds the number
+// of characters in them to 'nChars' and the number of bytes
+// they would take in the output to 'nBytes'.  It stops at
+// anything it can't be sure of, which is then measured by
+// converting it.  None of this applies when line endings
+// are changed.
+//----------------------------------------------------------
+template <TxEncoding InFmt, TxEncoding OutFmt> struct TxCount
+{
+   enum { ENABLED = false };
+
+   static size_t Prefix(const unsigned char *, size_t, size_t &, unsigned long long &)
+   {
+      return 0;
+   }
+};
+
+// UTF-8 to UTF-16:  two bytes each character, and two more
+// for each one outside the BMP, which is each one with a four
+// byte sequence.  The characters are counted as the UTF-8 is
+// checked, so only the lead bytes of four are counted here.
+template <> struct TxCount<FMT_UTF8, FMT_UTF16>
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars, unsigned long long &nBytes)
+   {
+      size_t nValid = 0;
+      size_t Good = ValidPrefixUTF8(p, n, nValid);
+      size_t nLong = 0;
+      for (size_t i = 0; i < Good; i++)
+         nLong += p[i] >= 0xF0 ? 1 : 0;
+      nChars += nValid;
+      nBytes += 2 * (nValid + nLong);
+      return Good;
+   }
+};
+
+template <> struct TxCount<FMT_UTF8, FMT_UTF16BE> : TxCount<FMT_UTF8, FMT_UTF16>
+{
+};
+
+// UTF-8 to UTF-32:  four bytes each character.
+template <> struct TxCount<FMT_UTF8, FMT_UTF32>
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars, unsigned long long &nBytes)
+   {
+      size_t nValid = 0;
+      size_t Good = ValidPrefixUTF8(p, n, nValid);
+      nChars += nValid;
+      nBytes += 4 * static_cast<unsigned long long>(nValid);
+      return Good;
+   }
+};
+
+template <> struct TxCount<FMT_UTF8, FMT_UTF32BE> : TxCount<FMT_UTF8, FMT_UTF32>
+{
+};
+
+// UTF-16 to UTF-8:  one to three bytes by the value of each
+// unit, and four for a surrogate pair.  Stops at a surrogate
+// that is not one of a pair.
+template <TxEncoding InFmt> struct TxCountUTF16ToUTF8
+{
+   enum { ENABLED = true };
+
+   static unsigned Unit(const unsigned char *p)
+   {
+      return InFmt == FMT_UTF16 ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+   }
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars, unsigned long long &nBytes)
+   {
+      size_t i = 0;
+      size_t nIn = 0;
+      unsigned long long nOut = 0;
+      while (i + 2 <= n)
+      {
+         unsigned u = Unit(p + i);
+         if ((u & 0xF800) != 0xD800)
+         {
+            nOut += 1 + (u >= 0x80 ? 1 : 0) + (u >= 0x800 ? 1 : 0);
+            i += 2;
+         }
+         else
+         {
+            if (u >= 0xDC00 || i + 4 > n || (Unit(p + i + 2) & 0xFC00) != 0xDC00)
+               break;
+            nOut += 4;
+            i += 4;
+         }
+         nIn++;
+      }
+      nChars += nIn;
+      nBytes += nOut;
+      return i;
+   }
+};
+
+template <> struct TxCount<FMT_UTF16, FMT_UTF8> : TxCountUTF16ToUTF8<FMT_UTF16>
+{
+};
+
+template <> struct TxCount<FMT_UTF16BE, FMT_UTF8> : TxCountUTF16ToUTF8<FMT_UTF16BE>
+{
+};
+
+// ANSI to UTF-8, UTF-16 or UTF-32:  each byte is one character
+// of the code page, whose size is known.  Stops at a byte that
+// is not in the code page.
+template <TxEncoding OutFmt> struct TxCountANSI
+{
+   enum { ENABLED = true, UNIT = TxCodec<OutFmt>::RUN_BYTES };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars, unsigned long long &nBytes)
+   {
+      const unsigned short *pDecode = pCodePage->Map.Decode;
+      size_t i = 0;
+      unsigned long long nOut = 0;
+      if (OutFmt != FMT_UTF8 && pCodePage == &CodePages[0])
+      {
+         // ISO 8859-1 has a character for every byte.
+         i = n;
+         nOut = static_cast<unsigned long long>(UNIT) * n;
+      }
+      for (; i < n; i++)
+      {
+         unsigned Char = pDecode[p[i]];
+         if (Char == NO_CHAR)
+            break;
+         nOut += OutFmt == FMT_UTF8 ? 1 + (Char >= 0x80 ? 1 : 0) + (Char >= 0x800 ? 1 : 0) : UNIT;
+      }
+      nChars += i;
+      nBytes += nOut;
+      return i;
+   }
+};
+
+template <> struct TxCount<FMT_ANSI, FMT_UTF8> : TxCountANSI<FMT_UTF8>
+{
+};
+
+template <> struct TxCount<FMT_ANSI, FMT_UTF16> : TxCountANSI<FMT_UTF16>
+{
+};
+
+template <> struct TxCount<FMT_ANSI, FMT_UTF16BE> : TxCountANSI<FMT_UTF16BE>
+{
+};
+
+template <> struct TxCount<FMT_ANSI, FMT_UTF32> : TxCountANSI<FMT_UTF32>
+{
+};
+
+template <> struct TxCount<FMT_ANSI, FMT_UTF32BE> : TxCountANSI<FMT_UTF32BE>
+{
+};
+
+// Between UTF-16 and UTF-16BE the output is the same size
+// as the input, as far as it is well formed.
+template <TxEncoding InFmt> struct TxCountSwap16
+{
+   enum { ENABLED = true };
+
+   static size_t Prefix(const unsigned char *p, size_t n, size_t &nChars, unsigned long long &nBytes)
+   {
+      size_t Good = ValidUnits16<InFmt>(p, n / 2, nChars) * 2;
+      nBytes += Good;
+      return Good;
+   }
+};
+
+template <> struct TxCount<FMT_UTF16, FMT_UTF16BE> : TxCountSwap16<FMT_UTF16>
+{
+};
+
+template <> struct TxCount<FMT_UTF16BE, FMT_UTF16> : TxCountSwap16<FMT_UTF16BE>
+{
+};
+
+//----------------------------------------------------------
+// Attempts to identify the BOM at the start of the given
+// bytes, which are the first 'bytes' bytes of the file.
+// If successful, sets 'BOMLen' to the number of bytes the
+// BOM occupies, so the caller can start reading at the
+// first character AFTER the BOM.
+//
+// Returns the text encoding indicated by the BOM if found,
+// or FMT_UNKNOWN if not found.
+//----------------------------------------------------------
+TxEncoding CheckBOM(const unsigned char *ch, size_t bytes, size_t &BOMLen)
+{
+   TxEncoding InFmt = FMT_UNKNOWN;
+   BOMLen = 0;
+
+   // Only the first few bytes are examined.
+   if (bytes > 32)
+      bytes = 32;
+
+   // If input mode was not specified, attempt to determine format
+   // from input data.  The magic numbers below are from the UTF specs.
+   // The UTF-32 BOM starts with the UTF-16 one, so is looked for first.
+   if (bytes >= 4 && ch[0] == 0xFF && ch[1] == 0xFE && ch[2] == 0 && ch[3] == 0)
+   {
+      InFmt = FMT_UTF32;
+      BOMLen = 4;
+   }
+   else if (bytes >= 4 && ch[0] == 0 && ch[1] == 0 && ch[2] == 0xFE && ch[3] == 0xFF)
+   {
+      InFmt = FMT_UTF32BE;
+      BOMLen = 4;
+   }
+   else if (bytes >= 2 && ch[0] == 0xFE && ch[1] == 0xFF)
+   {
+      InFmt = FMT_UTF16BE;
+      BOMLen = 2;
+   }
+   else if (bytes >= 2 && ch[0] == 0xFF && ch[1] == 0xFE)
+   {
+      InFmt = FMT_UTF16;
+      BOMLen = 2;
+   }
+   else if (bytes >= 3 && ch[0] == 0xEF && ch[1] == 0xBB && ch[2] == 0xBF)
+   {
+      InFmt = FMT_UTF8;
+      BOMLen = 3;
+   }
+   // else:  no BOM; see DetectEncoding().
+   return InFmt;
+}
+
+//----------------------------------------------------------
+// Checks the first 'bytes' bytes of a file for the magic
+// number of gzip or zstd.
+//
+// Returns how the file is compressed, or COMPRESS_NONE if
+// it is not.
+//----------------------------------------------------------
+TxCompression CheckCompression(const unsigned char *ch, size_t bytes)
+{
+   if (bytes >= 2 && ch[0] == 0x1F && ch[1] == 0x8B)
+      return COMPRESS_GZIP;
+   if (bytes >= 4 && ch[0] == 0x28 && ch[1] == 0xB5 && ch[2] == 0x2F && ch[3] == 0xFD)
+      return COMPRESS_ZSTD;
+   return COMPRESS_NONE;
+}
+
+//----------------------------------------------------------
+// Statistical encoding detection, for files with no BOM.
+// A bounded window is examined no matter how large the file
+// is:  the first DETECT_HEAD bytes, plus DETECT_SAMPLES
+// samples of DETECT_SAMPLE bytes spread evenly through the
+// rest of the file.
+//
+// UTF-32 is recognized by its units, nearly all of which are
+// no higher than U+10FFFF one way round and not the other.
+// UTF-16 is recognized by zero bytes, which the ASCII
+// characters of almost any text put at every other offset:
+// the odd offsets for UTF-16 and the even ones for UTF-16BE.
+// Otherwise the samples are validated as UTF-8, skipping
+// runs of ASCII with the SIMD kernels.  Text that is not
+// valid UTF-8 is taken to be ANSI, unless the bytes at even
+// offsets are spread differently from those at odd ones,
+// which in 8-bit text they are not, but in UTF-16 with no
+// ASCII, such as Chinese, they are:  the top bytes of its
+// units fall in the few ranges of its script.
+//----------------------------------------------------------
+// Tallies kept by DetectEncoding().
+struct TxDetectCounts
+{
+   size_t nBytes;       // Number of bytes examined.
+   size_t nZeroEven;    // Zero bytes at even file offsets.
+   size_t nZeroOdd;     // Zero bytes at odd file offsets.
+   size_t nControl;     // Control characters not found in text.
+   size_t nMulti;       // Valid UTF-8 multibyte sequences.
+   size_t nInvalid;     // Invalid UTF-8 sequences.
+   size_t nLetters16;   // UTF-16 units in common scripts.
+   size_t nLetters16BE; // UTF-16BE units in common scripts.
+   size_t nUnits32;     // UTF-32 units no higher than U+10FFFF.
+   size_t nUnits32BE;   // UTF-32BE units no higher than U+10FFFF.
+   size_t nEven[256];   // Each byte value at even file offsets.
+   size_t nOdd[256];    // Each byte value at odd file offsets.
+};
+
+//----------------------------------------------------------
+// Returns true if the given UTF-16 unit is in one of the
+// ranges that most text without ASCII is written in, or is
+// a surrogate.
+//----------------------------------------------------------
+static bool IsCommonUnit16(unsigned Unit)
+{
+   unsigned High = Unit >> 8;
+   return High <= 0x05 ||                    // Latin, Greek, Cyrillic, Hebrew
+          (High >= 0x30 && High <= 0x31) ||  // CJK punctuation, kana
+          (High >= 0x4E && High <= 0x9F) ||  // CJK ideographs
+          (High >= 0xAC && High <= 0xDF) ||  // Hangul, surrogates
+          High == 0xFF;                      // Fullwidth forms
+}
+
+//----------------------------------------------------------
+// Adds the bytes of one sample, which starts at a file offset
+// that is a multiple of four, to the tallies.  'bMidFile' is set for a sample
+// that may start in the middle of a character.
+//----------------------------------------------------------
+static void ScanSample(const unsigned char *p, size_t n, bool bMidFile, TxDetectCounts &Counts)
+{
+   Counts.nBytes += n;
+   for (size_t i = 0; i < n; i++)
+   {
+      unsigned char b = p[i];
+      if (i & 1)
+         Counts.nOdd[b]++;
+      else
+         Counts.nEven[b]++;
+      if (b == 0)
+      {
+         if (i & 1)
+            Counts.nZeroOdd++;
+         else
+            Counts.nZeroEven++;
+      }
+      else if (b < 0x20 && b != '\t' && b != '\n' && b != '\r' && b != '\f' && b != 0x1A && b != 0x1B)
+         Counts.nControl++;
+   }
+   for (size_t i = 0; i + 2 <= n; i += 2)
+   {
+      if (IsCommonUnit16(p[i] + p[i + 1] * 256))
+         Counts.nLetters16++;
+      if (IsCommonUnit16(p[i] * 256 + p[i + 1]))
+         Counts.nLetters16BE++;
+   }
+   for (size_t i = 0; i + 4 <= n; i += 4)
+   {
+      Counts.nUnits32 += p[i + 3] == 0 && p[i + 2] <= 0x10 ? 1 : 0;
+      Counts.nUnits32BE += p[i] == 0 && p[i + 1] <= 0x10 ? 1 : 0;
+   }
+
+   // Validate as UTF-8, skipping any continuation bytes of a
+   // character cut by the start of the sample.
+   size_t i = 0;
+   if (bMidFile)
+   {
+      while (i < n && i < 3 && (p[i] & 0xC0) == 0x80)
+         i++;
+   }
+   for (;;)
+   {
+      i += Kernels.CountAscii(p + i, n - i);
+      if (i >= n)
+         break;
+
+      // A character cut by the end of the sample is not counted.
+      int Len = CheckUTF8(p + i, n - i);
+      if (Len < 0)
+         break;
+      if (Len > 0)
+      {
+         Counts.nMulti++;
+         i += Len;
+      }
+      else
+      {
+         Counts.nInvalid++;
+         i++;
+      }
+   }
+}
+
+//----------------------------------------------------------
+// Returns how differently the byte values are spread at even
+// and at odd offsets, from 0 for the same to 1 for no value
+// in common.  This is the total variation distance of the
+// two distributions.
+//----------------------------------------------------------
+static double ParitySpread(const TxDetectCounts &Counts)
+{
+   size_t nEven = 0, nOdd = 0;
+   for (size_t b = 0; b < 256; b++)
+   {
+      nEven += Counts.nEven[b];
+      nOdd += Counts.nOdd[b];
+   }
+   if (nEven == 0 || nOdd == 0)
+      return 0.0;
+   double Sum = 0.0;
+   for (size_t b = 0; b < 256; b++)
+   {
+      double Diff = static_cast<double>(Counts.nEven[b]) / nEven - static_cast<double>(Counts.nOdd[b]) / nOdd;
+      Sum += Diff < 0 ? -Diff : Diff;
+   }
+   return Sum / 2;
+}
+
+//----------------------------------------------------------
+// Works out the encoding of text with no BOM from the
+// samples gathered by ReadSamples().  'Confidence' receives
+// a score from 0 to 100 for the answer.
+//
+// Returns the most likely encoding, or FMT_UNKNOWN if the
+// samples do not look like text.
+//----------------------------------------------------------
+TxEncoding DetectEncoding(
+   const std::vector<unsigned char> &Sample,
+   const std::vector<size_t> &Starts,
+   int &Confidence
+   )
+{
+   TxDetectCounts Counts;
+   memset(&Counts, 0, sizeof(Counts));
+   for (size_t k = 0; k < Starts.size(); k++)
+   {
+      size_t End = k + 1 < Starts.size() ? Starts[k + 1] : Sample.size();
+      if (End > Starts[k])
+         ScanSample(&Sample[Starts[k]], End - Starts[k], k > 0, Counts);
+   }
+
+   Confidence = 0;
+   size_t Units = Counts.nBytes / 2;
+   size_t nZero = Counts.nZeroEven + Counts.nZeroOdd;
+   if (Counts.nBytes == 0)
+      return FMT_UNKNOWN;
+
+   // UTF-32:  nearly every unit a character in one byte order,
+   // and more of them than in the other.  The ASCII of UTF-16
+   // has a letter where the top byte of a unit would be zero.
+   size_t Units32 = Counts.nBytes / 4;
+   if (Counts.nUnits32 * 16 >= Units32 * 15 && Counts.nUnits32 > Counts.nUnits32BE)
+   {
+      Confidence = static_cast<int>(100 * (Counts.nUnits32 - Counts.nUnits32BE) / Units32);
+      return FMT_UTF32;
+   }
+   if (Counts.nUnits32BE * 16 >= Units32 * 15 && Counts.nUnits32BE > Counts.nUnits32)
+   {
+      Confidence = static_cast<int>(100 * (Counts.nUnits32BE - Counts.nUnits32) / Units32);
+      return FMT_UTF32BE;
+   }
+
+   // UTF-16:  zero bytes at nearly all odd, or nearly all even,
+   // offsets, and no fewer units in the common scripts that way
+   // round than the other.  Chinese in UTF-16 has zero bytes
+   // too, the low bytes of characters such as U+4E00, but at
+   // the offsets ASCII would have them in the other byte order.
+   if (Counts.nZeroOdd > 0 && Counts.nZeroOdd >= Units / 16 && Counts.nZeroOdd > 8 * Counts.nZeroEven &&
+       Counts.nLetters16 >= Counts.nLetters16BE)
+   {
+      Confidence = static_cast<int>(100 * (Counts.nZeroOdd - Counts.nZeroEven) / nZero);
+      return FMT_UTF16;
+   }
+   if (Counts.nZeroEven > 0 && Counts.nZeroEven >= Units / 16 && Counts.nZeroEven > 8 * Counts.nZeroOdd &&
+       Counts.nLetters16BE >= Counts.nLetters16)
+   {
+      Confidence = static_cast<int>(100 * (Counts.nZeroEven - Counts.nZeroOdd) / nZero);
+      return FMT_UTF16BE;
+   }
+
+   // Zero bytes or control characters anywhere else mean this
+   // is not 8-bit text.  It may still be UTF-16 with little or
+   // no ASCII in it, such as Chinese or Korean, if nearly all
+   // the units are in the common scripts.
+   if ((nZero + Counts.nControl) * 100 > Counts.nBytes)
+   {
+      if (Counts.nLetters16 * 10 >= Units * 9 && Counts.nLetters16 > Counts.nLetters16BE)
+      {
+         Confidence = static_cast<int>(70 * Counts.nLetters16 / Units);
+         return FMT_UTF16;
+      }
+      if (Counts.nLetters16BE * 10 >= Units * 9)
+      {
+         Confidence = static_cast<int>(70 * Counts.nLetters16BE / Units);
+         return FMT_UTF16BE;
+      }
+      return FMT_UNKNOWN;
+   }
+
+   // Plain ASCII reads the same as ANSI or as UTF-8.
+   size_t nNonAscii = Counts.nMulti + Counts.nInvalid;
+   if (nNonAscii == 0)
+   {
+      Confidence = 100;
+      return FMT_ANSI;
+   }
+
+   // UTF-8, allowing for the odd damaged character.
+   if (Counts.nInvalid == 0)
+   {
+      Confidence = static_cast<int>(__min(99, 90 + Counts.nMulti));
+      return FMT_UTF8;
+   }
+   if (Counts.nInvalid * 16 < Counts.nMulti)
+   {
+      Confidence = static_cast<int>(80 * Counts.nMulti / nNonAscii);
+      return FMT_UTF8;
+   }
+
+   // UTF-16 with no ASCII and so no zero bytes, if the bytes
+   // at even and odd offsets are spread very differently, as
+   // long as there are enough of them to tell.  Nearly all the
+   // units must then be in the common scripts one way round,
+   // or it can't be told which.
+   double Spread = ParitySpread(Counts);
+   if (Spread >= 0.5 && Counts.nBytes >= 256)
+   {
+      if (Counts.nLetters16 * 10 >= Units * 9 && Counts.nLetters16 > Counts.nLetters16BE)
+      {
+         Confidence = static_cast<int>(70 * Spread * Counts.nLetters16 / Units);
+         return FMT_UTF16;
+      }
+      if (Counts.nLetters16BE * 10 >= Units * 9 && Counts.nLetters16BE > Counts.nLetters16)
+      {
+         Confidence = static_cast<int>(70 * Spread * Counts.nLetters16BE / Units);
+         return FMT_UTF16BE;
+      }
+      return FMT_UNKNOWN;
+   }
+
+   // 8-bit text in a code page, the less likely the more the
+   // bytes differ between even and odd offsets.
+   Confidence = static_cast<int>(90 * (1.0 - Spread) * Counts.nInvalid / nNonAscii);
+   return FMT_ANSI;
+}
+
+//----------------------------------------------------------
+// Counts the line feeds in 'n' bytes of input that are not
+// decoded, if the converter is to count them, with the
+// counting kernels where there are any.
+//----------------------------------------------------------
+template <TxEncoding InFmt>
+static void CountLines(TxConverter &Cv, const unsigned char *p, size_t n)
+{
+   if (Cv.bCountLines)
+   {
+      if (InFmt == FMT_UTF16)
+         Kernels.CountUnits16(p, n / 2, Cv.nLines);
+      else if (InFmt == FMT_UTF16BE)
+         Kernels.CountUnits16BE(p, n / 2, Cv.nLines);
+      else if (TxCodec<InFmt>::RUN_BYTES == 4)
+         Cv.nLines += CountLines32(p, n, InFmt);
+      else
+         Kernels.CountUTF8(p, n, Cv.nLines);
+   }
+}
+
+//----------------------------------------------------------
+// Returns how many of the 'n' bytes at 'p' can be passed
+// through as they are (see TxCopy), when line endings are
+// kept, and counts the characters in them.
+//----------------------------------------------------------
+template <TxEncoding InFmt, TxEncoding OutFmt>
+static size_t CopyPrefix(TxConverter &Cv, const unsigned char *p, size_t n)
+{
+   if (!TxCopy<InFmt, OutFmt>::ENABLED || Eol != EOL_KEEP)
+      return 0;
+   size_t Good = TxCopy<InFmt, OutFmt>::Prefix(p, n, Cv.nChars);
+   CountLines<InFmt>(Cv, p, Good);
+   return Good;
+}
+
+//----------------------------------------------------------
+// Converts to ANSI one character at a time, up to and
+// including the first that is not in the code page, for
+// ONERROR_STOP.  ConvertStep() comes here when a chunk it
+// encoded had such a character, with the chunk undone, so
+// that the output and 'Used' end just after it.
+// Returns TX_UNMAPPABLE.
+//----------------------------------------------------------
+template <TxEncoding InFmt>
+static TxResult StopAtUnmappable(TxConverter &Cv, const unsigned char *pIn, size_t InLen,
+   unsigned char *pOut, size_t &Used, size_t &Produced)
+{
+   for (;;)
+   {
+      size_t Took;
+      bool bInvalid;
+      size_t n = DecodeBlock<InFmt>(pIn + Used, InLen - Used, &Cv.Chars[0], 1, Took, bInvalid, Cv.nBad);
+      if (n == 0)
+         return TX_UNMAPPABLE;
+      Used += Took;
+      const unsigned *p = &Cv.Chars[0];
+      Cv.nChars++;
+      Cv.nLines += p[0] == '\n' ? 1 : 0;
+      if (Eol != EOL_KEEP)
+         p = NormalizeEol(p, n, Cv.EolChars, Cv.bAfterCR);
+
+      nUnmappable = 0;
+      Produced += EncodeBlock<FMT_ANSI>(p, n, pOut + Produced);
+      if (nUnmappable > 0)
+      {
+         Cv.nUnmapped += nUnmappable;
+         Cv.StopLen = Took;
+         return TX_UNMAPPABLE;
+      }
+   }
+}
+
+//----------------------------------------------------------
+// Conversion loop for one pair of encodings (see TxConvert).
+// What can be passed through (see TxCopy) is copied; the
+// rest is decoded a chunk of characters at a time into the
+// converter's code point buffer, and encoded from there,
+// while it is still in cache, straight into the output.
+// Chunks are kept small enough for the output to have room
+// for them, so nothing is ever held back in the converter.
+// There is one instance of this for each pair of encodings.
+//----------------------------------------------------------
+template <TxEncoding InFmt, TxEncoding OutFmt>
+static TxResult ConvertStep(TxConverter &Cv, const unsigned char *pIn, size_t InLen,
+   unsigned char *pOut, size_t OutCap, size_t &Used, size_t &Produced)
+{
+   // Most bytes one character can become.
+   const size_t Most = (Eol == EOL_CRLF ? 2 : 1) * TxCodec<OutFmt>::MAX_BYTES;
+
+   Used = Produced = 0;
+   for (;;)
+   {
+      size_t Good = CopyPrefix<InFmt, OutFmt>(Cv, pIn + Used, __min(InLen - Used, OutCap - Produced));
+      if (Good > 0)
+      {
+         memcpy(pOut + Produced, pIn + Used, Good);
+         Used += Good;
+         Produced += Good;
+      }
+      if (Used == InLen)
+         return TX_OK;
+      size_t Room = (OutCap - Produced) / Most;
+      if (Room == 0)
+         return TX_OUTPUT_FULL;
+
+      // What to go back to if a character is not in the code page.
+      const size_t Start = Used, OutStart = Produced, nChars = Cv.nChars, nLines = Cv.nLines;
+      const bool bAfterCR = Cv.bAfterCR;
+
+      size_t Took;
+      bool bInvalid;
+      size_t n = DecodeBlock<InFmt>(pIn + Used, InLen - Used, &Cv.Chars[0], __min(Cv.Chars.size(), Room),
+         Took, bInvalid, Cv.nBad);
+      Used += Took;
+      if (n > 0)
+      {
+         const unsigned *p = &Cv.Chars[0];
+         Cv.nChars += n;
+         Cv.nLines += std::count(p, p + n, static_cast<unsigned>('\n'));
+         if (Eol != EOL_KEEP)
+            p = NormalizeEol(p, n, Cv.EolChars, Cv.bAfterCR);
+
+         nUnmappable = 0;
+         Produced += EncodeBlock<OutFmt>(p, n, pOut + Produced);
+         if (OutFmt == FMT_ANSI && nUnmappable > 0)
+         {
+            if (OnError == ONERROR_STOP)
+            {
+               Used = Start;
+               Produced = OutStart;
+               Cv.nChars = nChars;
+               Cv.nLines = nLines;
+               Cv.bAfterCR = bAfterCR;
+               return StopAtUnmappable<InFmt>(Cv, pIn, InLen, pOut, Used, Produced);
+            }
+            Cv.nUnmapped += nUnmappable;
+         }
+      }
+      if (bInvalid)
+         return TX_INVALID;
+
+      // Nothing decoded means a character cut off by the end
+      // of the input.
+      if (Took == 0)
+         return TX_OK;
+   }
+}
+
+//----------------------------------------------------------
+// Conversion loop between UTF-16 and UTF-16BE when line
+// endings are kept.  These differ only in the order of the
+// two bytes in each code unit, so the input is byte swapped
+// into the output without being decoded, as far as it is
+// well formed.  From a surrogate that is not one of a pair,
+// or a pair cut off by the end of the input or the output,
+// the rest goes through ConvertStep, which deals with it as
+// OnError says or leaves it for the next call.
+//----------------------------------------------------------
+template <TxEncoding InFmt, TxEncoding OutFmt>
+static TxResult SwapStep(TxConverter &Cv, const unsigned char *pIn, size_t InLen,
+   unsigned char *pOut, size_t OutCap, size_t &Used, size_t &Produced)
+{
+   size_t n = __min(InLen, OutCap) & ~static_cast<size_t>(1);
+   size_t Good = ValidUnits16<InFmt>(pIn, n / 2, Cv.nChars) * 2;
+   CountLines<InFmt>(Cv, pIn, Good);
+   Kernels.SwapBytes16(pIn, Good, pOut);
+   if (Good == n)
+   {
+      Used = Produced = n;
+      return InLen - n >= 2 ? TX_OUTPUT_FULL : TX_OK;
+   }
+
+   TxResult Result = ConvertStep<InFmt, OutFmt>(Cv, pIn + Good, InLen - Good, pOut + Good, OutCap - Good,
+      Used, Produced);
+   Used += Good;
+   Produced += Good;
+   return Result;
+}
+
+// Size of the buffer TxMeasure() converts into and throws
+// away, for text the counting doesn't cover.  It is kept
+// small, so that the counting takes over again soon after.
+const size_t MEASURE_SCRATCH = 4 * 1024;
+
+//----------------------------------------------------------
+// Measuring loop for one pair of encodings (see TxMeasure).
+// Text that would be passed through or can be counted (see
+// TxCount) is sized where it is; the rest is converted into
+// the converter's scratch buffer, a little at a time, and
+// the bytes produced counted.
+//----------------------------------------------------------
+template <TxEncoding InFmt, TxEncoding OutFmt>
+static TxResult MeasureStep(TxConverter &Cv, const unsigned char *pIn, size_t InLen, size_t &Used,
+   unsigned long long &Bytes)
+{
+   const bool bCount = TxCount<InFmt, OutFmt>::ENABLED && Eol == EOL_KEEP;
+   if (Cv.Scratch.size() < MEASURE_SCRATCH)
+      Cv.Scratch.resize(MEASURE_SCRATCH);
+
+   Used = 0;
+   for (;;)
+   {
+      size_t Good = CopyPrefix<InFmt, OutFmt>(Cv, pIn + Used, InLen - Used);
+      Used += Good;
+      Bytes += Good;
+      if (bCount)
+      {
+         Good = TxCount<InFmt, OutFmt>::Prefix(pIn + Used, InLen - Used, Cv.nChars, Bytes);
+         CountLines<InFmt>(Cv, pIn + Used, Good);
+         Used += Good;
+      }
+      if (Used == InLen)
+         return TX_OK;
+
+      size_t Took, Produced;
+      TxResult Result = Cv.pStep(Cv, pIn + Used, InLen - Used, &Cv.Scratch[0], Cv.Scratch.size(), Took, Produced);
+      Used += Took;
+      Bytes += Produced;
+      if (Result != TX_OUTPUT_FULL)
+         return Result;
+   }
+}
+
+//----------------------------------------------------------
+// Sets the loops of a converter for the input encoding
+// InFmt and each of the possible outputs.
+// Returns false if OutFmt is not a real encoding.
+//----------------------------------------------------------
+template <TxEncoding InFmt>
+static bool PickSteps(TxConverter &Cv, TxEncoding OutFmt)
+{
+   switch(OutFmt)
+   {
+      case FMT_ANSI:
+         Cv.pStep = ConvertStep<InFmt, FMT_ANSI>;
+         Cv.pCopy = CopyPrefix<InFmt, FMT_ANSI>;
+         Cv.pMeasure = MeasureStep<InFmt, FMT_ANSI>;
+         return true;
+      case FMT_UTF8:
+         Cv.pStep = ConvertStep<InFmt, FMT_UTF8>;
+         Cv.pCopy = CopyPrefix<InFmt, FMT_UTF8>;
+         Cv.pMeasure = MeasureStep<InFmt, FMT_UTF8>;
+         return true;
+      case FMT_UTF16:
+         Cv.pStep = ConvertStep<InFmt, FMT_UTF16>;
+         Cv.pCopy = CopyPrefix<InFmt, FMT_UTF16>;
+         Cv.pMeasure = MeasureStep<InFmt, FMT_UTF16>;
+         if (InFmt == FMT_UTF16BE && Eol == EOL_KEEP)
+            Cv.pStep = SwapStep<InFmt, FMT_UTF16>;
+         return true;
+      case FMT_UTF16BE:
+         Cv.pStep = ConvertStep<InFmt, FMT_UTF16BE>;
+         Cv.pCopy = CopyPrefix<InFmt, FMT_UTF16BE>;
+         Cv.pMeasure = MeasureStep<InFmt, FMT_UTF16BE>;
+         if (InFmt == FMT_UTF16 && Eol == EOL_KEEP)
+            Cv.pStep = SwapStep<InFmt, FMT_UTF16BE>;
+         return true;
+      case FMT_UTF32:
+         Cv.pStep = ConvertStep<InFmt, FMT_UTF32>;
+         Cv.pCopy = CopyPrefix<InFmt, FMT_UTF32>;
+         Cv.pMeasure = MeasureStep<InFmt, FMT_UTF32>;
+         return true;
+      case FMT_UTF32BE:
+         Cv.pStep = ConvertStep<InFmt, FMT_UTF32BE>;
+         Cv.pCopy = CopyPrefix<InFmt, FMT_UTF32BE>;
+         Cv.pMeasure = MeasureStep<InFmt, FMT_UTF32BE>;
+         return true;
+      default:
+         return false;
+   }
+}
+
+//----------------------------------------------------------
+// Prepares a converter from InFmt to OutFmt.  The loops for
+// the pair are chosen once, here, rather than per character.
+// Returns false if either is not a real encoding.
+//----------------------------------------------------------
+bool TxInitConverter(TxConverter &Cv, TxEncoding InFmt, TxEncoding OutFmt)
+{
+   Cv.InFmt = InFmt;
+   Cv.OutFmt = OutFmt;
+   Cv.pStep = NULL;
+   Cv.pCopy = NULL;
+   Cv.pMeasure = NULL;
+   Cv.bCountLines = true;
+   Cv.bAfterCR = false;
+   Cv.nChars = Cv.nLines = Cv.nBad = Cv.nUnmapped = 0;
+   Cv.StopLen = 0;
+   Cv.Chars.resize(CHUNK_SIZE);
+
+   switch(InFmt)
+   {
+      case FMT_ANSI:       return PickSteps<FMT_ANSI>(Cv, OutFmt);
+      case FMT_UTF8:       return PickSteps<FMT_UTF8>(Cv, OutFmt);
+      case FMT_UTF16:      return PickSteps<FMT_UTF16>(Cv, OutFmt);
+      case FMT_UTF16BE:    return PickSteps<FMT_UTF16BE>(Cv, OutFmt);
+      case FMT_UTF32:      return PickSteps<FMT_UTF32>(Cv, OutFmt);
+      case FMT_UTF32BE:    return PickSteps<FMT_UTF32BE>(Cv, OutFmt);
+      default:             return false;
+   }
+}
+
+//----------------------------------------------------------
+// Converts as much of the input as will fit in the output.
+// See txulib.h.
+//----------------------------------------------------------
+TxResult TxConvert(
+   TxConverter &Cv,
+   const void *pIn,
+   size_t InLen,
+   void *pOut,
+   size_t OutCap,
+   size_t &Used,
+   size_t &Produced
+   )
+{
+   return Cv.pStep(Cv, static_cast<const unsigned char *>(pIn), InLen,
+      static_cast<unsigned char *>(pOut), OutCap, Used, Produced);
+}
+
+//----------------------------------------------------------
+// Ends a conversion:  the 'InLen' bytes TxConvert() left at
+// the end of the input, part of a character, are one more
+// invalid sequence.  See txulib.h.
+//----------------------------------------------------------
+TxResult TxFinish(
+   TxConverter &Cv,
+   size_t InLen,
+   void *pOut,
+   size_t OutCap,
+   size_t &Produced
+   )
+{
+   Produced = 0;
+   if (InLen == 0)
+      return TX_OK;
+   if (OnError == ONERROR_STOP)
+      return TX_INVALID;
+
+   if (OnError == ONERROR_REPLACE)
+   {
+      const unsigned Replacement = 0xFFFD;
+      unsigned char Bytes[8];
+      nUnmappable = 0;
+      size_t n = TxEncodeChars(Cv.OutFmt, &Replacement, 1, Bytes);
+      if (n > OutCap)
+         return TX_OUTPUT_FULL;
+      memcpy(pOut, Bytes, n);
+      Produced = n;
+      Cv.nChars++;
+      Cv.nUnmapped += nUnmappable;
+      Cv.bAfterCR = false;
+   }
+   Cv.nBad++;
+   return TX_OK;
+}
+
+//----------------------------------------------------------
+// Returns how many bytes at the start of the input can be
+// written out as they are.  See txulib.h.
+//----------------------------------------------------------
+size_t TxCopyPrefix(TxConverter &Cv, const void *pIn, size_t InLen)
+{
+   return Cv.pCopy(Cv, static_cast<const unsigned char *>(pIn), InLen);
+}
+
+//----------------------------------------------------------
+// Works out how many bytes the input would take in the
+// output.  See txulib.h.
+//----------------------------------------------------------
+TxResult TxMeasure(
+   TxConverter &Cv,
+   const void *pIn,
+   size_t InLen,
+   size_t &Used,
+   unsigned long long &Bytes
+   )
+{
+   return Cv.pMeasure(Cv, static_cast<const unsigned char *>(pIn), InLen, Used, Bytes);
+}
+
+//----------------------------------------------------------
+// Counts the characters and line feeds in text without
+// decoding it.  See txulib.h.
+//----------------------------------------------------------
+size_t TxCountText(TxEncoding Fmt, const void *pIn, size_t InLen, size_t &nChars, size_t &nLines)
+{
+   const unsigned char *p = static_cast<const unsigned char *>(pIn);
+   size_t nUnits = InLen / 2;
+   switch(Fmt)
+   {
+      case FMT_ANSI:
+         // Every byte is a character.  Only the lines are
+         // wanted from the kernel.
+         Kernels.CountUTF8(p, InLen, nLines);
+         nChars += InLen;
+         return InLen;
+      case FMT_UTF8:
+         nChars += Kernels.CountUTF8(p, InLen, nLines);
+         return InLen;
+      case FMT_UTF16:
+         nChars += Kernels.CountUnits16(p, nUnits, nLines);
+         return nUnits * 2;
+      case FMT_UTF16BE:
+         nChars += Kernels.CountUnits16BE(p, nUnits, nLines);
+         return nUnits * 2;
+      case FMT_UTF32:
+      case FMT_UTF32BE:
+         // Every unit is a character.
+         nUnits = InLen / 4;
+         nLines += CountLines32(p, nUnits * 4, Fmt);
+         nChars += nUnits;
+         return nUnits * 4;
+      default:
+         return 0;
+   }
+}
+
+//----------------------------------------------------------
+// True if text is copied or byte swapped, at least in part,
+// rather than decoded, between the given encodings.
+//----------------------------------------------------------
+bool TxPassesThrough(TxEncoding InFmt, TxEncoding OutFmt)
+{
+   if (Eol != EOL_KEEP)
+      return false;
+   return InFmt == OutFmt ||
+      (InFmt == FMT_ANSI && OutFmt == FMT_UTF8) || (InFmt == FMT_UTF8 && OutFmt == FMT_ANSI) ||
+      (InFmt == FMT_UTF16 && OutFmt == FMT_UTF16BE) || (InFmt == FMT_UTF16BE && OutFmt == FMT_UTF16);
+}
+
+//----------------------------------------------------------
+// Returns a place to split the input near 'Pos':  the start
+// of a character, moved past a LF found there so that a
+// CR LF is never split.
+//----------------------------------------------------------
+template <TxEncoding Fmt>
+static size_t SplitAt(const unsigned char *p, size_t n, size_t Pos)
+{
+   Pos = TxCodec<Fmt>::SplitPoint(p, Pos);
+   unsigned Char;
+   size_t Used;
+   if (Pos < n && TxCodec<Fmt>::Decode(p + Pos, n - Pos, Char, Used) == DEC_OK && Char == '\n')
+      Pos += Used;
+   return Pos;
+}
+
+size_t TxSplitPoint(TxEncoding Fmt, const void *p, size_t n, size_t Pos)
+{
+   const unsigned char *pBytes = static_cast<const unsigned char *>(p);
+   switch(Fmt)
+   {
+      case FMT_ANSI:       return SplitAt<FMT_ANSI>(pBytes, n, Pos);
+      case FMT_UTF8:       return SplitAt<FMT_UTF8>(pBytes, n, Pos);
+      case FMT_UTF16:      return SplitAt<FMT_UTF16>(pBytes, n, Pos);
+      case FMT_UTF16BE:    return SplitAt<FMT_UTF16BE>(pBytes, n, Pos);
+      case FMT_UTF32:      return SplitAt<FMT_UTF32>(pBytes, n, Pos);
+      case FMT_UTF32BE:    return SplitAt<FMT_UTF32BE>(pBytes, n, Pos);
+      default:             return Pos;
+   }
+}
+
+//----------------------------------------------------------
+// Encodes a run of code points in the given encoding, into
+// room for 4 bytes each.
+// Returns the number of bytes placed in pOut.
+//----------------------------------------------------------
+size_t TxEncodeChars(TxEncoding Fmt, const unsigned *pChars, size_t n, void *pOut)
+{
+   unsigned char *p = static_cast<unsigned char *>(pOut);
+   switch(Fmt)
+   {
+      case FMT_ANSI:       return EncodeBlock<FMT_ANSI>(pChars, n, p);
+      case FMT_UTF8:       return EncodeBlock<FMT_UTF8>(pChars, n, p);
+      case FMT_UTF16:      return EncodeBlock<FMT_UTF16>(pChars, n, p);
+      case FMT_UTF16BE:    return EncodeBlock<FMT_UTF16BE>(pChars, n, p);
+      case FMT_UTF32:      return EncodeBlock<FMT_UTF32>(pChars, n, p);
+      case FMT_UTF32BE:    return EncodeBlock<FMT_UTF32BE>(pChars, n, p);
+      default:             return 0;
+   }
+}
+
+// End txulib.cpp
@@ -0,0 +1,262 @@
+//---------------------------------------------------------------
+// txulib.h
+// libtxu:  the conversion engine of txu as a library, for
+// programs that convert text between the ANSI, UTF-8, UTF-16
+// and UTF-32 character formats in memory instead of running
+// txu on files.
+//
+// Text is converted from the caller's input buffer straight
+// into the caller's output buffer, a call at a time, with a
+// TxConverter holding what must be remembered between calls.
+//
+// (C) Copyright 2011 Ammon R. Campbell.
+// You may use this program freely for non-commercial purposes
+// provided you do so entirely at your own risk.  Commercial
+// use is not permitted without the author's express consent.
+//---------------------------------------------------------------
+
+#ifndef TXULIB_H
+#define TXULIB_H
+
+#include <stddef.h>
+#include "txuport.h"
+#include <vector>
+
+// Type to indicate one of several possible encodings for a text file.
+enum TxEncoding
+{
+   FMT_UNKNOWN = 0,        // Encoding is not known, not initialized, error, etc.
+   FMT_AUTO,               // An attempt should be made to automatically
+                           // determine the encoding of the text.
+   FMT_ANSI,               // Old fashioned 8-bit ANSI ASCII text.
+   FMT_UTF8,               // UTF-8 encoding.  The width of a character varies.
+   FMT_UTF16,              // UTF-16 little endian encoding.
+   FMT_UTF16BE,            // UTF-16 big endian encoding.
+   FMT_UTF32,              // UTF-32 little endian encoding.
+   FMT_UTF32BE             // UTF-32 big endian encoding.
+};
+
+// What to do about invalid input (/ONERROR).
+enum TxOnError
+{
+   ONERROR_STOP = 0,       // Report the error and stop converting the file.
+   ONERROR_REPLACE,        // Put U+FFFD in place of each invalid sequence.
+   ONERROR_SKIP            // Leave invalid sequences out of the output.
+};
+
+// How a whole file is compressed, if it is (/COMPRESS).
+enum TxCompression
+{
+   COMPRESS_NONE = 0,      // Not compressed.
+   COMPRESS_GZIP,          // gzip (RFC 1952).
+   COMPRESS_ZSTD           // Zstandard (RFC 8878).
+};
+
+// Line endings written (/EOL).
+enum TxEol
+{
+   EOL_KEEP = 0,           // As in the input.
+   EOL_LF,                 // Each CR LF, CR or LF becomes LF.
+   EOL_CRLF,               // ... becomes CR LF.
+   EOL_CR                  // ... becomes CR.
+};
+
+// Settings shared by every conversion in the process.  Set
+// them before setting up a converter, and leave them alone
+// while it is in use.
+extern TxOnError OnError;  // What to do about invalid input.
+extern TxEol     Eol;      // Line endings written.
+
+// Names of the encodings.
+const _TCHAR * TxEncodingToName(TxEncoding t);
+TxEncoding TxEncodingFromName(const _TCHAR *t);
+
+// SIMD kernels for the ASCII fast path:  AUTO, NONE, SSE2,
+// AVX2 or NEON.  The best the CPU supports is used unless
+// SelectKernels() is called.
+bool SelectKernels(const _TCHAR *Name);
+const _TCHAR * KernelsName(void);
+
+// Code page of ANSI text, by its Windows number.  ISO 8859-1
+// (28591) is used unless SelectCodePage() is called.
+bool SelectCodePage(unsigned Number);
+unsigned CodePageNumber(void);
+const _TCHAR * CodePageName(void);
+
+// True if every byte is a character in the code page, so
+// that any text is valid ANSI.
+bool CodePageHasEveryByte(void);
+
+//----------------------------------------------------------
+// Encoding detection.  CheckBOM() looks for a byte order
+// mark; DetectEncoding() works out the encoding of text
+// without one from samples:  the first DETECT_HEAD bytes,
+// and DETECT_SAMPLES samples of DETECT_SAMPLE bytes spread
+// evenly through the rest, each starting at the index in
+// 'Sample' given by 'Starts'.
+//
+// CheckCompression() looks for the magic number of a
+// compressed file, which must be decompressed before there
+// is any text to look for a BOM in.
+//----------------------------------------------------------
+const size_t DETECT_HEAD = 64 * 1024;
+const size_t DETECT_SAMPLE = 4 * 1024;
+const size_t DETECT_SAMPLES = 8;
+
+TxEncoding CheckBOM(const unsigned char *ch, size_t bytes, size_t &BOMLen);
+TxCompression CheckCompression(const unsigned char *ch, size_t bytes);
+TxEncoding DetectEncoding(
+   const std::vector<unsigned char> &Sample,
+   const std::vector<size_t> &Starts,
+   int &Confidence
+   );
+
+//----------------------------------------------------------
+// Conversion.  TxInitConverter() sets up a converter for a
+// pair of encodings; each call of TxConvert() then converts
+// as much of the input as it can into the output, and sets
+// 'Used' and 'Produced' to the number of bytes it took and
+// gave.  The output needs room for at least 8 bytes.
+// A converter can be set up again for the next text, and
+// keeps the buffers it has grown, so once it has been used
+// for a while none of these calls allocates memory.
+//
+// A character cut off by the end of the input is left
+// unused, to be passed again at the start of the next call
+// along with the rest of it.  Anything else the converter
+// needs to carry on, such as a CR whose LF may be in the
+// next input, is kept in the TxConverter.  At the end of the
+// input, TxFinish() deals with whatever TxConvert() left
+// unused there as OnError says, so that a last character cut
+// off by the end of a file is reported, replaced or skipped
+// like any other invalid input rather than lost.
+//
+// TxCopyPrefix() is for callers that can write the input out
+// as it is:  it returns how many bytes at the start of the
+// input are also the output, when the encodings are the
+// same or for ASCII between ANSI and UTF-8, and counts them
+// as converted.  The caller then writes them itself and
+// passes the rest to TxConvert(), so that they are never
+// copied at all.
+//----------------------------------------------------------
+
+// How a call of TxConvert() ended.
+enum TxResult
+{
+   TX_OK = 0,              // All the input was converted, except perhaps a
+                           // character cut off by its end.
+   TX_OUTPUT_FULL,         // The output buffer is full; call again.
+   TX_INVALID,             // Stopped at invalid input (ONERROR_STOP).  'Used'
+                           // ends at the start of the invalid sequence.
+                           // From TxFinish(), the input ended mid-character.
+   TX_UNMAPPABLE           // Stopped just after converting a character that is
+                           // not in the code page (ONERROR_STOP).  'Used' and
+                           // 'Produced' end just after it, and the converter's
+                           // StopLen is the number of bytes it took in pIn.
+};
+
+struct TxConverter;
+
+// Conversion loop for one pair of encodings.
+typedef TxResult (*TxStepFn)(TxConverter &Cv, const unsigned char *pIn, size_t InLen,
+   unsigned char *pOut, size_t OutCap, size_t &Used, size_t &Produced);
+
+// Passthrough test for one pair of encodings.
+typedef size_t (*TxCopyFn)(TxConverter &Cv, const unsigned char *pIn, size_t InLen);
+
+// Measuring loop for one pair of encodings.
+typedef TxResult (*TxMeasureFn)(TxConverter &Cv, const unsigned char *pIn, size_t InLen, size_t &Used,
+   unsigned long long &Bytes);
+
+// State of a conversion, kept between calls.
+struct TxConverter
+{
+   TxEncoding             InFmt;       // Encoding of the input.
+   TxEncoding             OutFmt;      // Encoding of the output.
+   TxStepFn               pStep;       // Conversion loop for the pair.
+   TxCopyFn               pCopy;       // Passthrough test for the pair.
+   TxMeasureFn            pMeasure;    // Measuring loop for the pair.
+   bool                   bCountLines; // Count lines in text passed through too (default).
+   bool                   bAfterCR;    // True if the last character was a CR.
+   size_t                 nChars;      // Number of characters converted.
+   size_t                 nLines;      // Number of line feeds converted.
+   size_t                 nBad;        // Number of invalid sequences replaced or skipped.
+   size_t                 nUnmapped;   // Number of characters not in the code page.
+   size_t                 StopLen;     // Bytes of the character TX_UNMAPPABLE stopped after.
+   std::vector<unsigned>  Chars;       // Decoded code points, between the two steps.
+   std::vector<unsigned>  EolChars;    // Characters with line endings changed (Eol).
+   std::vector<unsigned char> Scratch; // Output thrown away by TxMeasure().
+};
+
+bool TxInitConverter(TxConverter &Cv, TxEncoding InFmt, TxEncoding OutFmt);
+TxResult TxConvert(
+   TxConverter &Cv,        // Conversion state.
+   const void *pIn,        // Bytes to be converted.
+   size_t InLen,           // Number of bytes at pIn.
+   void *pOut,             // Receives the converted bytes.
+   size_t OutCap,          // Capacity of pOut, in bytes.
+   size_t &Used,           // Receives number of bytes taken from pIn.
+   size_t &Produced        // Receives number of bytes placed in pOut.
+   );
+TxResult TxFinish(
+   TxConverter &Cv,        // Conversion state.
+   size_t InLen,           // Number of bytes left unused at the end of the input.
+   void *pOut,             // Receives the converted bytes.
+   size_t OutCap,          // Capacity of pOut, in bytes.
+   size_t &Produced        // Receives number of bytes placed in pOut.
+   );
+size_t TxCopyPrefix(TxConverter &Cv, const void *pIn, size_t InLen);
+
+// True if text is copied or byte swapped, at least in part,
+// rather than decoded, between the given encodings.
+bool TxPassesThrough(TxEncoding InFmt, TxEncoding OutFmt);
+
+//----------------------------------------------------------
+// Measuring.  TxMeasure() goes through the input like
+// TxConvert(), with the same counts and the same results,
+// but adds the number of bytes the output would take to
+// 'Bytes' instead of producing it, and never fills up.  As
+// with TxConvert(), a character cut off by the end of the
+// input is left unused, for TxFinish() at the end.
+//
+// For valid input, with line endings kept, the output of
+// most pairs of encodings is sized without converting it:
+// the same encoding in and out, UTF-8 and UTF-16 either way,
+// UTF-8 to UTF-32, and ANSI to the rest.  Any other text is
+// converted a little at a time into a small buffer and
+// thrown away.
+//----------------------------------------------------------
+TxResult TxMeasure(
+   TxConverter &Cv,        // Conversion state.
+   const void *pIn,        // Bytes to be measured.
+   size_t InLen,           // Number of bytes at pIn.
+   size_t &Used,           // Receives number of bytes taken from pIn.
+   unsigned long long &Bytes  // Output size is added to this.
+   );
+
+//----------------------------------------------------------
+// Counting.  TxCountText() adds the number of characters and
+// of line feeds in 'InLen' bytes of text to 'nChars' and
+// 'nLines', without decoding or checking it:  a character is
+// each byte of ANSI, each byte of UTF-8 that is not 10xxxxxx,
+// each UTF-16 unit that is not a low surrogate, and each
+// UTF-32 unit, so the counts are those of a conversion for
+// valid text.  Text can be counted in pieces split anywhere,
+// except that part of a unit at the end of UTF-16 or UTF-32
+// is left for the next piece.
+// Returns the number of bytes counted.
+//----------------------------------------------------------
+size_t TxCountText(TxEncoding Fmt, const void *pIn, size_t InLen, size_t &nChars, size_t &nLines);
+
+// Returns a place near 'Pos' in the 'n' bytes at 'p' where
+// they can be split for converting the two parts apart:  the
+// start of a character, and never between a CR and a LF.
+size_t TxSplitPoint(TxEncoding Fmt, const void *p, size_t n, size_t Pos);
+
+// Encodes 'n' code points, into room for 4 bytes each.
+// Returns the number of bytes placed in pOut.
+size_t TxEncodeChars(TxEncoding Fmt, const unsigned *pChars, size_t n, void *pOut);
+
+#endif // TXULIB_H
+
+// End txulib.h
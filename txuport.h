@@ -0,0 +1,78 @@
+//---------------------------------------------------------------
+// txuport.h
+// Platform layer for txu and libtxu.  They are written to the
+// Microsoft C runtime, with the generic text (_TCHAR) names of
+// <tchar.h> and a few helpers of its own.  Elsewhere, such as
+// with GCC or Clang on Linux, this maps those names onto the
+// standard C library, for narrow (UTF-8) strings.  What else
+// differs, such as mapping files and listing directories, is
+// chosen where it is used, by _WIN32.
+//
+// (C) Copyright 2011 Ammon R. Campbell.
+// You may use this program freely for non-commercial purposes
+// provided you do so entirely at your own risk.  Commercial
+// use is not permitted without the author's express consent.
+//---------------------------------------------------------------
+
+#ifndef TXUPORT_H
+#define TXUPORT_H
+
+#ifdef _WIN32
+
+#include <tchar.h>
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+typedef char _TCHAR;
+#define _T(x)          x
+
+#define _tcslen        strlen
+#define _tcscmp        strcmp
+#define _tcsicmp       strcasecmp
+#define _tcstoul       strtoul
+#define _tprintf       printf
+#define _ftprintf      fprintf
+#define _fgetts        fgets
+#define _ftscanf       fscanf
+#define _tremove       remove
+
+#ifndef __min
+#define __min(a, b)    (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef __max
+#define __max(a, b)    (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef _countof
+#define _countof(a)    (sizeof(a) / sizeof((a)[0]))
+#endif
+
+// Opens a file as fopen() does.  Returns 0 if successful, or
+// the error number if not.
+static inline int _tfopen_s(FILE **pfp, const char *Name, const char *Mode)
+{
+   *pfp = fopen(Name, Mode);
+   return *pfp != NULL ? 0 : errno;
+}
+
+// Copies a string, cut short if need be to fit in 'Size'
+// characters.
+static inline int _tcscpy_s(char *pDest, size_t Size, const char *pSrc)
+{
+   if (Size == 0)
+      return EINVAL;
+   strncpy(pDest, pSrc, Size - 1);
+   pDest[Size - 1] = '\0';
+   return 0;
+}
+
+#endif // _WIN32
+
+#endif // TXUPORT_H
+
+// End txuport.h